@@ -0,0 +1,76 @@
+#ifndef ADJACENCY_VIEW_H
+#define ADJACENCY_VIEW_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include "tsv_reader.h"
+
+using namespace std;
+
+struct CsrGraph;
+
+// Neighbour ids of one node, pointing into the arrays of a view.
+struct NeighborRange {
+    const int* first = nullptr;
+    const int* last = nullptr;
+
+    const int* begin() const { return first; }
+    const int* end() const { return last; }
+    size_t size() const { return (size_t)(last - first); }
+    bool empty() const { return first == last; }
+    int operator[](size_t i) const { return first[i]; }
+};
+
+// Read-only CSR adjacency indexed by user id: the neighbours of u are
+// cols[offsets[u] .. offsets[u+1]). It views a CsrGraph or a mapped
+// adjacency.bin without owning either, so copies are cheap; the arrays must
+// outlive it.
+class AdjacencyView {
+public:
+    AdjacencyView() = default;
+    explicit AdjacencyView(const CsrGraph& graph);
+    AdjacencyView(const uint64_t* offsets, const int* cols, int num_nodes);
+
+    int num_nodes() const { return n; }
+    size_t num_edges() const { return n ? (size_t)offs[n] : 0; }
+    bool has_node(int u) const { return u >= 0 && u < n; }
+    NeighborRange neighbors(int u) const;
+    size_t degree(int u) const { return neighbors(u).size(); }
+
+    // Same arrays with the neighbours of the nodes in rows replaced, e.g. to
+    // hold some friends out without copying the graph. rows must outlive the
+    // view and may change while it is in use.
+    AdjacencyView with_overrides(const unordered_map<int, vector<int>>* rows) const;
+
+    const uint64_t* offsets() const { return offs; }  // num_nodes() + 1, overrides not applied
+    const int* cols() const { return neigh; }
+
+private:
+    const uint64_t* offs = nullptr;
+    const int* neigh = nullptr;
+    int n = 0;
+    const unordered_map<int, vector<int>>* overrides = nullptr;
+};
+
+// adjacency.bin, written by GraphBuilder::save_binary:
+//   "PKAJ" | version | num_nodes (u64) | num_edges (u64)
+//   | offsets: num_nodes + 1 u64 | neighbour ids: num_edges u32
+bool write_adjacency_bin(const string& path, const CsrGraph& graph);
+
+// adjacency.bin mapped read-only; its view stays valid until close().
+class AdjacencyFile {
+public:
+    bool open(const string& path);
+    void close();
+    bool is_open() const { return file.is_open(); }
+    AdjacencyView view() const { return adj; }
+
+private:
+    MappedFile file;
+    AdjacencyView adj;
+};
+
+#endif
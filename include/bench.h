@@ -0,0 +1,29 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+
+// Runs the regex club-link extraction and scan_club_links over the first
+// max_lines profile lines, reports mismatches and timings for each mode.
+void run_club_scanner_bench(const std::string& profiles_tsv, size_t max_lines);
+
+// Lemmatizes every text-column token of the first max_lines profile lines with
+// the original byte-tree walk and with the flattened tree (one word at a time
+// and batched), reports mismatches against the original and timings.
+void run_lemmatizer_bench(const std::string& model_path, const std::string& profiles_tsv, size_t max_lines);
+
+// Builds vocab, users.bin and profiles from the first max_lines profile lines
+// once per VocabOptions preset (min-df/max-df pruning, stopwords, hashing),
+// reports vocab ids, token entries per user, profile_similarity time and the
+// holdout hit rates, and how much interest hit rate each preset loses.
+void run_vocab_options_bench(const std::string& profiles_tsv, const std::string& relationships,
+                             const std::string& model_path, const std::vector<std::string>& text_columns,
+                             const std::string& stopwords_path, size_t max_lines);
+
+// Decodes every record of users.bin once per RecordMask (everything, the
+// fixed fields only, clubs, three token columns) and reports decode time per
+// record and the words each mask decodes.
+void run_record_decode_bench(const std::string& users_bin, const std::string& users_idx, size_t num_text_columns);
+
+#endif
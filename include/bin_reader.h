@@ -2,9 +2,11 @@
 #define BIN_READER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_map>
 #include <cstdint>
+#include <cstddef>
+#include "tsv_reader.h"
 
 using namespace std;
 
@@ -13,16 +15,156 @@ struct UserRecord {
     uint32_t ispublic;
     uint32_t completion_percentage;
     uint32_t gender;
-    vector<uint32_t> region; 
-    uint32_t age;   
+    vector<uint32_t> region;
+    uint32_t age;
     vector<uint32_t> clubs;
     vector<vector<pair<uint32_t,uint32_t>>> token_cols;
 };
 
-bool load_index_map(const string& idx_path,
-                    unordered_map<int, pair<uint32_t,uint32_t> >& out_idx);
-bool read_user_record(const string& bin_path,
-                      const unordered_map<int, pair<uint32_t,uint32_t> >& idx_map,
-                      int user_id, UserRecord& out_rec);
+// users.bin and users.idx headers; the formats are described in serializer.h.
+static const char USERS_BIN_MAGIC[4] = { 'P', 'K', 'U', 'R' };
+static const uint32_t USERS_BIN_VERSION = 3;
+static const size_t USERS_BIN_HEADER_SIZE = 8;
+static const char USERS_IDX_MAGIC[4] = { 'P', 'K', 'U', 'X' };
+static const uint32_t USERS_IDX_VERSION = 1;
+static const size_t USERS_IDX_HEADER_SIZE = 32;
+static const uint32_t USERS_IDX_DIRECT = 0;  // table indexed by user id
+static const uint32_t USERS_IDX_SORTED = 1;  // table of entries ordered by user id
+static const uint32_t USERS_IDX_NONE = 0xFFFFFFFFu;
+
+// One users.idx entry, stored as is.
+struct UsersIndexEntry {
+    int32_t user_id;
+    uint32_t length;
+    uint64_t offset;
+};
+
+// True if file starts with a users.bin header of this version.
+bool users_bin_header_ok(string_view file);
+
+// Decodes one record of len bytes at p, e.g. from a mapped users.bin.
+// False if the counts run past len.
+bool parse_user_record(const char* p, size_t len, UserRecord& out_rec);
+
+struct U32Span {
+    const uint32_t* data = nullptr;
+    uint32_t size = 0;
+
+    const uint32_t* begin() const { return data; }
+    const uint32_t* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+    uint32_t operator[](size_t i) const { return data[i]; }
+};
+
+// (token id, count) pairs of one column, interleaved as in the record.
+struct TokenPairSpan {
+    const uint32_t* data = nullptr;
+    uint32_t size = 0;
+
+    bool empty() const { return size == 0; }
+    uint32_t token(size_t i) const { return data[2 * i]; }
+    uint32_t count(size_t i) const { return data[2 * i + 1]; }
+};
+
+// A decoded record whose spans point into its own words buffer. Reusing
+// one view keeps that storage, so decoding allocates nothing once it has
+// seen the largest record.
+struct UserRecordView {
+    uint32_t user_id = 0;
+    uint32_t ispublic = 0;
+    uint32_t completion_percentage = 0;
+    uint32_t gender = 0;
+    uint32_t age = 0;
+    U32Span region;
+    U32Span clubs;
+    vector<TokenPairSpan> token_cols;
+    vector<uint32_t> words;  // backing store of the spans
+};
+
+// Parts of a record to decode. The fixed fields (ids, flags, region, age)
+// always are; clubs and token columns left out are skipped by their section
+// length and read as empty. The default decodes everything.
+class RecordMask {
+public:
+    static RecordMask all() { return RecordMask(); }
+    static RecordMask fixed_only() {
+        RecordMask m;
+        m.every = false;
+        return m;
+    }
+    RecordMask& add_clubs() {
+        with_clubs = true;
+        return *this;
+    }
+    RecordMask& add_tokens(size_t col) {
+        if (col >= cols.size()) cols.resize(col + 1, false);
+        cols[col] = true;
+        return *this;
+    }
+
+    bool clubs() const { return every || with_clubs; }
+    bool tokens(size_t col) const { return every || (col < cols.size() && cols[col]); }
+
+private:
+    bool every = true;
+    bool with_clubs = false;
+    vector<bool> cols;
+};
+
+bool parse_user_record_view(const char* p, size_t len, UserRecordView& out, const RecordMask& mask = RecordMask());
+
+// users.idx mapped read-only.
+class UsersIndex {
+public:
+    bool open(const string& path);
+    void close();
+    bool is_open() const { return file.is_open(); }
+
+    // Entries in record order.
+    size_t size() const { return n; }
+    const UsersIndexEntry& operator[](size_t i) const { return entries[i]; }
+    // Entry number of user_id, the later one if it was indexed twice, or -1.
+    // O(1) with a direct table, a binary search with a sorted one.
+    int find(int user_id) const;
+    bool is_direct() const { return layout == USERS_IDX_DIRECT; }
+
+private:
+    MappedFile file;
+    const UsersIndexEntry* entries = nullptr;
+    const uint32_t* table = nullptr;
+    size_t n = 0;
+    size_t table_size = 0;
+    uint32_t layout = USERS_IDX_DIRECT;
+};
+
+// users.bin and its users.idx, both mapped, for random access by user id.
+class UserRecordReader {
+public:
+    bool open(const string& users_bin, const string& users_idx);
+    void close();
+    bool is_open() const { return bin.is_open(); }
+
+    // Records in users.idx order.
+    size_t size() const { return index.size(); }
+    int user_id_at(size_t i) const { return index[i].user_id; }
+    bool read_at(size_t i, UserRecordView& out, const RecordMask& mask = RecordMask()) const;
+
+    bool contains(int user_id) const { return index.find(user_id) >= 0; }
+    // False if user_id is not indexed or its record is corrupt.
+    bool read(int user_id, UserRecordView& out, const RecordMask& mask = RecordMask()) const;
+    // out[k] is the record of ids[k], user_id 0 where read() would fail.
+    // Lookups come first, then the pages are requested and the records
+    // decoded in file order, so a batch costs one pass over the file.
+    // Returns the number of records found.
+    size_t read_many(const int* ids, size_t n, vector<UserRecordView>& out,
+                     const RecordMask& mask = RecordMask()) const;
+    size_t read_many(const vector<int>& ids, vector<UserRecordView>& out, const RecordMask& mask = RecordMask()) const {
+        return read_many(ids.data(), ids.size(), out, mask);
+    }
+
+private:
+    MappedFile bin;
+    UsersIndex index;
+};
 
 #endif
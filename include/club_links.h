@@ -0,0 +1,24 @@
+#ifndef CLUB_LINKS_H
+#define CLUB_LINKS_H
+
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// What counts as a club link; each mode reproduces one of the regexes used before:
+//   ClubHref   href="/klub/([^"]+)"
+//   ClubTag    <a[^>]*href="/klub/([^"]+)"[^>]*>
+//   ClubAnchor <a[^>]*href="/klub/([^"]+)"[^>]*>([^<]*)</a>
+enum ClubScanMode { ClubHref, ClubTag, ClubAnchor };
+
+struct ClubLink {
+    string_view slug;   // raw slug from the href, not normalized
+    string_view title;  // anchor text, ClubAnchor only
+};
+
+// Appends every non-overlapping match in text, left to right, to out.
+// The views point into text.
+void scan_club_links(string_view text, ClubScanMode mode, vector<ClubLink>& out);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef DELTA_INGEST_H
+#define DELTA_INGEST_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Tokenizer;
+struct Lemmatiser;
+struct VocabOptions;
+
+// Applies delta files to the stores a full run left in data_dir (vocab CSVs,
+// adjacency.bin, users.bin/users.idx and users_encoded.csv when exported)
+// instead of rebuilding them.
+//
+// profiles_delta: rows in the profiles TSV format, new users or full
+//   replacements of existing ones. Vocab maps are extended with fresh ids,
+//   so existing ids stay valid; docfreq drops the replaced rows' terms.
+// edges_delta: "src<ws>dst" lines of new relationships; edges already in the
+//   graph are skipped.
+// opts must be the options the vocab was built with; new tokens are pruned
+// against the delta's own document counts.
+// Either path may be empty. Only users with a new profile row are
+// re-encoded: their records are appended to users.bin and users.idx points
+// at them instead; the old records are left in place until the next full
+// run. Friend lists come from adjacency.bin, so new edges touch no record.
+// The stores keep their stamps, so the next run_pipeline uses them as they
+// are; the stamps of median_age.txt and column_normalizers.csv are dropped
+// so that those are recomputed from the new profiles, and serving.snap is
+// deleted.
+bool ingest_delta(const string& data_dir,
+                  const vector<string>& text_columns,
+                  const string& profiles_delta,
+                  const string& edges_delta,
+                  Tokenizer& tok,
+                  Lemmatiser& lem,
+                  const VocabOptions& opts);
+
+#endif
@@ -2,13 +2,18 @@
 #define ENCODER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
 #include <unordered_map>
+#include <unordered_set>
+#include "adjacency_view.h"
 
 using namespace std;
 
 struct Tokenizer;
 struct Lemmatiser;
+struct UserRecord;
 
 struct Encoder {
     Encoder(
@@ -18,9 +23,35 @@ struct Encoder {
         const unordered_map<string,int>& address_part1_to_id,
         const unordered_map<string,int>& address_part2_to_id,
         const unordered_map<string,int>& address_part3_to_id,
-        const unordered_map<int, vector<int>>& adjacency_in);
+        const AdjacencyView& adjacency_in);
 
-    void pass2(const string& profiles_tsv, const string& out_users_csv);
+    // Streams rows through a reader -> num_threads workers -> ordered writer pipeline
+    // and writes the users.bin records (see serializer.h) with their index.
+    // num_threads == 0 uses all hardware threads.
+    bool pass2(const string& profiles_tsv, const string& out_users_bin, const string& out_users_idx, int num_threads = 0);
+
+    // When set, pass2 also writes the same rows as users_encoded.csv text there.
+    string csv_export_path;
+
+    // Vocab built with VocabOptions::hash_bits > 0: token ids are hashed from
+    // the lemmas (minus stopwords) instead of looked up in token2id_per_col.
+    int hash_bits = 0;
+    unordered_set<string> stopwords;
+
+    // Token cache written by VocabBuilder::pass1; when valid pass2 skips tokenization.
+    string token_cache_path;
+
+    // When set, pass2 records its progress there every checkpoint_interval
+    // bytes of input and a later pass2 with the same checkpoint_key continues
+    // from it instead of starting over. The file is removed once pass2 is done.
+    string checkpoint_path;
+    string checkpoint_key;
+    uint64_t checkpoint_interval = 64ull << 20;
+
+    // Records and input bytes the last pass2 encoded; a resumed pass2 counts
+    // only what it did after the checkpoint.
+    uint64_t rows_encoded = 0;
+    uint64_t bytes_encoded = 0;
 
 private:
     vector<string> colKeys;
@@ -29,14 +60,18 @@ private:
     const unordered_map<string,int>& address_part1_to_id;
     const unordered_map<string,int>& address_part2_to_id;
     const unordered_map<string,int>& address_part3_to_id;
-    const unordered_map<int, vector<int>>& adjacency;
-
-    vector<string> split_line_to_cols(const string& line) const;
-    string build_region_parts_csv(const string& raw_region) const;
-    unordered_map<int,int> extract_club_counts_from_line(const string& line) const;
-    string format_counts_to_csv(const unordered_map<int,int>& counts) const;
-    string format_token_counts_to_csv(const unordered_map<int,int>& counts) const;
-    vector<string> process_profile_line(const vector<string>& cols, Tokenizer& tok, Lemmatiser& lem) const;
+    AdjacencyView adjacency;  // friends column of the CSV export
+
+    void build_region_parts(const string& raw_region, vector<uint32_t>& parts) const;
+    unordered_map<int,int> extract_club_counts_from_line(string_view line) const;
+    // The process_* functions fill rec and, when csv is set, append the row as CSV text.
+    bool encode_fixed_fields(const vector<string_view>& cols, UserRecord& rec, string* csv) const;
+    void add_token_column(const unordered_map<int,int>& counts, UserRecord& rec, string* csv) const;
+    struct EncodeScratch;
+    bool process_profile_line(const vector<string_view>& cols, const Tokenizer& tok, const Lemmatiser& lem, EncodeScratch& scratch,
+                              UserRecord& rec, string* csv) const;
+    bool process_profile_line(const vector<string_view>& cols, const vector<vector<int>>& cached_ids,
+                              UserRecord& rec, string* csv) const;
 };
 
 #endif
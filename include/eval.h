@@ -2,8 +2,9 @@
 #define EVAL_H
 
 #include <unordered_map>
-#include "user_profile.h"
+#include "profile_store.h"
 #include <vector>
+#include "adjacency_view.h"
 
 struct EvalResult {
     double hit_at_k;
@@ -12,8 +13,8 @@ struct EvalResult {
 };
 
 EvalResult evaluate_recommender_sample(
-    const std::unordered_map<int, UserProfile>& profiles,
-    const std::unordered_map<int, std::vector<int>>& adj_list,
+    const ProfileStore& profiles,
+    const AdjacencyView& adjacency,
     class Recommender &rec,
     const std::vector<std::string>& text_columns,
     int sample_size,
@@ -4,12 +4,13 @@
 #include <unordered_map>
 #include <vector>
 #include <string>
-#include "user_profile.h"
+#include "profile_store.h"
+#include "adjacency_view.h"
 
 struct EvalMetrics { double graph_hit=0.0; double collab_hit=0.0; double interest_hit=0.0; double supernode_hit=0.0; };
 
-EvalMetrics evaluate_recommenders_holdout(const std::unordered_map<int, UserProfile>& profiles,
-                                         const std::unordered_map<int, std::vector<int>>& adj_list,
+EvalMetrics evaluate_recommenders_holdout(const ProfileStore& profiles,
+                                         const AdjacencyView& adjacency,
                                          const std::vector<std::string>& text_columns,
                                          int sample_size,
                                          int topk,
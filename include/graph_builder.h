@@ -5,15 +5,47 @@
 #include <vector>
 #include <utility>
 #include <string>
+#include <cstdint>
 
 using namespace std;
 
+// Compressed sparse row graph indexed by user id: the neighbours of u are
+// cols[offsets[u] .. offsets[u+1]). Ids without out-edges have an empty range.
+struct CsrGraph {
+    vector<uint64_t> offsets;  // num_nodes() + 1 entries
+    vector<int> cols;
+
+    int num_nodes() const { return offsets.empty() ? 0 : (int)(offsets.size() - 1); }
+    size_t num_edges() const { return cols.size(); }
+    size_t degree(int u) const { return has_node(u) ? (size_t)(offsets[u + 1] - offsets[u]) : 0; }
+    const int* begin(int u) const { return has_node(u) ? cols.data() + offsets[u] : nullptr; }
+    const int* end(int u) const { return has_node(u) ? cols.data() + offsets[u + 1] : nullptr; }
+    bool has_node(int u) const { return u >= 0 && u < num_nodes(); }
+    void clear() { offsets.clear(); cols.clear(); }
+};
+
+struct EdgeLoadOptions {
+    bool drop_self_loops = false;
+    // Removes repeated edges; rows then come out sorted by neighbour id
+    // instead of in file order.
+    bool dedup = false;
+    int num_threads = 0;  // 0 uses all hardware threads
+};
+
 struct GraphBuilder {
-    unordered_map<int, vector<pair<int,float>>> adjacency;
-    void load_edges(const string& path, size_t max_lines = 0);
-    vector<int> neighbors(int uid);
+    CsrGraph graph;
+    // Parses "src<ws>dst" lines of the mmapped edge file on several threads and
+    // fills graph with a counting sort; neighbours keep their file order.
+    void load_edges(const string& path, size_t max_lines = 0, const EdgeLoadOptions& opts = EdgeLoadOptions());
+    // Appends the edges of delta that graph does not have yet; returns the
+    // sources whose rows changed, in increasing order.
+    vector<int> add_edges(const CsrGraph& delta);
+    vector<int> neighbors(int uid) const;
     bool load_serialized(const string& path);
     bool save_serialized(const string& path) const;
+    // adjacency.bin (see adjacency_view.h); load copies it into graph.
+    bool load_binary(const string& path);
+    bool save_binary(const string& path) const;
 };
 
 #endif
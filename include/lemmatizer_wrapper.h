@@ -1,13 +1,50 @@
 #ifndef LEMMATIZER_WRAPPER_H
 #define LEMMATIZER_WRAPPER_H
 #include <string>
+#include <string_view>
 #include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
 using namespace std;
+
+struct lem_model;
+
+// word -> lemma memo. Not thread-safe: parallel code keeps one per worker
+// and passes it to the Lemmatiser calls below. Misses are cached too, so a
+// word the model cannot lemmatize is only looked up once.
+struct LemmaCache {
+    explicit LemmaCache(size_t max_entries = 1 << 20) : max_entries(max_entries) {}
+    unordered_map<string, string> map;
+    size_t max_entries;  // the map is dropped once it grows past this, between batches
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    double hit_rate() const { return hits + misses ? (double)hits / (double)(hits + misses) : 0.0; }
+};
+
+// Each Lemmatiser holds a reference to a shared, read-only mapping of the
+// model file, so any number of them may live (and be destroyed) side by side.
 struct Lemmatiser {
     Lemmatiser(const string& model_path);
     ~Lemmatiser();
+    Lemmatiser(const Lemmatiser&) = delete;
+    Lemmatiser& operator=(const Lemmatiser&) = delete;
     string lemmatize_word(const string& w);
     vector<string> lemmatize_tokens(const vector<string>& toks);
+    // Same as above with a caller-owned cache; safe to call from several
+    // threads as long as each uses its own cache.
+    string lemmatize_word(const string& w, LemmaCache& cache) const;
+    vector<string> lemmatize_tokens(const vector<string>& toks, LemmaCache& cache) const;
+    // Tokens as produced by Tokenizer::tokenize into a TokenBuffer.
+    vector<string> lemmatize_tokens(const vector<string_view>& toks, LemmaCache& cache) const;
+    // Counters of the built-in cache used by the one-argument calls.
+    LemmaCache& default_cache() { return cache; }
     bool loaded;
+private:
+    string lemmatize_uncached(const string& w) const;
+    const string& lookup(string_view w, LemmaCache& cache) const;
+    lem_model* model;
+    LemmaCache cache;
+    mutex cache_m;
 };
 #endif
@@ -0,0 +1,106 @@
+#ifndef ORDERED_PIPELINE_H
+#define ORDERED_PIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Reader -> N workers -> ordered writer.
+// read_batch runs on the calling thread and returns false at end of input,
+// work runs on num_workers threads, write_batch runs on a dedicated thread and
+// sees batches in the order they were read. At most max_inflight batches are
+// held between reading and writing, which keeps memory flat for any input size.
+template <typename In, typename Out>
+void run_ordered_pipeline(const std::function<bool(In&)>& read_batch,
+                          const std::function<void(In&, Out&)>& work,
+                          const std::function<void(Out&)>& write_batch,
+                          int num_workers,
+                          size_t max_inflight)
+{
+    if (num_workers < 1) num_workers = 1;
+    if (max_inflight < (size_t)num_workers) max_inflight = (size_t)num_workers;
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::pair<size_t, In>> todo;
+    std::map<size_t, Out> done;
+    size_t read_seq = 0;
+    size_t written = 0;
+    bool reading_done = false;
+
+    std::vector<std::thread> workers;
+    workers.reserve((size_t)num_workers);
+    for (int w = 0; w < num_workers; ++w) {
+        workers.emplace_back([&]() {
+            while (true) {
+                std::pair<size_t, In> job;
+                {
+                    std::unique_lock<std::mutex> lk(m);
+                    cv.wait(lk, [&]{ return !todo.empty() || reading_done; });
+                    if (todo.empty()) return;
+                    job = std::move(todo.front());
+                    todo.pop_front();
+                }
+                Out out;
+                work(job.second, out);
+                {
+                    std::lock_guard<std::mutex> lk(m);
+                    done.emplace(job.first, std::move(out));
+                }
+                cv.notify_all();
+            }
+        });
+    }
+
+    std::thread writer([&]() {
+        while (true) {
+            Out out;
+            {
+                std::unique_lock<std::mutex> lk(m);
+                cv.wait(lk, [&]{
+                    return done.count(written) || (reading_done && written == read_seq);
+                });
+                auto it = done.find(written);
+                if (it == done.end()) return;
+                out = std::move(it->second);
+                done.erase(it);
+            }
+            write_batch(out);
+            {
+                std::lock_guard<std::mutex> lk(m);
+                ++written;
+            }
+            cv.notify_all();
+        }
+    });
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lk(m);
+            cv.wait(lk, [&]{ return read_seq - written < max_inflight; });
+        }
+        In batch;
+        if (!read_batch(batch)) break;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            todo.emplace_back(read_seq++, std::move(batch));
+        }
+        cv.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lk(m);
+        reading_done = true;
+    }
+    cv.notify_all();
+
+    for (auto &w : workers) w.join();
+    writer.join();
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+#include "vocab_builder.h"
+#include "adjacency_view.h"
+#include "vocab_view.h"
+#include "profile_store.h"
+#include "run_report.h"
+
+using namespace std;
+
+struct PipelineConfig {
+    string data_dir = "data";
+    string profiles = "data/soc-pokec-profiles.txt";
+    string relationships = "data/soc-pokec-relationships.txt";
+    string lemma_model = "data/lem-me-sk.bin";
+    vector<string> text_columns;
+    VocabOptions vocab;    // token pruning / hashing of the text columns
+    size_t max_users = 0;  // users loaded from users.bin, 0 = all
+    bool export_csv = false;  // also write users_encoded.csv for inspection
+    // false: no profiles are loaded; median_age is rebuilt from an ages-only
+    // pass and the normalizers from a sample. Serve through a ProfileCache.
+    bool resident_profiles = true;
+    int normalizer_sample_size = 100000;
+    int normalizer_comps_per_user = 5;
+    string tag = "main";   // log prefix
+};
+
+struct PipelineData {
+    explicit PipelineData(const vector<string>& text_columns) : vocab(text_columns) {}
+    VocabBuilder vocab;      // maps filled only when the vocab or users.bin is rebuilt
+    VocabView vocab_view;    // mapped vocab.bin, always open after run_pipeline
+    AdjacencyFile adjacency_file;  // mapped adjacency.bin
+    AdjacencyView adjacency;       // of adjacency_file, or of a serving snapshot
+    ProfileStore profiles;   // columnar, in users.idx order; empty without resident_profiles
+    ProfileView profiles_view;     // of profiles, or of a serving snapshot
+    int median_age = 0;
+    unordered_map<string, pair<float,float>> col_norms;
+    RunReport report;        // timings of every stage run_pipeline ran
+};
+
+// Brings every artifact in cfg.data_dir up to date and loads it:
+//   vocab, adjacency -> users_encoded -> profiles -> median_age -> ages -> normalizers
+// Each file is stamped with a fingerprint of its inputs and config; only
+// stages whose stamps no longer match are rebuilt, vocab and adjacency run
+// concurrently, and an interrupted encode resumes from its last checkpoint.
+bool run_pipeline(const PipelineConfig& cfg, PipelineData& data, ostream& log);
+
+#endif
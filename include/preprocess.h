@@ -2,9 +2,25 @@
 #define PREPROCESS_H
 #include <string>
 #include <vector>
+#include <functional>
+#include <ostream>
 #include "tokenizer.h"
 using namespace std;
 vector<string> split_tab(const string& line);
+
+// Receives the preprocessed rows in file order; the row may be moved from.
+typedef function<void(vector<string>& row)> ProfileRowSink;
+
+// Streams the profile rows through num_threads workers (0 = all hardware
+// threads) to sink without holding more than a few batches in memory.
+// Returns the number of rows handed to sink.
+size_t preprocess_profiles_stream(const string& path, const Tokenizer& tok, const ProfileRowSink& sink,
+                                  size_t max_rows = 0, int num_threads = 1);
+// Streams straight into the CSV that save_df_csv would write.
+bool preprocess_profiles_to_csv(const string& path, const Tokenizer& tok, const string& outpath,
+                                size_t max_rows = 0, int num_threads = 1);
+
 vector<vector<string>> preprocess_profiles(const string& path, Tokenizer& tok, size_t max_rows = 0);
+void write_csv_row(ostream& out, const vector<string>& row);
 void save_df_csv(const string& outpath, const vector<vector<string>>& df);
 #endif
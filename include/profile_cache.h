@@ -0,0 +1,121 @@
+#ifndef PROFILE_CACHE_H
+#define PROFILE_CACHE_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include "profile_store.h"
+#include "bin_reader.h"
+#include "adjacency_view.h"
+
+class ProfileCache;
+
+// A profile held for the caller. One that came from a ProfileCache pins its
+// entry, so ref() stays valid until the handle is released or destroyed.
+class ProfileHandle {
+public:
+    ProfileHandle() = default;
+    explicit ProfileHandle(const ProfileRef& profile) : r(profile) {}
+    ProfileHandle(ProfileHandle&& other) noexcept;
+    ProfileHandle& operator=(ProfileHandle&& other) noexcept;
+    ProfileHandle(const ProfileHandle&) = delete;
+    ProfileHandle& operator=(const ProfileHandle&) = delete;
+    ~ProfileHandle() { release(); }
+
+    void release();
+    const ProfileRef& ref() const { return r; }
+    const ProfileRef* operator->() const { return &r; }
+
+private:
+    friend class ProfileCache;
+    ProfileRef r;
+    ProfileCache* owner = nullptr;
+    uint32_t slot = 0;
+};
+
+struct ProfileCacheStats {
+    size_t capacity = 0;
+    size_t entries = 0;
+    size_t memory_bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    double miss_ms = 0.0;  // total time spent decoding misses
+
+    double hit_rate() const { return hits + misses ? (double)hits / (double)(hits + misses) : 0.0; }
+    double mean_miss_us() const { return misses ? miss_ms * 1000.0 / (double)misses : 0.0; }
+};
+
+// Profiles read on demand from a mapped users.bin, keeping at most capacity
+// of them decoded. Entries are replaced by CLOCK: a hit marks its entry and
+// the hand evicts the first unmarked, unpinned entry it finds, clearing the
+// marks it passes. Only while every entry is pinned does the cache grow past
+// capacity. Profiles match what load_users_bin + fill_missing_ages give:
+// friends from the adjacency, zero ages replaced by default_age.
+// Not thread-safe; lookups change the cache even through a const Recommender.
+class ProfileCache {
+public:
+    bool open(const std::string& users_bin, const std::string& users_idx, size_t num_text_columns,
+              const AdjacencyView& adjacency, size_t capacity, int default_age);
+    void close();
+    bool is_open() const { return reader.is_open(); }
+
+    // False if user_id is not in users.bin or its record is corrupt.
+    bool get(int user_id, ProfileHandle& out);
+    bool contains(int user_id) const { return reader.contains(user_id); }
+
+    size_t num_users() const { return reader.size(); }
+    size_t num_text_columns() const { return text_cols; }
+    size_t capacity() const { return max_entries; }
+    // The records behind the cache, for passes over every user that should
+    // not go through (and flush) the cache.
+    const UserRecordReader& records() const { return reader; }
+
+    ProfileCacheStats stats() const;
+    void reset_stats();
+
+private:
+    friend class ProfileHandle;
+
+    struct Entry {
+        int user_id = -1;
+        int public_flag = -1;
+        int completion_percentage = -1;
+        int gender = -1;
+        int age = 0;
+        std::array<int,3> region_parts = { -1, -1, -1 };
+        std::vector<uint32_t> clubs;
+        std::vector<uint32_t> friends;
+        std::vector<TokenCount> tokens;
+        std::vector<uint64_t> token_offsets;
+        uint32_t pins = 0;
+        bool marked = false;
+    };
+
+    UserRecordReader reader;
+    AdjacencyView adjacency;
+    RecordMask mask;
+    UserRecordView view;
+    size_t text_cols = 0;
+    size_t max_entries = 0;
+    int default_age = 0;
+
+    std::vector<Entry> entries;
+    std::unordered_map<int, uint32_t> slot_by_id;
+    size_t hand = 0;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t miss_ns = 0;
+
+    uint32_t take_slot();
+    void fill(Entry& e);
+    ProfileRef ref(const Entry& e) const;
+    void unpin(uint32_t slot) { --entries[slot].pins; }
+};
+
+#endif
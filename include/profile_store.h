@@ -0,0 +1,210 @@
+#ifndef PROFILE_STORE_H
+#define PROFILE_STORE_H
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+struct UserProfile;
+
+struct TokenCount {
+    int32_t token;
+    int32_t count;
+};
+
+// One CSR row of a ProfileStore, pointing into its arrays.
+template <typename T>
+struct ProfileRange {
+    const T* first = nullptr;
+    const T* last = nullptr;
+
+    const T* begin() const { return first; }
+    const T* end() const { return last; }
+    size_t size() const { return (size_t)(last - first); }
+    bool empty() const { return first == last; }
+    const T& operator[](size_t i) const { return first[i]; }
+};
+
+// One profile's fields and rows, pointing into a ProfileStore or a
+// ProfileCache entry; valid as long as that row is.
+struct ProfileRef {
+    int user_id = 0;
+    int public_flag = -1;
+    int completion_percentage = -1;
+    int gender = -1;
+    int age = 0;
+    std::array<int,3> region_parts = { -1, -1, -1 };
+    ProfileRange<uint32_t> clubs;
+    ProfileRange<uint32_t> friends;
+    const TokenCount* token_data = nullptr;
+    const uint64_t* token_offsets = nullptr;  // text_cols + 1, into token_data
+    size_t text_cols = 0;
+
+    ProfileRange<TokenCount> tokens(size_t col) const {
+        ProfileRange<TokenCount> r;
+        if (col >= text_cols) return r;
+        r.first = token_data + token_offsets[col];
+        r.last = token_data + token_offsets[col + 1];
+        return r;
+    }
+};
+
+// Profiles laid out as a ProfileStore keeps them, read-only. It views a
+// ProfileStore or the sections of a mapped serving snapshot without owning
+// either, so copies are cheap; the arrays must outlive it.
+class ProfileView {
+public:
+    struct Arrays {
+        const int* ids = nullptr;
+        const int* public_flags = nullptr;
+        const int* completions = nullptr;
+        const int* genders = nullptr;
+        const int* ages = nullptr;
+        const std::array<int,3>* regions = nullptr;
+        const uint64_t* club_offsets = nullptr;     // size() + 1
+        const uint32_t* club_ids = nullptr;
+        const uint64_t* friend_offsets = nullptr;   // size() + 1
+        const uint32_t* friend_ids = nullptr;
+        const uint64_t* token_offsets = nullptr;    // size() * num_text_columns() + 1
+        const TokenCount* token_counts = nullptr;
+        const int* index_by_id = nullptr;           // user id -> index, -1 where absent
+        size_t index_size = 0;
+    };
+
+    ProfileView() = default;
+    ProfileView(const Arrays& arrays, size_t num_users, size_t num_text_columns)
+        : a(arrays), n(num_users), text_cols(num_text_columns) {}
+
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    size_t num_text_columns() const { return text_cols; }
+    const Arrays& arrays() const { return a; }
+
+    // Dense index of user_id, or -1.
+    int index_of(int user_id) const {
+        return (user_id >= 0 && (size_t)user_id < a.index_size) ? a.index_by_id[user_id] : -1;
+    }
+    bool contains(int user_id) const { return index_of(user_id) >= 0; }
+    int user_id(int i) const { return a.ids[i]; }
+
+    ProfileRange<TokenCount> tokens(int i, size_t col) const {
+        ProfileRange<TokenCount> r;
+        if (col >= text_cols) return r;
+        const size_t row = (size_t)i * text_cols + col;
+        r.first = a.token_counts + a.token_offsets[row];
+        r.last = a.token_counts + a.token_offsets[row + 1];
+        return r;
+    }
+
+    ProfileRef ref(int i) const {
+        ProfileRef r;
+        r.user_id = a.ids[i];
+        r.public_flag = a.public_flags[i];
+        r.completion_percentage = a.completions[i];
+        r.gender = a.genders[i];
+        r.age = a.ages[i];
+        r.region_parts = a.regions[i];
+        r.clubs.first = a.club_ids + a.club_offsets[i];
+        r.clubs.last = a.club_ids + a.club_offsets[i + 1];
+        r.friends.first = a.friend_ids + a.friend_offsets[i];
+        r.friends.last = a.friend_ids + a.friend_offsets[i + 1];
+        r.token_data = a.token_counts;
+        r.token_offsets = a.token_offsets + (size_t)i * text_cols;
+        r.text_cols = text_cols;
+        return r;
+    }
+
+private:
+    Arrays a;
+    size_t n = 0;
+    size_t text_cols = 0;
+};
+
+// Profiles as columns: every fixed field is its own array, clubs, friends
+// and each token column are CSR rows, all indexed by a dense user index (the
+// order users were added in). Rows are sorted (clubs and friends by id,
+// tokens by token id) so two profiles are compared by merging ranges.
+// Token rows are laid out user-major: row i * num_text_columns() + t.
+class ProfileStore {
+public:
+    void clear();
+    void reserve(size_t users);
+    // Must be set while the store is empty.
+    void set_num_text_columns(size_t n) { text_cols = n; }
+    size_t num_text_columns() const { return text_cols; }
+
+    // A user is added as begin_user, any number of add_club / add_friend /
+    // add_token (columns in ascending order), then end_user. User ids are
+    // positive; if one is added twice, index_of finds the later row.
+    int begin_user(int user_id, int public_flag, int completion_percentage, int gender, int age,
+                   const std::array<int,3>& region_parts);
+    void add_club(uint32_t club) { club_ids.push_back(club); }
+    void add_friend(uint32_t friend_id) { friend_ids.push_back(friend_id); }
+    void add_token(size_t col, int token, int count);
+    void end_user();
+    int add(const UserProfile& p);
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+    // Dense index of user_id, or -1.
+    int index_of(int user_id) const {
+        return (user_id >= 0 && (size_t)user_id < index_by_id.size()) ? index_by_id[user_id] : -1;
+    }
+    bool contains(int user_id) const { return index_of(user_id) >= 0; }
+    const std::vector<int>& user_ids() const { return ids; }
+
+    int user_id(int i) const { return ids[i]; }
+    int public_flag(int i) const { return public_flags[i]; }
+    int completion_percentage(int i) const { return completions[i]; }
+    int gender(int i) const { return genders[i]; }
+    int age(int i) const { return ages[i]; }
+    void set_age(int i, int age) { ages[i] = age; }
+    const std::array<int,3>& region_parts(int i) const { return regions[i]; }
+
+    ProfileRange<uint32_t> clubs(int i) const { return row(club_ids, club_offsets, (size_t)i); }
+    ProfileRange<uint32_t> friends(int i) const { return row(friend_ids, friend_offsets, (size_t)i); }
+    ProfileRange<TokenCount> tokens(int i, size_t col) const {
+        if (col >= text_cols) return ProfileRange<TokenCount>();
+        return row(token_counts, token_offsets, (size_t)i * text_cols + col);
+    }
+
+    ProfileRef ref(int i) const { return view().ref(i); }
+    // Valid until the store is changed by anything but set_age.
+    ProfileView view() const;
+
+    // Copy of row i as a UserProfile, for output that wants one.
+    UserProfile profile(int i) const;
+    size_t memory_bytes() const;
+
+private:
+    size_t text_cols = 0;
+    size_t open_col = 0;
+
+    std::vector<int> ids;
+    std::vector<int> public_flags;
+    std::vector<int> completions;
+    std::vector<int> genders;
+    std::vector<int> ages;
+    std::vector<std::array<int,3>> regions;
+
+    std::vector<uint64_t> club_offsets = { 0 };
+    std::vector<uint32_t> club_ids;
+    std::vector<uint64_t> friend_offsets = { 0 };
+    std::vector<uint32_t> friend_ids;
+    std::vector<uint64_t> token_offsets = { 0 };
+    std::vector<TokenCount> token_counts;
+
+    // user id -> index, -1 where absent; ids are dense enough for a table
+    std::vector<int> index_by_id;
+
+    template <typename T>
+    static ProfileRange<T> row(const std::vector<T>& v, const std::vector<uint64_t>& off, size_t r) {
+        ProfileRange<T> out;
+        out.first = v.data() + off[r];
+        out.last = v.data() + off[r + 1];
+        return out;
+    }
+};
+
+#endif
@@ -5,8 +5,8 @@
 #include <vector>
 #include <string>
 #include <utility>
-
-struct UserProfile;
+#include "adjacency_view.h"
+#include "profile_store.h"
 
 struct Recommender; // forward
 
@@ -18,14 +18,14 @@ struct RecommendTestMetrics {
     double avg_club_recall_at_k = 0.0;
 };
 
-void print_example_recommendations(const std::unordered_map<int, UserProfile>& profiles,
-                                   const std::unordered_map<int, std::vector<int>>& adj_list,
+void print_example_recommendations(const ProfileStore& profiles,
+                                   const AdjacencyView& adjacency,
                                    Recommender& rec,
                                    const std::unordered_map<int, std::string>& club_id_to_name,
                                    const std::vector<std::string>& text_columns);
 
-RecommendTestMetrics run_recommendation_tests_sample(const std::unordered_map<int, UserProfile>& profiles,
-                                                     const std::unordered_map<int, std::vector<int>>& adj_list,
+RecommendTestMetrics run_recommendation_tests_sample(const ProfileStore& profiles,
+                                                     const AdjacencyView& adjacency,
                                                      const std::unordered_map<int, std::string>& club_id_to_name,
                                                      Recommender& base_rec,
                                                      const std::vector<std::string>& text_columns,
@@ -7,8 +7,35 @@
 #include <utility>
 #include <array>
 #include <cstdint>
+#include "adjacency_view.h"
+#include "profile_store.h"
+#include "profile_cache.h"
 
-struct UserProfile;
+struct IdfEntry {
+    int32_t token;
+    float idf;
+};
+
+// IDF of one text column as entries sorted by token. Computed columns own
+// them; a restored serving snapshot points them into its mapping, which
+// then has to outlive the column.
+class IdfColumn {
+public:
+    IdfColumn() = default;
+    explicit IdfColumn(std::vector<IdfEntry> entries);
+    IdfColumn(const IdfEntry* sorted, size_t count) : mapped(sorted), n(count) {}
+
+    size_t size() const { return n; }
+    const IdfEntry* begin() const { return mapped ? mapped : owned.data(); }
+    const IdfEntry* end() const { return begin() + n; }
+    // Binary search; fallback for a token without an idf.
+    float find(int token, float fallback) const;
+
+private:
+    std::vector<IdfEntry> owned;
+    const IdfEntry* mapped = nullptr;
+    size_t n = 0;
+};
 
 struct RecommenderInternalGraph;
 struct RecommenderInternalClubs;
@@ -16,10 +43,13 @@ struct RecommenderInternalSim;
 
 class Recommender {
 public:
-    Recommender(const std::unordered_map<int, UserProfile>* profiles_in,
-                const std::unordered_map<int, std::vector<int>>* al);
+    Recommender(const ProfileStore* profiles_in,
+                const AdjacencyView& al);
+    // Profiles come through the cache instead of a loaded store.
+    Recommender(ProfileCache* cache_in,
+                const AdjacencyView& al);
     Recommender(const std::unordered_map<int, std::unordered_map<int,float>>* user_feats_in,
-                const std::unordered_map<int, std::vector<int>>* al);
+                const AdjacencyView& al);
 
     std::vector<std::pair<int,float>> recommend_graph_registration(int user, int topk, int candidate_limit = 10000) const;
     std::vector<std::pair<int,float>> recommend_collaborative(int user, int topk, int candidate_limit = 10000) const;
@@ -29,6 +59,7 @@ public:
 
     void set_text_columns(const std::vector<std::string>& cols);
     void set_tfidf_index(const std::unordered_map<std::string, std::unordered_map<int,float>>& idf_map);
+    void set_tfidf_index(const std::unordered_map<std::string, IdfColumn>& idf_map);
 
     std::vector<std::pair<int,float>> recommend_friends_graph(int user, int topk, int candidate_limit = 10000) const;
     std::vector<std::pair<int,float>> recommend_friends_collab(int user, int topk, int candidate_limit = 10000) const;
@@ -38,32 +69,41 @@ public:
     void set_field_normalizers(const std::unordered_map<std::string, std::pair<float,float>>& m);
     void set_column_normalizers(const std::unordered_map<std::string, std::pair<float,float>>& m);
 
-    float profile_similarity(const UserProfile &A, const UserProfile &B, const std::vector<std::string> &text_columns) const;
-    float profile_similarity(const UserProfile &A, const UserProfile &B) const;
+    // a and b are indices into profiles; 0 if either is out of range, e.g.
+    // when profiles come through a cache.
+    float profile_similarity(int a, int b, const std::vector<std::string> &text_columns) const;
+    float profile_similarity(int a, int b) const;
+    float profile_similarity(const ProfileRef& a, const ProfileRef& b, const std::vector<std::string> &text_columns) const;
 
     void compute_idf_from_profiles(const std::vector<std::string>& text_columns);
 
-    const std::unordered_map<int, UserProfile>* profiles = nullptr;
+    // A loaded ProfileStore or a mapped serving snapshot.
+    ProfileView profiles;
+    ProfileCache* cache = nullptr;
     const std::unordered_map<int, std::unordered_map<int,float>>* user_feats = nullptr;
 
-    const std::unordered_map<int, std::vector<int>>* adj_list = nullptr;
+    AdjacencyView adjacency;
 
     std::unordered_map<std::string, std::pair<float,float>> field_normalizers;
     std::unordered_map<std::string, std::pair<float,float>> column_normalizers;
 
-    std::unordered_map<std::string, std::unordered_map<int,float>> idf_per_col;
+    std::unordered_map<std::string, IdfColumn> idf_per_col;
     size_t total_users = 0;
 
 private:
     std::vector<std::string> text_columns_internal;
 
-    float tfidf_cosine_for_column(const std::unordered_map<int,int>& A,
-                                  const std::unordered_map<int,int>& B,
-                                  const std::unordered_map<int,float>& idf_map) const;
+    bool has_profiles() const { return !profiles.empty() || cache; }
+    // Profile of user_id from the store or the cache; false if there is none.
+    bool find_profile(int user_id, ProfileHandle& out) const;
+
+    float tfidf_cosine_for_column(ProfileRange<TokenCount> A,
+                                  ProfileRange<TokenCount> B,
+                                  const IdfColumn& idf) const;
 
-    static float vec_set_similarity(const std::vector<uint32_t>& A, const std::vector<uint32_t>& B);
+    static float vec_set_similarity(ProfileRange<uint32_t> A, ProfileRange<uint32_t> B);
     static float region_similarity_local(const std::array<int,3>& A, const std::array<int,3>& B);
-    static float cosine_counts_maps_local(const std::unordered_map<int,int>& A, const std::unordered_map<int,int>& B);
+    static float cosine_counts_local(ProfileRange<TokenCount> A, ProfileRange<TokenCount> B);
 
     friend struct ::RecommenderInternalGraph;
     friend struct ::RecommenderInternalClubs;
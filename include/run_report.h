@@ -0,0 +1,71 @@
+#ifndef RUN_REPORT_H
+#define RUN_REPORT_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <ctime>
+#include <ostream>
+#include <cstdint>
+
+using namespace std;
+
+// What one ETL stage cost. cpu_s and peak_rss_kb are process-wide: the CPU
+// time of stages that run concurrently overlaps, and peak RSS is the
+// high-water mark of the whole run when the stage ended.
+struct StageMetrics {
+    string name;
+    string status = "built";  // "built", "loaded" or "failed"
+    double wall_s = 0;
+    double cpu_s = 0;
+    uint64_t rows = 0;
+    uint64_t bytes = 0;       // input read by the stage
+    uint64_t peak_rss_kb = 0;
+
+    double rows_per_s() const { return wall_s > 0 ? (double)rows / wall_s : 0; }
+    double bytes_per_s() const { return wall_s > 0 ? (double)bytes / wall_s : 0; }
+};
+
+// Collects the StageMetrics of one run; stages may add from several threads.
+class RunReport {
+public:
+    void add(const StageMetrics& m);
+    vector<StageMetrics> stages() const;
+    // {"version", "started", "wall_s", "cpu_s", "peak_rss_kb", "stages": [...]}
+    bool write_json(const string& path) const;
+    void print(ostream& log, const string& tag) const;
+
+private:
+    mutable mutex m;
+    vector<StageMetrics> entries;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    time_t started = time(nullptr);
+};
+
+// Measures from construction to finish(), or to destruction, and adds the
+// result to report (which may be null). Fill rows, bytes and status of
+// metrics before it finishes.
+class StageTimer {
+public:
+    StageTimer(RunReport* report, const string& name);
+    ~StageTimer() { finish(); }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+    void finish();
+
+    StageMetrics metrics;
+
+private:
+    RunReport* report;
+    chrono::steady_clock::time_point start;
+    double cpu_start;
+    bool done = false;
+};
+
+double process_cpu_seconds();
+uint64_t peak_rss_kb();
+// Size of path, 0 when it does not exist.
+uint64_t file_bytes(const string& path);
+
+#endif
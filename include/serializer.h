@@ -1,6 +1,44 @@
 #ifndef SERIALIZER_H
 #define SERIALIZER_H
 #include <string>
+#include "bin_reader.h"
 using namespace std;
+
+// users.bin is a USERS_BIN_HEADER_SIZE header ("PKUR", u32 format version)
+// followed by records. A record is a run of LEB128 varints:
+//   user_id, public + 1, completion_percentage + 1, gender + 1,
+//   region count (3) + region part ids + 1, age,
+//   section count (1 + token columns) + the byte length of each section,
+//   then the sections:
+//   clubs: count + club ids ascending, the first as is and the rest as gaps,
+//   one per token column: pair count, token ids ascending as gaps, then the
+//   counts in the same order.
+// An empty section has length 0 and no body. The lengths let a reader skip
+// the sections it was not asked for (RecordMask).
+// Unknown public/completion/gender and missing region parts are
+// USER_FIELD_NONE, which the + 1 turns into a single 0 byte.
+//
+// users.idx is a USERS_IDX_HEADER_SIZE header
+//   "PKUX" | version (u32) | layout (u32) | 0 (u32) | entry count (u64)
+//   | table size (u64)
+// followed by one UsersIndexEntry (user id, record length, offset from the
+// start of users.bin) per record in record order, then a u32 table:
+// USERS_IDX_DIRECT has one slot per user id 0..max holding its entry
+// number or USERS_IDX_NONE; USERS_IDX_SORTED, used when ids are too sparse
+// for that, holds the entry numbers ordered by user id. Either way a user id
+// indexed twice resolves to its later entry.
+#define USER_FIELD_NONE 0xFFFFFFFFu
+
+void append_users_bin_header(string& out);
+// Club and token lists are written sorted; rec's are sorted on a copy if not.
+void append_user_record(string& out, const UserRecord& rec);
+
+// A users.idx is written as a header and entries, then closed with
+// finish_users_idx, which appends the table and fills in the header.
+// Until then the file is rejected by UsersIndex::open.
+void append_users_idx_header(string& out);
+void append_users_idx_entry(string& out, int user_id, uint64_t offset, uint32_t length);
+bool finish_users_idx(const string& path);
+bool write_users_idx(const string& path, const vector<UsersIndexEntry>& entries);
 bool csv_to_bin_index(const string& users_csv, const string& out_bin, const string& out_index, int num_token_cols);
 #endif
@@ -0,0 +1,71 @@
+#ifndef SERVING_SNAPSHOT_H
+#define SERVING_SNAPSHOT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "tsv_reader.h"
+
+using namespace std;
+
+struct PipelineConfig;
+struct PipelineData;
+class Recommender;
+
+// serving.snap holds everything api_cli answers from once the pipeline and
+// the IDF are done: profiles (ages filled), adjacency, IDF per text column,
+// column normalizers and club names. It is a list of named sections, each
+// a flat array of fixed-width values at an 8-byte aligned offset:
+//   "PKSN" | version | section count | key | { name, offset, size }...
+// Variable-length rows are CSR: "<x>.off" holds n + 1 offsets into "<x>".
+// Profiles keep the layout of a ProfileStore ("users.<field>", "clubs",
+// "friends", "tokens") and the IDF is sorted by token per column, so both
+// are served from the mapping as they are.
+
+// Identifies what a snapshot was taken from: the raw inputs, the artifacts
+// in cfg.data_dir, the text columns and max_users. A snapshot whose key
+// differs is stale.
+string serving_snapshot_key(const PipelineConfig& cfg);
+
+// Written to path + ".tmp" and renamed over path.
+bool write_serving_snapshot(const string& path, const string& key, const vector<string>& text_columns,
+                            const PipelineData& data, const Recommender& rec,
+                            const unordered_map<int,string>& club_id_to_name);
+
+class ServingSnapshot {
+public:
+    bool open(const string& path);
+    void close();
+    bool is_open() const { return file.is_open(); }
+    string_view key() const { return snap_key; }
+
+    // Section name as an array of T; nullptr (and count 0) when it is missing
+    // or its size is not a multiple of sizeof(T).
+    template <typename T>
+    const T* section(string_view name, size_t& count) const {
+        string_view s = raw(name);
+        count = s.size() / sizeof(T);
+        if (s.data() == nullptr || s.size() % sizeof(T)) { count = 0; return nullptr; }
+        return reinterpret_cast<const T*>(s.data());
+    }
+    string_view raw(string_view name) const;
+
+    // Sets up the serving state without copying the bulk of it: the
+    // profiles (data.profiles_view, rec.profiles), the adjacency and the IDF
+    // of rec point into the mapping, so the snapshot has to stay open while
+    // they are used; data.col_norms, the normalizers of rec and the club
+    // names are copied. Offsets are checked against their sections first.
+    // False if the snapshot is incomplete or corrupt or its text columns
+    // differ from text_columns.
+    bool restore(const vector<string>& text_columns, PipelineData& data, Recommender& rec,
+                 unordered_map<int,string>& club_id_to_name) const;
+
+private:
+    MappedFile file;
+    string_view snap_key;
+    vector<pair<string_view, string_view>> sections;
+};
+
+#endif
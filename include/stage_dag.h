@@ -0,0 +1,61 @@
+#ifndef STAGE_DAG_H
+#define STAGE_DAG_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <ostream>
+#include <cstdint>
+#include "run_report.h"
+
+using namespace std;
+
+// 64-bit FNV-1a over everything an artifact was built from.
+struct Fingerprint {
+    uint64_t h = 14695981039346656037ull;
+
+    Fingerprint& add(string_view s);
+    Fingerprint& add(uint64_t v);
+    // Size, modification time and the first and last MiB of the file; a
+    // missing file hashes differently from every existing one.
+    Fingerprint& add_file(const string& path);
+    string hex() const;
+};
+
+// Every output of a stage gets "<output>.stamp" holding the fingerprint it
+// was built from.
+bool read_stamp(const string& artifact, string& fingerprint);
+bool write_stamp(const string& artifact, const string& fingerprint);
+void remove_stamp(const string& artifact);
+
+struct Stage {
+    string name;
+    vector<string> deps;      // names of stages that must finish first
+    vector<string> outputs;   // files written by build(); none means the stage always runs
+    // Adds the stage's own inputs and config; the fingerprints of deps are added by the DAG.
+    function<void(Fingerprint&)> inputs;
+    // Produces the outputs; gets the fingerprint they will be stamped with.
+    function<bool(const string& fingerprint)> build;
+    // Optional: takes fresh outputs into memory. If it fails the stage is rebuilt.
+    function<bool()> load;
+    // Optional: sets rows and bytes of the run report entry; status says
+    // whether the stage was built or loaded.
+    function<void(StageMetrics&)> counts;
+};
+
+// Runs stages in dependency order. A stage whose outputs all carry the
+// current fingerprint is loaded instead of rebuilt; stages whose deps are
+// done run concurrently.
+class StageDag {
+public:
+    void add(Stage stage);
+    // False if a stage failed, a dep is unknown or the deps form a cycle.
+    // Each stage that runs adds its timings to report when set.
+    bool run(ostream& log, const string& tag, RunReport* report = nullptr);
+
+private:
+    vector<Stage> stages;
+};
+
+#endif
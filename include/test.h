@@ -4,12 +4,13 @@
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include "adjacency_view.h"
 
-struct UserProfile;
+class ProfileStore;
 class Recommender;
 
-void run_friends_holdout_test(const std::unordered_map<int, UserProfile>& profiles,
-                              const std::unordered_map<int, std::vector<int>>& adj_list,
+void run_friends_holdout_test(const ProfileStore& profiles,
+                              const AdjacencyView& adjacency,
                               const std::vector<std::string>& text_columns,
                               const Recommender& base_rec,
                               int sample_size,
@@ -5,12 +5,12 @@
 #include <vector>
 #include <string>
 
-struct UserProfile;
+class ProfileStore;
 
 struct TFIDFIndex {
-    void build(const std::unordered_map<int, UserProfile>& profiles, const std::vector<std::string>& text_columns);
+    void build(const ProfileStore& profiles, const std::vector<std::string>& text_columns);
     float weighted_cosine(const std::unordered_map<int,int>& A, const std::unordered_map<int,int>& B, int col_idx) const;
-    void compute_tfidf_vector(const UserProfile& p, std::unordered_map<int,float>& out) const;
+    void compute_tfidf_vector(const ProfileStore& profiles, int i, std::unordered_map<int,float>& out) const;
 
     // public idf table: column name -> (token -> idf)
     std::unordered_map<std::string, std::unordered_map<int,float>> idf_per_col;
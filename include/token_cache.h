@@ -0,0 +1,65 @@
+#ifndef TOKEN_CACHE_H
+#define TOKEN_CACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+using namespace std;
+
+// Lemmatized token streams per user and text column, written by
+// VocabBuilder::pass1 so that Encoder::pass2 never has to tokenize again.
+//
+// Layout: header | chunk 0 records | chunk 1 records | ... | directory
+// Each chunk stores ids local to the pass1 worker that produced it; the
+// directory holds per chunk and column the local -> vocab id remap table.
+// Record: varint user_id, varint body_len, body = per column varint n + n varint ids.
+
+class TokenCacheWriter {
+public:
+    bool open_part(const string& part_path);
+    void add(uint32_t user_id, const vector<vector<int>>& ids_per_col);
+    void close();
+
+    // Concatenates the part files into path and appends the remap directory.
+    // remaps[chunk][col][local_id] = vocab id; vocab_sizes guard against a stale vocab.
+    static bool finalize(const string& path,
+                         const vector<string>& part_paths,
+                         const vector<vector<vector<int>>>& remaps,
+                         uint64_t source_size,
+                         const vector<uint32_t>& vocab_sizes);
+
+private:
+    ofstream out;
+    string buf;
+    string body;
+};
+
+struct TokenCacheRecord {
+    uint32_t user_id = 0;
+    uint32_t chunk = 0;
+    string body;
+};
+
+class TokenCacheReader {
+public:
+    // Fails if the cache was built from another source file or vocab.
+    bool open(const string& path, uint64_t source_size, const vector<uint32_t>& vocab_sizes);
+    bool next(TokenCacheRecord& rec);
+    // Position of the next record, for resuming a reader with seek().
+    uint64_t tell() const { return pos; }
+    bool seek(uint64_t record_pos);
+    // Vocab ids per column in token order; may run concurrently with next().
+    bool decode(const TokenCacheRecord& rec, vector<vector<int>>& ids_per_col) const;
+
+private:
+    ifstream in;
+    uint32_t num_cols = 0;
+    vector<uint64_t> chunk_end;
+    vector<vector<vector<int>>> remaps;
+    uint32_t cur_chunk = 0;
+    uint64_t pos = 0;
+};
+
+#endif
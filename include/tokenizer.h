@@ -1,13 +1,27 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 #include <string>
+#include <string_view>
 #include <vector>
 using namespace std;
+
+// Reusable output of Tokenizer::tokenize: text holds the case-folded copy of
+// the input and tokens point into it, so both stay valid until the next call.
+struct TokenBuffer {
+    string text;
+    vector<string_view> tokens;
+};
+
+// Tokens are maximal runs of ASCII letters, digits and '-' and of the UTF-8
+// Latin-1 / Latin Extended-A letters used by Slovak and Czech, lowercased.
+// Everything else (punctuation, other scripts, invalid UTF-8) separates tokens.
+// A Tokenizer keeps no state between calls, so parallel passes share one
+// instance across their workers (and one Lemmatiser, each with its own
+// LemmaCache).
 struct Tokenizer {
     Tokenizer();
     ~Tokenizer();
-    vector<string> tokenize(const string& text);
-private:
-    void normalize_inplace(string& s);
+    void tokenize(string_view text, TokenBuffer& out) const;
+    vector<string> tokenize(const string& text) const;
 };
 #endif
@@ -0,0 +1,78 @@
+#ifndef TSV_READER_H
+#define TSV_READER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// Whole file mapped read-only. Views handed out stay valid until close().
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps path and hints the kernel that it is read front to back, so a
+    // cold-cache scan gets full readahead, or with random_access that pages
+    // are touched in no particular order and readahead would be wasted. An
+    // empty file opens as an empty view.
+    bool open(const string& path, bool random_access = false);
+    void close();
+    // Asks the kernel to start reading [offset, offset + length) in.
+    void will_need(size_t offset, size_t length) const;
+
+    bool is_open() const { return opened; }
+    size_t size() const { return len; }
+    string_view view() const { return string_view(base, len); }
+
+private:
+    const char* base = nullptr;
+    size_t len = 0;
+    bool opened = false;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+// Zero-copy rows and cells of a tab (or other) separated text range.
+class TsvReader {
+public:
+    explicit TsvReader(string_view text) : start(text.data()), cur(text.data()), end(text.data() + text.size()) {}
+
+    // Next row without its '\n'; empty rows are returned too.
+    bool next_row(string_view& row);
+    // Bytes of text consumed so far.
+    size_t offset() const { return (size_t)(cur - start); }
+
+    // Splits row like repeated getline(ss, cell, delim): an empty row has no
+    // cells and a trailing delimiter does not add an empty last cell.
+    static void split_cells(string_view row, vector<string_view>& cells, char delim = '\t');
+
+    // [begin, end) offsets cutting text into at most parts pieces, each ending
+    // just after a newline (or at the end of text), so passes can run a worker per piece.
+    static vector<pair<size_t,size_t>> chunk_ranges(string_view text, size_t parts);
+
+private:
+    const char* start;
+    const char* cur;
+    const char* end;
+};
+
+// atoi for a cell: leading blanks, optional sign, digits up to the first other char.
+inline int parse_int(string_view s) {
+    size_t i = 0;
+    while (i < s.size() && (s[i] == ' ' || (s[i] >= '\t' && s[i] <= '\r'))) ++i;
+    bool neg = false;
+    if (i < s.size() && (s[i] == '-' || s[i] == '+')) { neg = s[i] == '-'; ++i; }
+    int64_t v = 0;
+    for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; ++i) v = v * 10 + (s[i] - '0');
+    return (int)(neg ? -v : v);
+}
+
+#endif
@@ -4,11 +4,12 @@
 #include <unordered_map>
 #include <vector>
 #include <string>
-#include "user_profile.h"
+#include "profile_store.h"
 #include "recommender.h"
+#include "adjacency_view.h"
 
-void run_terminal_ui(std::unordered_map<int, UserProfile>& profiles,
-                     const std::unordered_map<int, std::vector<int>>& adj_list,
+void run_terminal_ui(const ProfileStore& profiles,
+                     const AdjacencyView& adjacency,
                      Recommender& rec,
                      const std::unordered_map<int, std::string>& club_id_to_name,
                      const std::vector<std::string>& text_columns,
@@ -5,15 +5,43 @@
 #include <vector>
 #include <unordered_map>
 #include "user_profile.h"
+#include "profile_store.h"
+#include "adjacency_view.h"
 
 bool load_users_encoded(const std::string& users_encoded_csv,
                         const std::vector<std::string>& text_columns,
                         std::unordered_map<int, UserProfile>& out_profiles,
                         size_t max_users);
 
-int compute_median_age_from_profiles(const std::unordered_map<int, UserProfile>& profiles);
+// Same profiles from the users.bin store the encoder writes. Friends are not
+// part of the records; they are taken from adjacency. Rows follow users.idx
+// order; max_users == 0 loads all of them. To serve more users than fit in
+// memory, read them through a ProfileCache instead.
+bool load_users_bin(const std::string& users_bin,
+                    const std::string& users_idx,
+                    const std::vector<std::string>& text_columns,
+                    const AdjacencyView& adjacency,
+                    ProfileStore& out_profiles,
+                    size_t max_users);
+
+// A sample of what load_users_bin would load: sample_size of its records
+// picked with a fixed seed, in users.idx order, or all of them when there
+// are no more. For statistics that do not need every profile in memory.
+bool load_users_bin_sample(const std::string& users_bin,
+                           const std::string& users_idx,
+                           const std::vector<std::string>& text_columns,
+                           const AdjacencyView& adjacency,
+                           ProfileStore& out_profiles,
+                           size_t max_users,
+                           size_t sample_size);
+
+int compute_median_age_from_profiles(const ProfileStore& profiles);
+// Same median over the records load_users_bin would load, decoding only
+// their fixed fields.
+bool compute_median_age_from_bin(const std::string& users_bin, const std::string& users_idx,
+                                 size_t max_users, int& out_median);
 bool load_median_age(const std::string& path, int& out_median);
 bool save_median_age(const std::string& path, int median);
-int fill_missing_ages(std::unordered_map<int, UserProfile>& profiles, int median_age);
+int fill_missing_ages(ProfileStore& profiles, int median_age);
 
 #endif
@@ -4,16 +4,17 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <cstdint>
 
 std::vector<std::string> load_text_columns_from_file(const std::string& path);
 
-std::unordered_map<int, std::vector<int>> build_adj_list(const std::unordered_map<int, std::vector<std::pair<int,float>>>& adj_weighted);
+std::unordered_map<int, std::vector<int>> build_adj_list(const struct CsrGraph& graph);
 
 bool load_column_normalizers(const std::string& path, std::unordered_map<std::string, std::pair<float,float>>& out);
 bool save_column_normalizers(const std::string& path, const std::unordered_map<std::string, std::pair<float,float>>& m);
 
 std::unordered_map<std::string, std::pair<float,float>> compute_column_normalizers(
-    const std::unordered_map<int, struct UserProfile>& profiles,
+    const class ProfileStore& profiles,
     const std::vector<std::string>& text_columns,
     int sample_size,
     int comps_per_user);
@@ -2,17 +2,56 @@
 #define VOCAB_BUILDER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
 #include "tokenizer.h"
 #include "lemmatizer_wrapper.h"
 
 using namespace std;
 
+// Which lemmas pass1 keeps per text column. The defaults keep every one.
+struct VocabOptions {
+    int min_df = 1;           // drop tokens found in fewer profiles
+    double max_df = 1.0;      // drop tokens found in more than this share of profiles
+    string stopwords_path;    // one lemma per line, e.g. config/stopwords_sk.txt
+    // > 0: hashing trick, a token's id is hashed_token_id(lemma, hash_bits) and
+    // no string map is kept; min_df/max_df do not apply, stopwords still do.
+    int hash_bits = 0;
+};
+
+static const int VOCAB_MAX_HASH_BITS = 30;
+
+// False if the options describe no token space: min_df < 1, max_df outside
+// (0, 1] or hash_bits outside 0..VOCAB_MAX_HASH_BITS.
+bool vocab_options_ok(const VocabOptions &opts);
+
+// "key = value" lines (min_df, max_df, stopwords, hash_bits); '#' starts a
+// comment line and keys left out keep their defaults. kurs, kurs --ingest and
+// api_cli all read config/vocab_options.txt, so they agree on the token space
+// and on the fingerprints built from it. A missing file leaves the defaults;
+// false on an unknown key, a malformed value or options that are not ok.
+bool load_vocab_options(const string &path, VocabOptions &out);
+
+// FNV-1a of the lemma folded to hash_bits bits, 1..VOCAB_MAX_HASH_BITS.
+inline int hashed_token_id(string_view lemma, int hash_bits) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : lemma) { h ^= c; h *= 1099511628211ull; }
+    return (int)((h ^ (h >> 32)) & ((1ull << hash_bits) - 1));
+}
+
+// Lowercase lemmas, one per line; '#' starts a comment line.
+bool load_stopwords(const string &path, unordered_set<string> &out);
+
 struct VocabBuilder {
     explicit VocabBuilder(const vector<string> &colKeys);
-    void pass1(const string &profiles_tsv, Tokenizer &tok, Lemmatiser &lem);
+    // num_threads == 0 uses all hardware threads; ids match the single-threaded build
+    void pass1(const string &profiles_tsv, Tokenizer &tok, Lemmatiser &lem, int num_threads = 0);
+    // Writes the CSVs and vocab.bin (see vocab_view.h).
     void save_vocab(const string &out_dir) const;
+    // Reads vocab.bin when present, the CSVs otherwise.
     bool load_vocab(const string &in_dir);
 
     unordered_map<string, unordered_map<string,int>> token2id_per_col;
@@ -23,11 +62,27 @@ struct VocabBuilder {
     unordered_map<string,int> address_part2_to_id;
     unordered_map<string,int> address_part3_to_id;
 
+    // When set, pass1 also writes the lemmatized token streams here for Encoder::pass2.
+    string token_cache_path;
+
+    // Profiles read by the last pass1.
+    uint64_t pass1_rows = 0;
+
+    // Applied by pass1 to the tokens it adds. Ids already in the vocab (e.g.
+    // from load_vocab before an incremental pass1) are never dropped or
+    // renumbered; new ones are pruned against the counts of this pass only.
+    VocabOptions options;
+
 private:
+    struct Partial;
     vector<string> colKeys;
-    void process_line_clubs(const string& line);
-    void process_line_tokens(const vector<string>& cols, Tokenizer &tok, Lemmatiser &lem);
-    void process_region_parts_from_cols(const vector<string>& cols);
+    void pass1_range(string_view chunk, Tokenizer &tok, Lemmatiser &lem, Partial &part) const;
+    void merge_partial(const Partial &part, const unordered_set<string> &stopwords, vector<vector<int>> &remap);
+    void prune_tokens(const vector<size_t> &first_new, uint64_t docs, vector<vector<vector<int>>> &remaps);
+    static void process_line_clubs(string_view line, Partial &part);
+    void process_line_tokens(const vector<string_view>& cols, Tokenizer &tok, Lemmatiser &lem, Partial &part) const;
+    static void process_region_parts_from_cols(const vector<string_view>& cols, Partial &part);
+    bool load_vocab_bin(const string &path);
     static string normalize_slug(const string& raw);
     static string normalize_address(const string& raw);
     static string csv_escape(const string& s);
@@ -0,0 +1,76 @@
+#ifndef VOCAB_VIEW_H
+#define VOCAB_VIEW_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "tsv_reader.h"
+
+using namespace std;
+
+// vocab.bin, written by VocabBuilder::save_vocab next to the CSVs:
+//   "PKVB" | version | table count | per table: offset of its header
+// Each table holds the strings of one map ordered by id in a contiguous
+// arena, a minimal perfect hash (hash and displace: buckets of ~3 keys,
+// one pilot per bucket) from string to slot plus a slot -> id array, and
+// optionally document counts per id. Hashed token columns store only
+// sorted (id, df) pairs. Sections are 8-byte aligned so a mapping is
+// queried in place.
+
+struct VocabTableSource {
+    string name;
+    vector<string_view> strings;          // by id; "" for unused ids
+    int empty_id = -1;                    // id whose string really is "", if any
+    bool index = true;                    // build the string -> id hash
+    vector<uint32_t> df;                  // by id, or empty
+    vector<pair<uint32_t,uint32_t>> df_pairs;  // sorted (id, df), for tables without strings
+};
+
+bool write_vocab_bin(const string& path, const vector<VocabTableSource>& tables);
+
+class VocabTable {
+public:
+    uint32_t size() const { return n; }  // ids, or df pairs without strings
+    bool has_strings() const { return offsets != nullptr; }
+    // -1 when s is not in the table or the table has no index.
+    int find(string_view s) const;
+    // Id of the entry "" (an unused id has "" too), or -1.
+    int empty_id() const { return empty; }
+    string_view str(uint32_t id) const;
+    uint32_t df(uint32_t id) const;
+    // i-th (id, df) of a table without strings.
+    pair<uint32_t,uint32_t> df_pair(uint32_t i) const { return make_pair(df_data[2*i], df_data[2*i+1]); }
+
+private:
+    friend class VocabView;
+    uint32_t n = 0;
+    int empty = -1;
+    uint32_t keys = 0;
+    uint32_t buckets = 0;
+    uint64_t seed = 0;
+    const uint32_t* offsets = nullptr;  // n + 1
+    const char* arena = nullptr;
+    const uint32_t* pilots = nullptr;   // buckets
+    const uint32_t* slot_ids = nullptr; // keys
+    const uint32_t* df_data = nullptr;  // n, or 2 * n when paired
+    bool paired_df = false;
+};
+
+// vocab.bin mapped read-only; tables stay valid until close().
+class VocabView {
+public:
+    bool open(const string& path);
+    void close();
+    bool is_open() const { return file.is_open(); }
+
+    // Tables: "tokens/<column>", "clubs", "club_titles", "address_part1".."3".
+    const VocabTable* table(string_view name) const;
+    const vector<pair<string_view, VocabTable>>& tables() const { return tabs; }
+
+private:
+    MappedFile file;
+    vector<pair<string_view, VocabTable>> tabs;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include "adjacency_view.h"
+#include "graph_builder.h"
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <climits>
+
+using namespace std;
+
+static const char ADJACENCY_BIN_MAGIC[4] = { 'P', 'K', 'A', 'J' };
+static const uint32_t ADJACENCY_BIN_VERSION = 1;
+static const size_t ADJACENCY_HEADER_SIZE = 24;
+
+AdjacencyView::AdjacencyView(const CsrGraph& graph)
+    : offs(graph.offsets.data()), neigh(graph.cols.data()), n(graph.num_nodes()) {}
+
+AdjacencyView::AdjacencyView(const uint64_t* offsets, const int* cols, int num_nodes)
+    : offs(offsets), neigh(cols), n(num_nodes) {}
+
+NeighborRange AdjacencyView::neighbors(int u) const {
+    NeighborRange r;
+    if (overrides) {
+        auto it = overrides->find(u);
+        if (it != overrides->end()) {
+            r.first = it->second.data();
+            r.last = r.first + it->second.size();
+            return r;
+        }
+    }
+    if (!has_node(u)) return r;
+    r.first = neigh + offs[u];
+    r.last = neigh + offs[u + 1];
+    return r;
+}
+
+AdjacencyView AdjacencyView::with_overrides(const unordered_map<int, vector<int>>* rows) const {
+    AdjacencyView v = *this;
+    v.overrides = rows;
+    return v;
+}
+
+bool write_adjacency_bin(const string& path, const CsrGraph& graph) {
+    const uint64_t nodes = (uint64_t)graph.num_nodes();
+    const uint64_t edges = (uint64_t)graph.num_edges();
+    const uint64_t zero = 0;
+    // replaced by rename, so a mapping of the previous file stays intact
+    const string tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        if (!out.is_open()) return false;
+        uint32_t version = ADJACENCY_BIN_VERSION;
+        out.write(ADJACENCY_BIN_MAGIC, 4);
+        out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        out.write(reinterpret_cast<const char*>(&nodes), sizeof(nodes));
+        out.write(reinterpret_cast<const char*>(&edges), sizeof(edges));
+        if (nodes > 0) out.write(reinterpret_cast<const char*>(graph.offsets.data()), (streamsize)((nodes + 1) * sizeof(uint64_t)));
+        else out.write(reinterpret_cast<const char*>(&zero), sizeof(zero));
+        // ids are never negative, so the int array is written as is
+        out.write(reinterpret_cast<const char*>(graph.cols.data()), (streamsize)(edges * sizeof(uint32_t)));
+        if (!out) return false;
+    }
+    error_code ec;
+    filesystem::rename(tmp, path, ec);
+    return !ec;
+}
+
+bool AdjacencyFile::open(const string& path) {
+    close();
+    if (!file.open(path)) return false;
+    const char* base = file.view().data();
+    const size_t size = file.size();
+    uint32_t version = 0;
+    uint64_t nodes = 0, edges = 0;
+    if (size < ADJACENCY_HEADER_SIZE + sizeof(uint64_t) || memcmp(base, ADJACENCY_BIN_MAGIC, 4) != 0) { close(); return false; }
+    memcpy(&version, base + 4, sizeof(version));
+    memcpy(&nodes, base + 8, sizeof(nodes));
+    memcpy(&edges, base + 16, sizeof(edges));
+    if (version != ADJACENCY_BIN_VERSION || nodes > (uint64_t)INT_MAX
+        || (size - ADJACENCY_HEADER_SIZE) / sizeof(uint64_t) < nodes + 1
+        || (size - ADJACENCY_HEADER_SIZE - (nodes + 1) * sizeof(uint64_t)) / sizeof(uint32_t) < edges) {
+        close();
+        return false;
+    }
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(base + ADJACENCY_HEADER_SIZE);
+    const int* cols = reinterpret_cast<const int*>(offsets + nodes + 1);
+    if (offsets[0] != 0 || offsets[nodes] != edges) { close(); return false; }
+    for (uint64_t u = 0; u < nodes; ++u) {
+        if (offsets[u] > offsets[u + 1]) { close(); return false; }
+    }
+    adj = AdjacencyView(offsets, cols, (int)nodes);
+    return true;
+}
+
+void AdjacencyFile::close() {
+    adj = AdjacencyView();
+    file.close();
+}
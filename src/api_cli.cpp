@@ -22,6 +22,8 @@
 #include "recommendation_tests.h"
 #include "user_loader.h"
 #include "ui.h"
+#include "pipeline.h"
+#include "serving_snapshot.h"
 
 using namespace std;
 
@@ -47,35 +49,38 @@ static string json_escape(const string &s) {
     return out;
 }
 
-static void write_profile_json(const UserProfile &p, ostream &os) {
+static void write_profile_json(const ProfileRef &p, ostream &os) {
+    const array<int,3> &region = p.region_parts;
+    ProfileRange<uint32_t> clubs = p.clubs;
+    ProfileRange<uint32_t> friends = p.friends;
     os << "{";
     os << "\"user_id\":" << p.user_id << ",";
     os << "\"public_flag\":" << p.public_flag << ",";
     os << "\"completion_percentage\":" << p.completion_percentage << ",";
     os << "\"gender\":" << p.gender << ",";
     os << "\"age\":" << p.age << ",";
-    os << "\"region_parts\":[" << p.region_parts[0] << "," << p.region_parts[1] << "," << p.region_parts[2] << "],";
+    os << "\"region_parts\":[" << region[0] << "," << region[1] << "," << region[2] << "],";
     os << "\"clubs\":[";
-    for (size_t i = 0; i < p.clubs.size(); ++i) {
-        if (i) os << ",";
-        os << p.clubs[i];
+    for (size_t k = 0; k < clubs.size(); ++k) {
+        if (k) os << ",";
+        os << clubs[k];
     }
     os << "],";
     os << "\"friends\":[";
-    for (size_t i = 0; i < p.friends.size(); ++i) {
-        if (i) os << ",";
-        os << p.friends[i];
+    for (size_t k = 0; k < friends.size(); ++k) {
+        if (k) os << ",";
+        os << friends[k];
     }
     os << "],";
     os << "\"token_cols\":[";
-    for (size_t t = 0; t < p.token_cols.size(); ++t) {
+    for (size_t t = 0; t < p.text_cols; ++t) {
         if (t) os << ",";
         os << "{";
         bool first = true;
-        for (auto &pr : p.token_cols[t]) {
+        for (const TokenCount &tc : p.tokens(t)) {
             if (!first) os << ",";
             first = false;
-            os << "\"" << pr.first << "\":" << pr.second;
+            os << "\"" << tc.token << "\":" << tc.count;
         }
         os << "}";
     }
@@ -90,85 +95,100 @@ int main(int argc, char** argv) {
     const string profiles = "data/soc-pokec-profiles.txt";
     const string rels = "data/soc-pokec-relationships.txt";
     const string TEXT_COLS_PATH = "config/text_columns.txt";
+    const string VOCAB_OPTIONS_PATH = "config/vocab_options.txt";
     vector<string> textCols = load_text_columns_from_file(TEXT_COLS_PATH);
-
-    Tokenizer tok;
-    Lemmatiser lemma("data/lem-me-sk.bin");
-
-    VocabBuilder vb(textCols);
-
-    const string DATA_DIR = "data";
-    bool loaded_vocab = vb.load_vocab(DATA_DIR);
-    if (! loaded_vocab) {
-        vb.pass1(profiles, tok, lemma);
-        vb.save_vocab(DATA_DIR);
-        cerr << "[api_cli] vocab built and saved to " << DATA_DIR << "\n";
-    } else {
-        cerr << "[api_cli] vocab loaded from " << DATA_DIR << "\n";
-    }
-
-    GraphBuilder gb;
-    const string adjacency_csv = "data/adjacency.csv";
-    bool loaded = gb.load_serialized(adjacency_csv);
-    if (! loaded) {
-        gb.load_edges(rels, 0);
-        gb.save_serialized(adjacency_csv);
-        cerr << "[api_cli] adjacency built and saved to " << adjacency_csv << "\n";
-    } else {
-        cerr << "[api_cli] adjacency loaded from " << adjacency_csv << "\n";
+    // must match kurs, or each rebuilds the other's vocab and users.bin
+    VocabOptions vocab_opts;
+    if (!load_vocab_options(VOCAB_OPTIONS_PATH, vocab_opts)) {
+        cerr << "[api_cli] cannot use " << VOCAB_OPTIONS_PATH << "\n";
+        return 1;
     }
 
-    unordered_map<int, vector<int>> adj_list = build_adj_list(gb.adjacency);
-
-    const string users_encoded = "data/users_encoded.csv";
-
-    unordered_map<int, UserProfile> profiles_map;
-
+    // api_cli [load_users] [--write-snapshot] [--cache <profiles>]
+    // --cache serves every user from users.bin, keeping at most <profiles>
+    // of them decoded, instead of loading load_users of them up front.
     size_t to_load = 0;
-    if (argc > 1) {
-        try { to_load = (size_t)stoi(argv[1]); } catch(...) { to_load = 0; }
+    bool write_snapshot = false;
+    size_t cache_entries = 0;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--write-snapshot") { write_snapshot = true; continue; }
+        if (arg == "--cache") {
+            // a whole positive number; stoul alone would wrap "-5" around
+            string value = i + 1 < argc ? argv[++i] : "";
+            size_t used = 0;
+            long long n = 0;
+            try { n = stoll(value, &used); } catch(...) { used = 0; }
+            if (used == 0 || used != value.size() || n <= 0) {
+                cerr << "[api_cli] --cache needs a positive number of profiles, got '" << value << "'\n";
+                return 1;
+            }
+            cache_entries = (size_t)n;
+            continue;
+        }
+        try { to_load = (size_t)stoi(arg); } catch(...) { to_load = 0; }
     }
-
-    bool ok = load_users_encoded(users_encoded, textCols, profiles_map, to_load);
-    if (! ok) {
-        cerr << "[api_cli] cannot load users_encoded.csv\n";
+    if (cache_entries > 0 && write_snapshot) {
+        cerr << "[api_cli] --write-snapshot needs resident profiles, drop --cache\n";
         return 1;
     }
-    cerr << "[api_cli] loaded profiles: " << profiles_map.size() << "\n";
 
-    int median_age = 0;
-    const string median_path = DATA_DIR + "/median_age.txt";
-    if (load_median_age(median_path, median_age)) {
-        cerr << "[api_cli] loaded median_age=" << median_age << " from " << median_path << "\n";
+    PipelineConfig cfg;
+    cfg.profiles = profiles;
+    cfg.relationships = rels;
+    cfg.text_columns = textCols;
+    cfg.vocab = vocab_opts;
+    cfg.max_users = to_load;
+    cfg.tag = "api_cli";
+    cfg.resident_profiles = cache_entries == 0;
+    PipelineData data(textCols);
+    ProfileStore &profiles_map = data.profiles;
+    unordered_map<string, pair<float,float>> &col_norms_map = data.col_norms;
+    Recommender rec(&profiles_map, data.adjacency);
+    ProfileCache cache;
+    unordered_map<int,string> club_id_to_name;
+
+    // A snapshot taken from the current artifacts replaces the whole pipeline.
+    const string snapshot_path = "data/serving.snap";
+    ServingSnapshot snap;
+    bool restored = !write_snapshot && cache_entries == 0 && snap.open(snapshot_path) && snap.key() == serving_snapshot_key(cfg)
+                    && snap.restore(textCols, data, rec, club_id_to_name);
+    if (restored) {
+        cerr << "[api_cli] serving state restored from " << snapshot_path << " (" << rec.profiles.size() << " users)\n";
     } else {
-        median_age = compute_median_age_from_profiles(profiles_map);
-        if (median_age > 0) {
-            save_median_age(median_path, median_age);
-            cerr << "[api_cli] computed median_age=" << median_age << " and saved to " << median_path << "\n";
-        } else {
-            cerr << "[api_cli] computed median_age=0\n";
+        snap.close();
+        if (! run_pipeline(cfg, data, cerr)) {
+            cerr << "[api_cli] pipeline failed\n";
+            return 1;
+        }
+        rec.adjacency = data.adjacency;
+        rec.profiles = data.profiles_view;
+        if (cache_entries > 0) {
+            if (!cache.open("data/users.bin", "data/users.idx", textCols.size(), data.adjacency, cache_entries, data.median_age)) {
+                cerr << "[api_cli] cannot open data/users.bin\n";
+                return 1;
+            }
+            rec = Recommender(&cache, data.adjacency);
+            cerr << "[api_cli] serving " << cache.num_users() << " users through a cache of " << cache_entries << " profiles\n";
+        }
+        rec.set_field_normalizers(col_norms_map);
+        rec.set_column_normalizers(col_norms_map);
+        rec.compute_idf_from_profiles(textCols);
+        if (const VocabTable* clubs = data.vocab_view.table("clubs")) {
+            for (uint32_t id = 0; id < clubs->size(); ++id) club_id_to_name[(int)id] = string(clubs->str(id));
         }
     }
-    int replaced = fill_missing_ages(profiles_map, median_age);
-    cerr << "[api_cli] replaced " << replaced << " zero-ages with median_age=" << median_age << "\n";
-
-    unordered_map<string, pair<float,float>> col_norms_map;
-    const string norms_path = DATA_DIR + "/column_normalizers.csv";
-    if (load_column_normalizers(norms_path, col_norms_map)) {
-        cerr << "[api_cli] loaded column normalizers from " << norms_path << " (" << col_norms_map.size() << " entries)\n";
-    } else {
-        cerr << "[api_cli] column_normalizers.csv not found or invalid\n";
+    if (write_snapshot) {
+        // keyed after the pipeline, which may have rebuilt stale artifacts
+        if (! write_serving_snapshot(snapshot_path, serving_snapshot_key(cfg), textCols, data, rec, club_id_to_name)) {
+            cerr << "[api_cli] cannot write " << snapshot_path << "\n";
+            return 1;
+        }
+        cerr << "[api_cli] serving snapshot saved to " << snapshot_path << "\n";
+        return 0;
     }
-
-    Recommender rec(&profiles_map, &adj_list);
-    rec.set_field_normalizers(col_norms_map);
-    rec.set_column_normalizers(col_norms_map);
-    rec.compute_idf_from_profiles(textCols);
     rec.set_text_columns(textCols);
 
-    unordered_map<int,string> club_id_to_name;
-    for (auto &kv : vb.club_to_id) club_id_to_name[kv.second] = kv.first;
-
     cout << "READY" << endl;
     cout.flush();
 
@@ -192,14 +212,32 @@ int main(int argc, char** argv) {
             cout.flush();
             continue;
         }
+        if (cmd == "STATS") {
+            ostringstream os;
+            if (rec.cache) {
+                ProfileCacheStats st = cache.stats();
+                os << "{\"users\":" << cache.num_users() << ",\"cache\":{"
+                   << "\"capacity\":" << st.capacity << ",\"entries\":" << st.entries
+                   << ",\"hits\":" << st.hits << ",\"misses\":" << st.misses << ",\"evictions\":" << st.evictions
+                   << ",\"hit_rate\":" << std::fixed << std::setprecision(6) << st.hit_rate()
+                   << ",\"mean_miss_us\":" << st.mean_miss_us() << ",\"memory_bytes\":" << st.memory_bytes << "}}";
+            } else {
+                os << "{\"users\":" << rec.profiles.size() << ",\"cache\":null,\"memory_bytes\":" << profiles_map.memory_bytes() << "}";
+            }
+            cout << os.str() << endl;
+            cout.flush();
+            continue;
+        }
         if (cmd == "EXIT") {
             cout << "{\"ok\":true, \"exiting\":true}" << endl;
             cout.flush();
             break;
         }
         if (cmd == "USER" && uid >= 0) {
-            auto it = profiles_map.find(uid);
-            if (it == profiles_map.end()) {
+            ProfileHandle profile;
+            int pi = rec.profiles.index_of(uid);
+            if (!rec.cache && pi >= 0) profile = ProfileHandle(rec.profiles.ref(pi));
+            if (rec.cache ? !cache.get(uid, profile) : pi < 0) {
                 cout << "{\"error\":\"not found\",\"user_id\":" << uid << "}" << endl;
                 cout.flush();
                 continue;
@@ -207,7 +245,7 @@ int main(int argc, char** argv) {
             ostringstream os;
             os << "{";
             os << "\"profile\":";
-            write_profile_json(it->second, os);
+            write_profile_json(profile.ref(), os);
             os << ",";
             os << "\"recommendations\":{";
             auto out_g = rec.recommend_graph_registration(uid, 20, 5000);
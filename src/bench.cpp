@@ -0,0 +1,297 @@
+#include "bench.h"
+#include "club_links.h"
+#include "tokenizer.h"
+#include "lemmagen.h"
+#include "lemmatizer_wrapper.h"
+#include "vocab_builder.h"
+#include "encoder.h"
+#include "graph_builder.h"
+#include "user_loader.h"
+#include "bin_reader.h"
+#include "recommender.h"
+#include "evaluator.h"
+#include "utils.h"
+#include "../third_party/lemmagen/src/RdrLemmatizer.h"
+
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+static double elapsed_ms(chrono::steady_clock::time_point t0) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+static void regex_links(const string& line, const regex& re, bool with_title, vector<pair<string,string>>& out) {
+    string::const_iterator start = line.cbegin();
+    smatch m;
+    while (regex_search(start, line.cend(), m, re)) {
+        out.emplace_back(m[1].str(), with_title ? m[2].str() : string());
+        start = m.suffix().first;
+    }
+}
+
+void run_club_scanner_bench(const string& profiles_tsv, size_t max_lines) {
+    vector<string> lines;
+    {
+        ifstream in(profiles_tsv);
+        if (!in.is_open()) {
+            cout << "[bench] cannot open " << profiles_tsv << "\n";
+            return;
+        }
+        string line;
+        while (lines.size() < max_lines && getline(in, line)) {
+            if (!line.empty()) lines.push_back(line);
+        }
+    }
+    cout << "[bench] club links over " << lines.size() << " profile lines\n";
+
+    struct Mode { const char* name; ClubScanMode mode; const char* pattern; };
+    const Mode modes[] = {
+        { "href",   ClubHref,   "href=\"/klub/([^\"]+)\"" },
+        { "tag",    ClubTag,    "<a[^>]*href=\"/klub/([^\"]+)\"[^>]*>" },
+        { "anchor", ClubAnchor, "<a[^>]*href=\"/klub/([^\"]+)\"[^>]*>([^<]*)</a>" },
+    };
+
+    for (const Mode &md : modes) {
+        bool with_title = (md.mode == ClubAnchor);
+        vector<vector<pair<string,string>>> expected(lines.size());
+
+        // the old code compiled the regex on every call
+        auto t0 = chrono::steady_clock::now();
+        size_t regex_found = 0;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            regex re(md.pattern);
+            regex_links(lines[i], re, with_title, expected[i]);
+            regex_found += expected[i].size();
+        }
+        double regex_per_call_ms = elapsed_ms(t0);
+
+        t0 = chrono::steady_clock::now();
+        regex re(md.pattern);
+        vector<pair<string,string>> tmp;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            tmp.clear();
+            regex_links(lines[i], re, with_title, tmp);
+        }
+        double regex_once_ms = elapsed_ms(t0);
+
+        t0 = chrono::steady_clock::now();
+        vector<ClubLink> links;
+        size_t scan_found = 0;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            links.clear();
+            scan_club_links(lines[i], md.mode, links);
+            scan_found += links.size();
+        }
+        double scan_ms = elapsed_ms(t0);
+
+        size_t mismatched_lines = 0;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            links.clear();
+            scan_club_links(lines[i], md.mode, links);
+            bool same = links.size() == expected[i].size();
+            for (size_t k = 0; same && k < links.size(); ++k) {
+                same = links[k].slug == expected[i][k].first && links[k].title == expected[i][k].second;
+            }
+            if (!same) ++mismatched_lines;
+        }
+
+        cout << "[bench] " << md.name << ": links regex=" << regex_found << " scanner=" << scan_found
+             << " mismatched_lines=" << mismatched_lines
+             << " | regex per call " << regex_per_call_ms << " ms"
+             << ", regex compiled once " << regex_once_ms << " ms"
+             << ", scanner " << scan_ms << " ms"
+             << " (x" << (scan_ms > 0.0 ? regex_per_call_ms / scan_ms : 0.0) << ")\n";
+    }
+}
+
+void run_lemmatizer_bench(const string& model_path, const string& profiles_tsv, size_t max_lines) {
+    // every token occurrence of the text columns, as the ETL passes see them
+    vector<string> words;
+    {
+        ifstream in(profiles_tsv);
+        if (!in.is_open()) {
+            cout << "[bench] cannot open " << profiles_tsv << "\n";
+            return;
+        }
+        Tokenizer tok;
+        TokenBuffer buf;
+        string line, cell;
+        for (size_t n = 0; n < max_lines && getline(in, line); ++n) {
+            stringstream ss(line);
+            for (size_t col = 0; getline(ss, cell, '\t'); ++col) {
+                if (col < 9 || cell.empty() || cell == "null") continue;
+                tok.tokenize(cell, buf);
+                for (string_view w : buf.tokens) words.emplace_back(w);
+            }
+        }
+    }
+    int status = STATUS_FAILED;
+    lem_model* model = lem_model_open(model_path.c_str(), &status);
+    if (model == nullptr) {
+        cout << "[bench] cannot open lemmatizer model " << model_path << "\n";
+        return;
+    }
+    RdrLemmatizer reference(model_path.c_str());
+    cout << "[bench] lemmatizer over " << words.size() << " tokens\n";
+
+    vector<string> expected(words.size());
+    char buf[LEM_MAX_OUTPUT_LEN];
+    auto t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < words.size(); ++i) {
+        reference.Lemmatize(words[i].c_str(), buf);
+        expected[i] = buf;
+    }
+    double reference_ms = elapsed_ms(t0);
+
+    size_t single_mismatches = 0;
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < words.size(); ++i) {
+        size_t len = lem_model_lemmatize(model, words[i].c_str(), buf);
+        if (expected[i].compare(0, string::npos, buf, len) != 0) ++single_mismatches;
+    }
+    double flat_ms = elapsed_ms(t0);
+
+    const size_t batch = 64;
+    vector<const char*> ptrs;
+    vector<char> out(batch * LEM_MAX_OUTPUT_LEN);
+    vector<size_t> lens(batch);
+    size_t batch_mismatches = 0;
+    t0 = chrono::steady_clock::now();
+    for (size_t b = 0; b < words.size(); b += batch) {
+        size_t n = min(batch, words.size() - b);
+        ptrs.clear();
+        for (size_t i = 0; i < n; ++i) ptrs.push_back(words[b + i].c_str());
+        lem_model_lemmatize_batch(model, ptrs.data(), n, out.data(), lens.data());
+        for (size_t i = 0; i < n; ++i) {
+            if (expected[b + i].compare(0, string::npos, out.data() + i * LEM_MAX_OUTPUT_LEN, lens[i]) != 0) ++batch_mismatches;
+        }
+    }
+    double batch_ms = elapsed_ms(t0);
+    lem_model_close(model);
+
+    cout << "[bench] lemmatize: mismatches flat=" << single_mismatches << " batch=" << batch_mismatches
+         << " | byte tree " << reference_ms << " ms"
+         << ", flat tree " << flat_ms << " ms"
+         << ", flat batch " << batch_ms << " ms"
+         << " (x" << (batch_ms > 0.0 ? reference_ms / batch_ms : 0.0) << ")\n";
+}
+
+void run_vocab_options_bench(const string& profiles_tsv, const string& relationships,
+                             const string& model_path, const vector<string>& text_columns,
+                             const string& stopwords_path, size_t max_lines) {
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / "vocab_options_bench";
+    error_code ec;
+    fs::create_directories(dir, ec);
+    const string sample = (dir / "profiles.tsv").string();
+    {
+        ifstream in(profiles_tsv);
+        ofstream out(sample, ios::binary);
+        if (!in.is_open() || !out.is_open()) {
+            cout << "[bench] cannot open " << profiles_tsv << "\n";
+            return;
+        }
+        string line;
+        for (size_t n = 0; n < max_lines && getline(in, line); ++n) out << line << "\n";
+    }
+    GraphBuilder gb;
+    gb.load_edges(relationships);
+    AdjacencyView adj(gb.graph);
+    Tokenizer tok;
+    Lemmatiser lem(model_path);
+
+    struct Preset { const char* name; VocabOptions opts; };
+    vector<Preset> presets(7);
+    presets[0].name = "all tokens";
+    presets[1].name = "min_df=2";       presets[1].opts.min_df = 2;
+    presets[2].name = "min_df=5";       presets[2].opts.min_df = 5;
+    presets[3].name = "min_df=2 max_df=0.5"; presets[3].opts.min_df = 2; presets[3].opts.max_df = 0.5;
+    presets[4].name = "stopwords";      presets[4].opts.stopwords_path = stopwords_path;
+    presets[5].name = "hash 2^18";      presets[5].opts.hash_bits = 18;
+    presets[6].name = "hash 2^14";      presets[6].opts.hash_bits = 14;
+
+    double base_interest = -1.0;
+    for (const Preset &ps : presets) {
+        VocabBuilder vb(text_columns);
+        vb.options = ps.opts;
+        auto t0 = chrono::steady_clock::now();
+        vb.pass1(sample, tok, lem);
+        double vocab_ms = elapsed_ms(t0);
+        size_t vocab_ids = 0;
+        for (auto &kv : vb.docfreq_per_col) vocab_ids += kv.second.size();
+
+        Encoder enc(text_columns, vb.token2id_per_col, vb.club_to_id,
+                    vb.address_part1_to_id, vb.address_part2_to_id, vb.address_part3_to_id, adj);
+        enc.hash_bits = ps.opts.hash_bits;
+        if (ps.opts.hash_bits > 0 && !ps.opts.stopwords_path.empty()) load_stopwords(ps.opts.stopwords_path, enc.stopwords);
+        const string bin = (dir / "users.bin").string(), idx = (dir / "users.idx").string();
+        ProfileStore profiles;
+        if (!enc.pass2(sample, bin, idx) || !load_users_bin(bin, idx, text_columns, adj, profiles, 0)) {
+            cout << "[bench] " << ps.name << ": encoding failed\n";
+            continue;
+        }
+        size_t entries = 0;
+        for (int i = 0; i < (int)profiles.size(); ++i)
+            for (size_t t = 0; t < text_columns.size(); ++t) entries += profiles.tokens(i, t).size();
+
+        Recommender rec(&profiles, adj);
+        rec.compute_idf_from_profiles(text_columns);
+        rec.set_text_columns(text_columns);
+        const size_t n = profiles.size();
+        mt19937 rng(7);
+        const size_t pairs = n == 0 ? 0 : 20000;
+        volatile double sink = 0.0;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < pairs; ++i)
+            sink = sink + rec.profile_similarity((int)(rng() % n), (int)(rng() % n), text_columns);
+        double sim_ms = elapsed_ms(t0);
+
+        EvalMetrics m = evaluate_recommenders_holdout(profiles, adj, text_columns, 200, 10);
+        if (base_interest < 0.0) base_interest = m.interest_hit;
+        cout << "[bench] " << ps.name << ": vocab ids=" << vocab_ids << " (pass1 " << vocab_ms << " ms)"
+             << ", token entries/user=" << (profiles.empty() ? 0.0 : (double)entries / (double)profiles.size())
+             << ", similarity " << (pairs ? sim_ms * 1000.0 / (double)pairs : 0.0) << " us/pair"
+             << " | hit graph=" << m.graph_hit << " collab=" << m.collab_hit << " interest=" << m.interest_hit
+             << " (" << (m.interest_hit - base_interest >= 0 ? "+" : "") << (m.interest_hit - base_interest) << ")"
+             << "\n";
+    }
+    fs::remove_all(dir, ec);
+}
+
+void run_record_decode_bench(const string& users_bin, const string& users_idx, size_t num_text_columns) {
+    UserRecordReader reader;
+    if (!reader.open(users_bin, users_idx)) {
+        cout << "[bench] cannot open " << users_bin << "\n";
+        return;
+    }
+    struct Preset { const char* name; RecordMask mask; };
+    vector<Preset> presets(4);
+    presets[0].name = "all";
+    presets[1].name = "fixed";     presets[1].mask = RecordMask::fixed_only();
+    presets[2].name = "clubs";     presets[2].mask = RecordMask::fixed_only().add_clubs();
+    presets[3].name = "3 columns"; presets[3].mask = RecordMask::fixed_only();
+    for (size_t t = 0; t < num_text_columns && t < 3; ++t) presets[3].mask.add_tokens(t);
+    cout << "[bench] record decode over " << reader.size() << " records\n";
+
+    UserRecordView rec;
+    for (const Preset &ps : presets) {
+        size_t words = 0, bad = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < reader.size(); ++i) {
+            if (!reader.read_at(i, rec, ps.mask)) ++bad;
+            words += rec.words.size();
+        }
+        double ms = elapsed_ms(t0);
+        cout << "[bench] " << ps.name << ": " << (reader.size() ? ms * 1000.0 / (double)reader.size() : 0.0) << " us/record, "
+             << (reader.size() ? (double)words / (double)reader.size() : 0.0) << " words/record"
+             << (bad ? ", corrupt=" + to_string(bad) : string()) << "\n";
+    }
+}
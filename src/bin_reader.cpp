@@ -1,128 +1,223 @@
 #include "bin_reader.h"
-#include <fstream>
-#include <sstream>
+#include "varint.h"
+#include <cstring>
+#include <algorithm>
 
 using namespace std;
 
-bool load_index_map(const string& idx_path, unordered_map<int, pair<uint32_t,uint32_t> >& out_idx) {
-    out_idx.clear();
-    ifstream in(idx_path);
+bool users_bin_header_ok(string_view file) {
+    uint32_t version = 0;
+    if (file.size() < USERS_BIN_HEADER_SIZE || memcmp(file.data(), USERS_BIN_MAGIC, 4) != 0) return false;
+    memcpy(&version, file.data() + 4, sizeof(version));
+    return version == USERS_BIN_VERSION;
+}
 
-    if (!in.is_open())
-        return false;
+bool parse_user_record(const char* p, size_t len, UserRecord& out_rec) {
+    UserRecordView v;
+    if (!parse_user_record_view(p, len, v)) return false;
+    out_rec.user_id = v.user_id;
+    out_rec.ispublic = v.ispublic;
+    out_rec.completion_percentage = v.completion_percentage;
+    out_rec.gender = v.gender;
+    out_rec.age = v.age;
+    out_rec.region.assign(v.region.begin(), v.region.end());
+    out_rec.clubs.assign(v.clubs.begin(), v.clubs.end());
+    out_rec.token_cols.resize(v.token_cols.size());
+    for (size_t ci = 0; ci < v.token_cols.size(); ++ci) {
+        const TokenPairSpan &col = v.token_cols[ci];
+        auto &vec = out_rec.token_cols[ci];
+        vec.resize(col.size);
+        for (uint32_t i = 0; i < col.size; ++i) vec[i] = make_pair(col.token(i), col.count(i));
+    }
+    return true;
+}
 
-    string line;
-    while (getline(in, line)) {
-        if (line.empty())
-            continue;
-        stringstream ss(line);
-        string a,b,c;
-        if (! (getline(ss, a, ',') && getline(ss, b, ',') && getline(ss, c)))
+bool parse_user_record_view(const char* p, size_t len, UserRecordView& out, const RecordMask& mask) {
+    const uint8_t* q = reinterpret_cast<const uint8_t*>(p);
+    const uint8_t* end = q + len;
+    auto next = [&](uint32_t& x) {
+        uint64_t v = 0;
+        if (!get_varint(q, end, v) || v > 0xFFFFFFFFu) return false;
+        x = (uint32_t)v;
+        return true;
+    };
+    // every value takes at least a byte, so a count can never exceed the
+    // bytes left, and the words never exceed len: reserving len keeps the
+    // spans valid while they are filled
+    auto fits = [&](uint32_t count, size_t width) { return count <= (size_t)(end - q) / width; };
+    vector<uint32_t> &w = out.words;
+    w.clear();
+    w.reserve(len);
+    uint32_t n = 0;
+    if (!next(out.user_id) || !next(out.ispublic) || !next(out.completion_percentage)
+        || !next(out.gender) || !next(n) || !fits(n, 1))
+        return false;
+    out.ispublic -= 1;
+    out.completion_percentage -= 1;
+    out.gender -= 1;
+    out.region.data = w.data() + w.size();
+    out.region.size = n;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t x = 0;
+        if (!next(x)) return false;
+        w.push_back(x - 1);
+    }
+    // section count and lengths: clubs, then one per token column
+    if (!next(out.age) || !next(n) || n == 0 || !fits(n, 1)) return false;
+    const uint8_t* lengths = q;
+    for (uint32_t s = 0; s < n; ++s) {
+        uint32_t x = 0;
+        if (!next(x)) return false;
+    }
+    const uint8_t* lengths_end = q;
+    const uint8_t* record_end = end;
+    out.clubs = U32Span();
+    out.token_cols.assign(n - 1, TokenPairSpan());
+    for (uint32_t s = 0; s < n; ++s) {
+        uint64_t size = 0;
+        get_varint(lengths, lengths_end, size);
+        if (size > (uint64_t)(record_end - q)) return false;
+        end = q + size;
+        if (size == 0 || !(s == 0 ? mask.clubs() : mask.tokens(s - 1))) {
+            q = end;
             continue;
-        int uid = atoi(a.c_str());
-        uint32_t off = (uint32_t) atoi(b.c_str());
-        uint32_t len = (uint32_t) atoi(c.c_str());
-        out_idx[uid] = make_pair(off, len);
+        }
+        uint32_t count = 0;
+        uint32_t prev = 0;
+        if (!next(count) || !fits(count, s == 0 ? 1 : 2)) return false;
+        const size_t at = w.size();
+        if (s == 0) {
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t gap = 0;
+                if (!next(gap)) return false;
+                prev += gap;
+                w.push_back(prev);
+            }
+            out.clubs.data = w.data() + at;
+            out.clubs.size = count;
+        } else {
+            w.resize(at + 2 * (size_t)count);
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t gap = 0;
+                if (!next(gap)) return false;
+                prev += gap;
+                w[at + 2 * i] = prev;
+            }
+            for (uint32_t i = 0; i < count; ++i)
+                if (!next(w[at + 2 * i + 1])) return false;
+            out.token_cols[s - 1].data = w.data() + at;
+            out.token_cols[s - 1].size = count;
+        }
+        if (q != end) return false;
     }
-
-    in.close();
     return true;
 }
 
-static string read_string_len(ifstream& in, uint32_t len) {
-    if (len == 0)
-        return string();
-
-    string s;
-    s.resize(len);
-    in.read(&s[0], (streamsize) len);
-
-    return s;
+bool UsersIndex::open(const string& path) {
+    close();
+    if (!file.open(path)) return false;
+    const char* base = file.view().data();
+    const size_t size = file.size();
+    uint32_t version = 0;
+    uint64_t count = 0, slots = 0;
+    if (size < USERS_IDX_HEADER_SIZE || memcmp(base, USERS_IDX_MAGIC, 4) != 0) { close(); return false; }
+    memcpy(&version, base + 4, sizeof(version));
+    memcpy(&layout, base + 8, sizeof(layout));
+    memcpy(&count, base + 16, sizeof(count));
+    memcpy(&slots, base + 24, sizeof(slots));
+    if (version != USERS_IDX_VERSION || (layout != USERS_IDX_DIRECT && layout != USERS_IDX_SORTED)
+        || count > USERS_IDX_NONE || (size - USERS_IDX_HEADER_SIZE) / sizeof(UsersIndexEntry) < count
+        || size - USERS_IDX_HEADER_SIZE - count * sizeof(UsersIndexEntry) != slots * sizeof(uint32_t)
+        || (layout == USERS_IDX_SORTED && slots != count)) {
+        close();
+        return false;
+    }
+    n = (size_t)count;
+    table_size = (size_t)slots;
+    entries = reinterpret_cast<const UsersIndexEntry*>(base + USERS_IDX_HEADER_SIZE);
+    table = reinterpret_cast<const uint32_t*>(entries + n);
+    for (size_t i = 0; i < table_size; ++i) {
+        if (table[i] != USERS_IDX_NONE && table[i] >= n) { close(); return false; }
+    }
+    return true;
 }
 
-bool read_user_record(const string& bin_path,
-                      const unordered_map<int, pair<uint32_t,uint32_t> >& idx_map,
-                      int user_id,
-                      UserRecord& out_rec) {
-    out_rec = UserRecord();
+void UsersIndex::close() {
+    file.close();
+    entries = nullptr;
+    table = nullptr;
+    n = table_size = 0;
+    layout = USERS_IDX_DIRECT;
+}
 
-    auto it = idx_map.find(user_id);
-    if (it == idx_map.end())
-        return false;
+int UsersIndex::find(int user_id) const {
+    if (layout == USERS_IDX_DIRECT) {
+        if (user_id < 0 || (size_t)user_id >= table_size || table[user_id] == USERS_IDX_NONE) return -1;
+        return (int)table[user_id];
+    }
+    // of two entries with one id the later sorts last
+    const uint32_t* it = upper_bound(table, table + table_size, user_id,
+                                     [&](int id, uint32_t e) { return id < entries[e].user_id; });
+    if (it == table || entries[*(it - 1)].user_id != user_id) return -1;
+    return (int)*(it - 1);
+}
 
-    pair<uint32_t,uint32_t> pr = it->second;
-    uint32_t offset = pr.first;
-    ifstream in(bin_path, ios::binary);
-    if (! in.is_open())
+bool UserRecordReader::open(const string& users_bin, const string& users_idx) {
+    close();
+    if (!bin.open(users_bin, true) || !index.open(users_idx) || !users_bin_header_ok(bin.view())) {
+        close();
         return false;
+    }
+    return true;
+}
 
-    in.seekg((streamoff) offset);
-
-    // user_id
-    uint32_t uid = 0;
-    in.read(reinterpret_cast<char*>(&uid), sizeof(uint32_t));
-    out_rec.user_id = uid;
-
-    // ispublic
-    uint32_t ispub = 0;
-    in.read(reinterpret_cast<char*>(&ispub), sizeof(uint32_t));
-    out_rec.ispublic = ispub;
-
-    // completion_percentage
-    uint32_t completion = 0;
-    in.read(reinterpret_cast<char*>(&completion), sizeof(uint32_t));
-    out_rec.completion_percentage = completion;
-
-    // gender (numeric)
-    uint32_t gender = 0;
-    in.read(reinterpret_cast<char*>(&gender), sizeof(uint32_t));
-    out_rec.gender = gender;
+void UserRecordReader::close() {
+    bin.close();
+    index.close();
+}
 
-    // region: count + elements
-    uint32_t region_count = 0;
-    in.read(reinterpret_cast<char*>(&region_count), sizeof(uint32_t));
-    out_rec.region.clear();
-    for (uint32_t i = 0; i < region_count; ++i) {
-        uint32_t pid = 0;
-        in.read(reinterpret_cast<char*>(&pid), sizeof(uint32_t));
-        out_rec.region.push_back(pid);
-    }
+bool UserRecordReader::read_at(size_t i, UserRecordView& out, const RecordMask& mask) const {
+    const UsersIndexEntry &s = index[i];
+    if (s.offset < USERS_BIN_HEADER_SIZE || s.offset > bin.size() || s.length > bin.size() - s.offset) return false;
+    return parse_user_record_view(bin.view().data() + s.offset, s.length, out, mask);
+}
 
-    // age as uint32_t
-    uint32_t age = 0;
-    in.read(reinterpret_cast<char*>(&age), sizeof(uint32_t));
-    out_rec.age = age;
+bool UserRecordReader::read(int user_id, UserRecordView& out, const RecordMask& mask) const {
+    int s = index.find(user_id);
+    return s >= 0 && read_at((size_t)s, out, mask);
+}
 
-    // clubs
-    uint32_t clubs_count = 0;
-    in.read(reinterpret_cast<char*>(&clubs_count), sizeof(uint32_t));
-    out_rec.clubs.clear();
-    for (uint32_t i = 0; i < clubs_count; ++i) {
-        uint32_t cid = 0;
-        in.read(reinterpret_cast<char*>(&cid), sizeof(uint32_t));
-        out_rec.clubs.push_back(cid);
+size_t UserRecordReader::read_many(const int* ids, size_t n, vector<UserRecordView>& out, const RecordMask& mask) const {
+    out.resize(n);
+    vector<pair<uint64_t, uint32_t>> order;  // (offset, k), k into ids
+    vector<int> slot_of(n);
+    order.reserve(n);
+    for (size_t k = 0; k < n; ++k) {
+        out[k].user_id = 0;
+        slot_of[k] = index.find(ids[k]);
+        if (slot_of[k] < 0) continue;
+        order.emplace_back(index[slot_of[k]].offset, (uint32_t)k);
     }
-
-    // token columns
-    uint32_t cols_num = 0;
-    in.read(reinterpret_cast<char*>(&cols_num), sizeof(uint32_t));
-    out_rec.token_cols.clear();
-    out_rec.token_cols.resize(cols_num);
-    for (uint32_t ci = 0; ci < cols_num; ++ci) {
-        uint32_t pairs_count = 0;
-        in.read(reinterpret_cast<char*>(&pairs_count), sizeof(uint32_t));
-        vector<pair<uint32_t,uint32_t>> vec;
-        vec.reserve(pairs_count);
-        for (uint32_t pi = 0; pi < pairs_count; ++pi) {
-            uint32_t tid = 0;
-            uint32_t cnt = 0;
-            in.read(reinterpret_cast<char*>(&tid), sizeof(uint32_t));
-            in.read(reinterpret_cast<char*>(&cnt), sizeof(uint32_t));
-            vec.push_back(make_pair(tid, cnt));
+    sort(order.begin(), order.end());
+    // nearby records share one request
+    const uint64_t gap = 4096;
+    uint64_t run_begin = 0, run_end = 0;
+    for (size_t j = 0; j < order.size(); ++j) {
+        uint64_t b = order[j].first, e = b + index[slot_of[order[j].second]].length;
+        if (j > 0 && b <= run_end + gap) {
+            run_end = max(run_end, e);
+            continue;
         }
-        out_rec.token_cols[ci] = std::move(vec);
+        if (j > 0) bin.will_need((size_t)run_begin, (size_t)(run_end - run_begin));
+        run_begin = b;
+        run_end = e;
     }
-
-    in.close();
-    return true;
+    if (!order.empty()) bin.will_need((size_t)run_begin, (size_t)(run_end - run_begin));
+    size_t found = 0;
+    for (auto &o : order) {
+        UserRecordView &v = out[o.second];
+        if (read_at((size_t)slot_of[o.second], v, mask)) ++found;
+        else v.user_id = 0;
+    }
+    return found;
 }
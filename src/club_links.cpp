@@ -0,0 +1,69 @@
+#include "club_links.h"
+
+using namespace std;
+
+static const string_view HREF_NEEDLE = "href=\"/klub/";
+
+static void scan_hrefs(string_view text, vector<ClubLink>& out) {
+    size_t pos = 0;
+    while (true) {
+        size_t q = text.find(HREF_NEEDLE, pos);
+        if (q == string_view::npos) return;
+        size_t s = q + HREF_NEEDLE.size();
+        size_t e = text.find('"', s);
+        if (e == string_view::npos) return;
+        if (e == s) { pos = q + 1; continue; }
+        ClubLink link;
+        link.slug = text.substr(s, e - s);
+        out.push_back(link);
+        pos = e + 1;
+    }
+}
+
+// Tries the href starting at q; returns the end of the match or npos.
+static size_t match_tag_at(string_view text, size_t q, ClubScanMode mode, ClubLink& link) {
+    size_t s = q + HREF_NEEDLE.size();
+    size_t e = text.find('"', s);
+    if (e == string_view::npos || e == s) return string_view::npos;
+    size_t t = text.find('>', e + 1);
+    if (t == string_view::npos) return string_view::npos;
+    link.slug = text.substr(s, e - s);
+    if (mode != ClubAnchor) return t + 1;
+    size_t u = text.find('<', t + 1);
+    if (u == string_view::npos || text.compare(u, 4, "</a>") != 0) return string_view::npos;
+    link.title = text.substr(t + 1, u - (t + 1));
+    return u + 4;
+}
+
+static void scan_tags(string_view text, ClubScanMode mode, vector<ClubLink>& out) {
+    vector<size_t> hrefs;
+    size_t pos = 0;
+    while (true) {
+        size_t p = text.find("<a", pos);
+        if (p == string_view::npos) return;
+        // [^>]* before the href cannot cross the first '>' of the tag
+        size_t tag_end = text.find('>', p + 2);
+        if (tag_end == string_view::npos) return;
+        hrefs.clear();
+        for (size_t q = text.find(HREF_NEEDLE, p + 2);
+             q != string_view::npos && q + HREF_NEEDLE.size() <= tag_end;
+             q = text.find(HREF_NEEDLE, q + 1)) {
+            hrefs.push_back(q);
+        }
+        // the leading [^>]* is greedy, so the last href in the tag is tried first
+        size_t end = string_view::npos;
+        ClubLink link;
+        for (size_t i = hrefs.size(); i-- > 0; ) {
+            end = match_tag_at(text, hrefs[i], mode, link);
+            if (end != string_view::npos) break;
+        }
+        if (end == string_view::npos) { pos = p + 1; continue; }
+        out.push_back(link);
+        pos = end;
+    }
+}
+
+void scan_club_links(string_view text, ClubScanMode mode, vector<ClubLink>& out) {
+    if (mode == ClubHref) scan_hrefs(text, out);
+    else scan_tags(text, mode, out);
+}
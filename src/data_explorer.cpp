@@ -1,11 +1,11 @@
 #include "data_explorer.h"
 #include <fstream>
-#include <sstream>
 #include <algorithm>
 #include <cmath>
 #include <map>
 #include <filesystem>
 #include <iomanip>
+#include "tsv_reader.h"
 
 #ifdef USE_MATPLOT
 #include <matplot/matplot.h>
@@ -13,7 +13,7 @@
 
 using namespace std;
 
-static vector<string> split_csv_line(const string& line)
+static vector<string> split_csv_line(string_view line)
 {
     vector<string> out;
     string cur;
@@ -88,22 +88,20 @@ static void read_adjacency_degrees(const string& adjacency_csv, vector<int>& deg
 {
     degs.clear();
     total_edges = 0;
-    ifstream adjin(adjacency_csv);
-    if (!adjin.is_open()) return;
-    string aline;
-    while (getline(adjin, aline)) {
+    MappedFile adjfile;
+    if (!adjfile.open(adjacency_csv)) return;
+    TsvReader adjin(adjfile.view());
+    string_view aline;
+    vector<string_view> toks;
+    while (adjin.next_row(aline)) {
         if (aline.empty()) continue;
-        stringstream ss(aline);
-        string token;
-        vector<string> toks;
-        while (getline(ss, token, ',')) toks.push_back(token);
+        TsvReader::split_cells(aline, toks, ',');
         if (toks.size() == 0) continue;
         int deg = 0;
         for (size_t i = 1; i < toks.size(); ++i) if (!toks[i].empty()) ++deg;
         degs.push_back(deg);
         total_edges += deg;
     }
-    adjin.close();
 }
 
 static void write_stats_file(const string& path,
@@ -159,15 +157,16 @@ void DataExplorer::analyze_users_encoded(const string& users_encoded_csv,
 {
     filesystem::create_directories(out_prefix);
 
-    ifstream in(users_encoded_csv);
-    if (! in.is_open()) return;
+    MappedFile file;
+    if (! file.open(users_encoded_csv)) return;
+    TsvReader in(file.view());
 
-    string header;
-    if (!getline(in, header)) return;
+    string_view header;
+    if (!in.next_row(header)) return;
     vector<string> header_cols = split_csv_line(header);
     HeaderIdx hi = parse_header(header_cols, text_columns);
 
-    string line;
+    string_view line;
 
     vector<int> ages_nonzero;
     unordered_map<int,int> addr_count;
@@ -176,7 +175,7 @@ void DataExplorer::analyze_users_encoded(const string& users_encoded_csv,
     vector<int> null_counts(text_columns.size(), 0);
     size_t users_count = 0;
 
-    while (getline(in, line)) {
+    while (in.next_row(line)) {
         if (line.empty()) continue;
         vector<string> parts = split_csv_line(line);
         if (parts.size() == 0) continue;
@@ -207,7 +206,7 @@ void DataExplorer::analyze_users_encoded(const string& users_encoded_csv,
             if (cell.empty()) ++null_counts[t];
         }
     }
-    in.close();
+    file.close();
 
     vector<int> degs;
     int total_edges = 0;
@@ -0,0 +1,271 @@
+#include "delta_ingest.h"
+#include "vocab_builder.h"
+#include "encoder.h"
+#include "graph_builder.h"
+#include "tsv_reader.h"
+#include "utils.h"
+#include "stage_dag.h"
+#include "bin_reader.h"
+#include "serializer.h"
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Field idx of a users_encoded.csv row. The encoder never quotes (lists use
+// ';'), so fields are plain comma separated.
+static bool field_range(string_view row, size_t idx, size_t& b, size_t& e) {
+    b = 0;
+    for (size_t i = 0; i < idx; ++i) {
+        size_t c = row.find(',', b);
+        if (c == string_view::npos) return false;
+        b = c + 1;
+    }
+    e = row.find(',', b);
+    if (e == string_view::npos) e = row.size();
+    return true;
+}
+
+// users.idx entries in file order.
+static bool read_index(const string& path, vector<UsersIndexEntry>& entries) {
+    UsersIndex index;
+    if (!index.open(path)) return false;
+    entries.reserve(index.size());
+    for (size_t i = 0; i < index.size(); ++i) entries.push_back(index[i]);
+    return true;
+}
+
+static string join_friends(const CsrGraph& graph, int uid) {
+    string friends;
+    for (const int* p = graph.begin(uid); p != graph.end(uid); ++p) {
+        if (p != graph.begin(uid)) friends.push_back(';');
+        friends += to_string(*p);
+    }
+    return friends;
+}
+
+bool ingest_delta(const string& data_dir,
+                  const vector<string>& text_columns,
+                  const string& profiles_delta,
+                  const string& edges_delta,
+                  Tokenizer& tok,
+                  Lemmatiser& lem,
+                  const VocabOptions& opts)
+{
+    const string users_bin = (fs::path(data_dir) / "users.bin").string();
+    const string users_idx = (fs::path(data_dir) / "users.idx").string();
+    const string users_csv = (fs::path(data_dir) / "users_encoded.csv").string();
+    const string adjacency_bin = (fs::path(data_dir) / "adjacency.bin").string();
+    const size_t friends_field = 7;
+    if (!vocab_options_ok(opts)) {
+        cout << "[ingest] invalid vocab options\n";
+        return false;
+    }
+
+    VocabBuilder vb(text_columns);
+    vb.options = opts;
+    if (!vb.load_vocab(data_dir)) {
+        cout << "[ingest] no vocab in " << data_dir << ", run the full pipeline first\n";
+        return false;
+    }
+    GraphBuilder gb;
+    if (!gb.load_binary(adjacency_bin)) {
+        cout << "[ingest] cannot load " << adjacency_bin << "\n";
+        return false;
+    }
+    vector<UsersIndexEntry> index;
+    if (!read_index(users_idx, index)) {
+        cout << "[ingest] cannot open " << users_idx << "\n";
+        return false;
+    }
+
+    unordered_set<int> delta_users;
+    if (!profiles_delta.empty()) {
+        MappedFile f;
+        if (!f.open(profiles_delta)) {
+            cout << "[ingest] cannot open " << profiles_delta << "\n";
+            return false;
+        }
+        TsvReader reader(f.view());
+        string_view row;
+        while (reader.next_row(row)) if (!row.empty()) delta_users.insert(parse_int(row));
+    }
+
+    // Replaced records leave the document counts before their new version is added.
+    if (!delta_users.empty()) {
+        UserRecordReader users;
+        if (!users.open(users_bin, users_idx)) {
+            cout << "[ingest] cannot open " << users_bin << "\n";
+            return false;
+        }
+        vector<int> ids;
+        for (const UsersIndexEntry &e : index) if (delta_users.count(e.user_id)) ids.push_back(e.user_id);
+        RecordMask mask = RecordMask::fixed_only();
+        for (size_t t = 0; t < text_columns.size(); ++t) mask.add_tokens(t);
+        vector<UserRecordView> records;
+        users.read_many(ids, records, mask);
+        for (size_t k = 0; k < ids.size(); ++k) {
+            const UserRecordView &rec = records[k];
+            if (rec.user_id == 0) {
+                cout << "[ingest] corrupt record for user " << ids[k] << " in " << users_bin << "\n";
+                return false;
+            }
+            for (size_t t = 0; t < text_columns.size() && t < rec.token_cols.size(); ++t) {
+                unordered_map<int,int> &docfreq = vb.docfreq_per_col[text_columns[t]];
+                const TokenPairSpan &col = rec.token_cols[t];
+                for (size_t i = 0; i < col.size; ++i) {
+                    auto it = docfreq.find((int)col.token(i));
+                    if (it != docfreq.end() && it->second > 0) --it->second;
+                }
+            }
+        }
+    }
+
+    if (!profiles_delta.empty()) vb.pass1(profiles_delta, tok, lem);
+    vb.save_vocab(data_dir);
+
+    unordered_set<int> edge_users;
+    if (!edges_delta.empty()) {
+        GraphBuilder delta;
+        delta.load_edges(edges_delta);
+        for (int u : gb.add_edges(delta.graph)) edge_users.insert(u);
+        if (!gb.save_binary(adjacency_bin)) {
+            cout << "[ingest] cannot write " << adjacency_bin << "\n";
+            return false;
+        }
+    }
+
+    // The delta's records go to the end of users.bin and users.idx is
+    // rewritten to point at them; the replaced records stay behind unused.
+    // Friends are not stored in the records, so new edges need no rewrite.
+    const bool has_csv = fs::exists(users_csv);
+    unordered_map<int, UsersIndexEntry> fresh;
+    vector<int> fresh_order;
+    unordered_map<int, string> encoded_csv;
+    if (!profiles_delta.empty()) {
+        Encoder enc(text_columns, vb.token2id_per_col, vb.club_to_id,
+                    vb.address_part1_to_id, vb.address_part2_to_id, vb.address_part3_to_id, AdjacencyView(gb.graph));
+        const string delta_bin = users_bin + ".delta";
+        const string delta_idx = users_idx + ".delta";
+        const string delta_csv = users_csv + ".delta";
+        if (has_csv) enc.csv_export_path = delta_csv;
+        enc.hash_bits = opts.hash_bits;
+        if (opts.hash_bits > 0 && !opts.stopwords_path.empty()) load_stopwords(opts.stopwords_path, enc.stopwords);
+        if (!enc.pass2(profiles_delta, delta_bin, delta_idx)) return false;
+
+        error_code ec;
+        uint64_t base = (uint64_t)fs::file_size(users_bin, ec);
+        if (ec) return false;
+        vector<UsersIndexEntry> delta_index;
+        MappedFile records;
+        if (!read_index(delta_idx, delta_index) || !records.open(delta_bin) || !users_bin_header_ok(records.view())) return false;
+        {
+            // the delta's records without its header
+            ofstream out(users_bin, ios::binary | ios::app);
+            out.write(records.view().data() + USERS_BIN_HEADER_SIZE, (streamsize)(records.size() - USERS_BIN_HEADER_SIZE));
+            if (!out) return false;
+        }
+        for (UsersIndexEntry e : delta_index) {
+            e.offset = e.offset - USERS_BIN_HEADER_SIZE + base;
+            if (fresh.find(e.user_id) == fresh.end()) fresh_order.push_back(e.user_id);
+            fresh[e.user_id] = e;
+        }
+        records.close();
+
+        if (has_csv) {
+            MappedFile f;
+            if (!f.open(delta_csv)) return false;
+            TsvReader reader(f.view());
+            string_view row;
+            reader.next_row(row);
+            while (reader.next_row(row)) {
+                if (!row.empty()) encoded_csv[parse_int(row)] = string(row);
+            }
+        }
+        fs::remove(delta_bin, ec);
+        fs::remove(delta_idx, ec);
+        fs::remove(delta_csv, ec);
+    }
+
+    size_t replaced = 0, patched = 0, added = 0;
+    {
+        const string tmp_idx = users_idx + ".tmp";
+        vector<UsersIndexEntry> entries;
+        entries.reserve(index.size() + fresh_order.size());
+        unordered_set<int> written;
+        for (const UsersIndexEntry &e : index) {
+            auto it = fresh.find(e.user_id);
+            if (it != fresh.end()) {
+                written.insert(e.user_id);
+                ++replaced;
+            }
+            entries.push_back(it != fresh.end() ? it->second : e);
+        }
+        for (int uid : fresh_order) {
+            if (written.count(uid)) continue;
+            entries.push_back(fresh[uid]);
+            ++added;
+        }
+        if (!write_users_idx(tmp_idx, entries)) return false;
+        error_code ec;
+        fs::rename(tmp_idx, users_idx, ec);
+        if (ec) {
+            cout << "[ingest] cannot replace " << users_idx << ": " << ec.message() << "\n";
+            return false;
+        }
+    }
+
+    // The optional CSV export gets the same rows and friend lists.
+    if (has_csv) {
+        const string tmp_csv = users_csv + ".tmp";
+        {
+            MappedFile users;
+            if (!users.open(users_csv)) return false;
+            ofstream out(tmp_csv, ios::binary);
+            if (!out.is_open()) return false;
+            TsvReader reader(users.view());
+            string_view row;
+            if (reader.next_row(row)) out << row << "\n";
+            unordered_set<int> written;
+            while (reader.next_row(row)) {
+                if (row.empty()) continue;
+                int uid = parse_int(row);
+                auto it = encoded_csv.find(uid);
+                size_t b = 0, e = 0;
+                if (it != encoded_csv.end()) {
+                    out << it->second << "\n";
+                    written.insert(uid);
+                } else if (edge_users.count(uid) && field_range(row, friends_field, b, e)) {
+                    out << row.substr(0, b) << join_friends(gb.graph, uid) << row.substr(e) << "\n";
+                    ++patched;
+                } else {
+                    out << row << "\n";
+                }
+            }
+            for (int uid : fresh_order) {
+                if (written.count(uid) == 0 && encoded_csv.count(uid)) out << encoded_csv[uid] << "\n";
+            }
+            if (!out) return false;
+        }
+        error_code ec;
+        fs::rename(tmp_csv, users_csv, ec);
+        if (ec) {
+            cout << "[ingest] cannot replace " << users_csv << ": " << ec.message() << "\n";
+            return false;
+        }
+    }
+    remove_stamp((fs::path(data_dir) / "median_age.txt").string());
+    remove_stamp((fs::path(data_dir) / "column_normalizers.csv").string());
+    // taken from the stores before the delta
+    error_code snap_ec;
+    fs::remove(fs::path(data_dir) / "serving.snap", snap_ec);
+    cout << "[ingest] " << added << " users added, " << replaced << " re-encoded, "
+         << edge_users.size() << " users with new edges";
+    if (has_csv) cout << ", " << patched << " friend lists patched in " << users_csv;
+    cout << "\n";
+    return true;
+}
@@ -2,9 +2,21 @@
 #include "tokenizer.h"
 #include "lemmatizer_wrapper.h"
 #include <fstream>
-#include <sstream>
-#include <regex>
 #include <algorithm>
+#include <functional>
+#include <thread>
+#include "ordered_pipeline.h"
+#include "club_links.h"
+#include "token_cache.h"
+#include "tsv_reader.h"
+#include "bin_reader.h"
+#include "serializer.h"
+#include "vocab_builder.h"
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 
 using namespace std;
 
@@ -15,7 +27,7 @@ Encoder::Encoder(
     const unordered_map<string,int>& address_part1_to_id_in,
     const unordered_map<string,int>& address_part2_to_id_in,
     const unordered_map<string,int>& address_part3_to_id_in,
-    const unordered_map<int, vector<int>>& adjacency_in)
+    const AdjacencyView& adjacency_in)
     : colKeys(colKeys_in),
       token2id_per_col(token2id_per_col_in),
       club_to_id(club_to_id_in),
@@ -25,15 +37,7 @@ Encoder::Encoder(
       adjacency(adjacency_in)
 {}
 
-vector<string> Encoder::split_line_to_cols(const string& line) const {
-    vector<string> cols;
-    string cell;
-    stringstream ss(line);
-    while (getline(ss, cell, '\t')) cols.push_back(cell);
-    return cols;
-}
-
-string Encoder::build_region_parts_csv(const string& raw_region) const {
+void Encoder::build_region_parts(const string& raw_region, vector<uint32_t>& parts) const {
     string nr = raw_region;
     for (size_t i = 0; i < nr.size(); ++i) {
         unsigned char c = (unsigned char)nr[i];
@@ -50,133 +54,356 @@ string Encoder::build_region_parts_csv(const string& raw_region) const {
         if (dash == string::npos) { part2 = rest; part3.clear(); } else { part2 = rest.substr(0,dash); part3 = rest.substr(dash+1); }
     }
     trim(part2); trim(part3);
-    int p1v = -1, p2v = -1, p3v = -1;
-    auto it1 = address_part1_to_id.find(part1); if (it1 != address_part1_to_id.end()) p1v = it1->second;
-    auto it2 = address_part2_to_id.find(part2); if (it2 != address_part2_to_id.end()) p2v = it2->second;
-    auto it3 = address_part3_to_id.find(part3); if (it3 != address_part3_to_id.end()) p3v = it3->second;
-    string out;
-    if (p1v >= 0) out += to_string(p1v);
-    out += ";";
-    if (p2v >= 0) out += to_string(p2v);
-    out += ";";
-    if (p3v >= 0) out += to_string(p3v);
-    return out;
+    parts.assign(3, USER_FIELD_NONE);
+    auto it1 = address_part1_to_id.find(part1); if (it1 != address_part1_to_id.end()) parts[0] = (uint32_t)it1->second;
+    auto it2 = address_part2_to_id.find(part2); if (it2 != address_part2_to_id.end()) parts[1] = (uint32_t)it2->second;
+    auto it3 = address_part3_to_id.find(part3); if (it3 != address_part3_to_id.end()) parts[2] = (uint32_t)it3->second;
 }
 
-unordered_map<int,int> Encoder::extract_club_counts_from_line(const string& line) const {
+unordered_map<int,int> Encoder::extract_club_counts_from_line(string_view line) const {
     unordered_map<int,int> club_counts;
-    regex href_re("<a[^>]*href=\"/klub/([^\"]+)\"[^>]*>");
-    string::const_iterator start = line.cbegin();
-    smatch m;
-    while (regex_search(start, line.cend(), m, href_re)) {
-        string raw = m[1].str();
-        string slug; slug.reserve(raw.size());
-        for (char ch : raw) {
+    vector<ClubLink> links;
+    scan_club_links(line, ClubTag, links);
+    string slug;
+    for (const ClubLink &link : links) {
+        slug.assign(link.slug.data(), link.slug.size());
+        for (char &ch : slug) {
             unsigned char c = (unsigned char)ch;
-            if (c >= 'A' && c <= 'Z') slug.push_back((char)(c + ('a' - 'A')));
-            else slug.push_back(ch);
+            if (c >= 'A' && c <= 'Z') ch = (char)(c + ('a' - 'A'));
         }
         auto it = club_to_id.find(slug);
         if (it != club_to_id.end()) club_counts[it->second] += 1;
-        start = m.suffix().first;
     }
     return club_counts;
 }
 
-string Encoder::format_counts_to_csv(const unordered_map<int,int>& counts) const {
-    string out; bool first = true;
-    for (auto &p : counts) {
-        if (!first) out.push_back(';'); first = false;
-        out += to_string(p.first);
-    }
-    return out;
+// Numeric profile fields: empty stays unknown, anything else is atoi'd.
+static uint32_t field_value(string_view raw, uint32_t missing) {
+    return raw.empty() ? missing : (uint32_t)parse_int(raw);
 }
 
-string Encoder::format_token_counts_to_csv(const unordered_map<int,int>& counts) const {
-    if (counts.empty()) return string();
-    string out; bool first = true;
-    for (auto &p : counts) {
-        if (!first) out.push_back(';'); first = false;
-        out += to_string(p.first); out.push_back(':'); out += to_string(p.second);
+bool Encoder::encode_fixed_fields(const vector<string_view>& cols, UserRecord& rec, string* csv) const {
+    if (cols.empty()) return false;
+    int uid = parse_int(cols[0]);
+    string_view pub = cols.size()>1 ? cols[1] : string_view();
+    string_view comp = cols.size()>2 ? cols[2] : string_view();
+    string_view gender = cols.size()>3 ? cols[3] : string_view();
+    string_view age = cols.size()>7 ? cols[7] : string_view("0");
+    rec.user_id = (uint32_t)uid;
+    rec.ispublic = field_value(pub, USER_FIELD_NONE);
+    rec.completion_percentage = field_value(comp, USER_FIELD_NONE);
+    rec.gender = field_value(gender, USER_FIELD_NONE);
+    if (cols.size()>4) build_region_parts(string(cols[4]), rec.region);
+    else rec.region.assign(3, USER_FIELD_NONE);
+    rec.age = field_value(age, 0);
+    rec.clubs.clear();
+    for (auto &p : extract_club_counts_from_line(cols.back())) rec.clubs.push_back((uint32_t)p.first);
+    sort(rec.clubs.begin(), rec.clubs.end());  // users.bin delta-codes them
+    rec.token_cols.clear();
+    if (!csv) return true;
+
+    string& out = *csv;
+    out += to_string(uid);
+    out.push_back(','); out.append(pub.data(), pub.size());
+    out.push_back(','); out.append(comp.data(), comp.size());
+    out.push_back(','); out.append(gender.data(), gender.size());
+    out.push_back(',');
+    for (size_t i = 0; i < rec.region.size(); ++i) {
+        if (i) out.push_back(';');
+        if (rec.region[i] != USER_FIELD_NONE) out += to_string(rec.region[i]);
+    }
+    out.push_back(','); out.append(age.data(), age.size());
+    out.push_back(',');
+    for (size_t i = 0; i < rec.clubs.size(); ++i) {
+        if (i) out.push_back(';');
+        out += to_string(rec.clubs[i]);
+    }
+    out.push_back(',');
+    NeighborRange friends = adjacency.neighbors(uid);
+    for (size_t i = 0; i < friends.size(); ++i) {
+        if (i) out.push_back(';');
+        out += to_string(friends[i]);
     }
-    return out;
+    return true;
 }
 
-vector<string> Encoder::process_profile_line(const vector<string>& cols, Tokenizer& tok, Lemmatiser& lem) const {
-    vector<string> outrow;
-    if (cols.empty()) return outrow;
-    int uid = atoi(cols[0].c_str());
-    string pub = cols.size()>1 ? cols[1] : "";
-    string comp = cols.size()>2 ? cols[2] : "";
-    string gender = cols.size()>3 ? cols[3] : "";
-    string region_csv = cols.size()>4 ? build_region_parts_csv(cols[4]) : string(";;");
-    string age = cols.size()>7 ? cols[7] : "0";
-    string clubs = format_counts_to_csv(extract_club_counts_from_line(cols.empty() ? string() : cols[0] + "\t" + (cols.size()>1?cols[1]:"")));
-    if (cols.size() > 0) clubs = format_counts_to_csv(extract_club_counts_from_line(cols.back()));
-    string clubs2 = format_counts_to_csv(extract_club_counts_from_line(cols.empty() ? string() : cols.back()));
-    string friends;
-    auto it = adjacency.find(uid);
-    if (it != adjacency.end()) {
-        for (size_t i = 0; i < it->second.size(); ++i) {
-            if (i) friends.push_back(';');
-            friends += to_string(it->second[i]);
-        }
+void Encoder::add_token_column(const unordered_map<int,int>& counts, UserRecord& rec, string* csv) const {
+    rec.token_cols.emplace_back();
+    auto &col = rec.token_cols.back();
+    col.reserve(counts.size());
+    for (auto &p : counts) col.push_back(make_pair((uint32_t)p.first, (uint32_t)p.second));
+    sort(col.begin(), col.end());
+    if (!csv) return;
+    csv->push_back(',');
+    for (size_t i = 0; i < col.size(); ++i) {
+        if (i) csv->push_back(';');
+        *csv += to_string(col[i].first); csv->push_back(':'); *csv += to_string(col[i].second);
     }
-    vector<string> token_cols;
-    token_cols.resize(colKeys.size());
+}
+
+// Per-worker state reused across rows.
+struct Encoder::EncodeScratch {
+    LemmaCache lemmas;
+    TokenBuffer words;
+};
+
+bool Encoder::process_profile_line(const vector<string_view>& cols, const Tokenizer& tok, const Lemmatiser& lem, EncodeScratch& scratch,
+                                   UserRecord& rec, string* csv) const {
+    if (!encode_fixed_fields(cols, rec, csv)) return false;
     for (size_t i = 0; i < colKeys.size(); ++i) {
         size_t idx = 9 + i;
-        string text = idx < cols.size() ? cols[idx] : "";
-        if (text.empty() || text == "null") { token_cols[i] = string(); continue; }
-        vector<string> toks = tok.tokenize(text);
-        vector<string> lems = lem.lemmatize_tokens(toks);
+        string_view text = idx < cols.size() ? cols[idx] : string_view();
         unordered_map<int,int> counts;
-        auto itmap = token2id_per_col.find(colKeys[i]);
-        if (itmap != token2id_per_col.end()) {
-            for (auto &w : lems) {
-                auto jt = itmap->second.find(w);
-                if (jt != itmap->second.end()) counts[jt->second] += 1;
+        if (!text.empty() && text != "null") {
+            tok.tokenize(text, scratch.words);
+            vector<string> lems = lem.lemmatize_tokens(scratch.words.tokens, scratch.lemmas);
+            auto itmap = token2id_per_col.find(colKeys[i]);
+            if (hash_bits > 0) {
+                for (auto &w : lems) {
+                    if (!w.empty() && !stopwords.count(w)) counts[hashed_token_id(w, hash_bits)] += 1;
+                }
+            } else if (itmap != token2id_per_col.end()) {
+                for (auto &w : lems) {
+                    auto jt = itmap->second.find(w);
+                    if (jt != itmap->second.end()) counts[jt->second] += 1;
+                }
             }
         }
-        token_cols[i] = format_token_counts_to_csv(counts);
-    }
-    outrow.push_back(to_string(uid));
-    outrow.push_back(pub);
-    outrow.push_back(comp);
-    outrow.push_back(gender);
-    outrow.push_back(region_csv);
-    outrow.push_back(age);
-    outrow.push_back(clubs2);
-    outrow.push_back(friends);
-    for (auto &tc : token_cols) outrow.push_back(tc);
-    return outrow;
+        add_token_column(counts, rec, csv);
+    }
+    if (csv) csv->push_back('\n');
+    return true;
+}
+
+bool Encoder::process_profile_line(const vector<string_view>& cols, const vector<vector<int>>& cached_ids,
+                                   UserRecord& rec, string* csv) const {
+    if (!encode_fixed_fields(cols, rec, csv)) return false;
+    for (size_t i = 0; i < colKeys.size(); ++i) {
+        unordered_map<int,int> counts;
+        if (i < cached_ids.size()) for (int id : cached_ids[i]) counts[id] += 1;
+        add_token_column(counts, rec, csv);
+    }
+    if (csv) csv->push_back('\n');
+    return true;
+}
+
+struct EncodeBatch {
+    vector<string_view> lines;  // rows of the mapped profiles file
+    vector<TokenCacheRecord> cached;  // one per line, or empty when the cache is not used
+    uint64_t input_end = 0;  // profiles offset just past the batch
+    uint64_t cache_pos = 0;  // token cache position after the batch, 0 without the cache
+};
+
+struct EncodedBatch {
+    string bin;  // users.bin records
+    vector<pair<uint32_t,uint32_t>> records;  // user_id, record length, in bin order
+    string csv;  // export rows, empty without csv_export_path
+    uint64_t input_end = 0;
+    uint64_t cache_pos = 0;
+};
+
+// Progress of an interrupted pass2: rows from input_offset on still have to
+// be encoded, the first *_size bytes of each output are complete.
+struct Pass2Checkpoint {
+    string key;
+    uint64_t input_offset = 0;
+    uint64_t bin_size = 0;
+    uint64_t idx_size = 0;
+    uint64_t csv_size = 0;
+    uint64_t cache_pos = 0;
+};
+
+static bool read_checkpoint(const string& path, Pass2Checkpoint& ck) {
+    ifstream in(path);
+    if (!in.is_open()) return false;
+    return (bool)(in >> ck.key >> ck.input_offset >> ck.bin_size >> ck.idx_size >> ck.csv_size >> ck.cache_pos);
+}
+
+static bool write_checkpoint(const string& path, const Pass2Checkpoint& ck) {
+    const string tmp = path + ".tmp";
+    {
+        ofstream out(tmp);
+        if (!out.is_open()) return false;
+        out << ck.key << " " << ck.input_offset << " " << ck.bin_size << " " << ck.idx_size << " "
+            << ck.csv_size << " " << ck.cache_pos << "\n";
+        if (!out) return false;
+    }
+    error_code ec;
+    filesystem::rename(tmp, path, ec);
+    return !ec;
+}
+
+// Cuts path back to the size a checkpoint recorded.
+static bool truncate_to(const string& path, uint64_t size) {
+    error_code ec;
+    uint64_t have = (uint64_t)filesystem::file_size(path, ec);
+    if (ec || have < size) return false;
+    filesystem::resize_file(path, size, ec);
+    return !ec;
 }
 
-void Encoder::pass2(const string& profiles_tsv, const string& out_users_csv) {
-    ifstream in(profiles_tsv);
-    if (!in.is_open()) return;
+bool Encoder::pass2(const string& profiles_tsv, const string& out_users_bin, const string& out_users_idx, int num_threads) {
+    MappedFile profiles;
+    if (!profiles.open(profiles_tsv)) return false;
+    const bool export_csv = !csv_export_path.empty();
+
+    Pass2Checkpoint resume;
+    bool resuming = false;
+    if (!checkpoint_path.empty() && read_checkpoint(checkpoint_path, resume) && resume.key == checkpoint_key
+        && resume.input_offset <= profiles.size()) {
+        resuming = truncate_to(out_users_bin, resume.bin_size) && truncate_to(out_users_idx, resume.idx_size)
+                   && (!export_csv || truncate_to(csv_export_path, resume.csv_size));
+    }
+    if (!resuming) resume = Pass2Checkpoint();
+
+    TsvReader reader(profiles.view().substr((size_t)resume.input_offset));
+    rows_encoded = 0;
+    bytes_encoded = profiles.size() - resume.input_offset;
+    const ios::openmode mode = resuming ? ios::out | ios::app : ios::out | ios::trunc;
+    ofstream bin(out_users_bin, mode | ios::binary);
+    ofstream idx(out_users_idx, mode | ios::binary);
+    ofstream csv;
+    if (export_csv) csv.open(csv_export_path, mode);
+    if (!bin.is_open() || !idx.is_open() || (export_csv && !csv.is_open())) return false;
+    uint64_t bin_offset = resume.bin_size;
+    if (!resuming) {
+        string header;
+        append_users_bin_header(header);
+        bin.write(header.data(), (streamsize)header.size());
+        bin_offset = header.size();
+        header.clear();
+        append_users_idx_header(header);
+        idx.write(header.data(), (streamsize)header.size());
+    }
+    if (resuming) {
+        cout << "[encoder] resuming " << out_users_bin << " at input byte " << resume.input_offset << " of " << profiles.size() << "\n";
+    } else if (export_csv) {
+        csv << "user_id,public,completion_percentage,gender,region,age,clubs,friends";
+        for (auto &k : colKeys) csv << "," << k << "_tokens";
+        csv << "\n";
+    }
+
+    if (num_threads <= 0) num_threads = (int)max(1u, thread::hardware_concurrency());
+    const size_t batch_lines = 512;
+
+    TokenCacheReader cache;
+    bool use_cache = false;
+    if (!token_cache_path.empty()) {
+        vector<uint32_t> vocab_sizes;
+        for (const auto &key : colKeys) {
+            auto it = token2id_per_col.find(key);
+            vocab_sizes.push_back(it == token2id_per_col.end() ? 0u : (uint32_t)it->second.size());
+        }
+        use_cache = cache.open(token_cache_path, (uint64_t)profiles.size(), vocab_sizes);
+        // an interrupted run continues in the cache where it stopped, or without it
+        if (use_cache && resuming) use_cache = resume.cache_pos != 0 && cache.seek(resume.cache_pos);
+        cout << "[encoder] token cache " << token_cache_path << (use_cache ? " in use" : " missing or stale, tokenizing") << "\n";
+    }
+
+    // Shared by the workers as in pass1; only created once a row has to be tokenized.
     Tokenizer tok;
-    Lemmatiser lem("data/lem-me-sk.bin");
-    vector<vector<string>> rows;
-    string line;
-    while (getline(in, line)) {
-        if (line.empty()) continue;
-        auto cols = split_line_to_cols(line);
-        if (cols.empty()) continue;
-        auto row = process_profile_line(cols, tok, lem);
-        if (!row.empty()) rows.push_back(row);
-    }
-    in.close();
-    ofstream out(out_users_csv);
-    out << "user_id,public,completion_percentage,gender,region,age,clubs,friends";
-    for (auto &k : colKeys) out << "," << k << "_tokens";
-    out << "\n";
-    for (auto &r : rows) {
-        for (size_t i = 0; i < r.size(); ++i) {
-            out << r[i];
-            if (i+1 < r.size()) out << ",";
+    unique_ptr<Lemmatiser> lem;
+    once_flag lem_once;
+    // Lemma cache and token buffer per worker thread.
+    mutex scratch_m;
+    map<thread::id, unique_ptr<EncodeScratch>> scratch;
+
+    function<bool(EncodeBatch&)> read_batch = [&](EncodeBatch& batch) {
+        batch.lines.reserve(batch_lines);
+        string_view line;
+        while (batch.lines.size() < batch_lines && reader.next_row(line)) {
+            if (line.empty()) continue;
+            if (use_cache) {
+                TokenCacheRecord rec;
+                if (cache.next(rec) && rec.user_id == (uint32_t)parse_int(line)) {
+                    batch.cached.push_back(std::move(rec));
+                } else {
+                    cout << "[encoder] token cache out of sync at user " << parse_int(line) << ", tokenizing the rest\n";
+                    use_cache = false;
+                    batch.cached.clear();
+                }
+            }
+            batch.lines.push_back(line);
         }
-        out << "\n";
+        batch.input_end = resume.input_offset + reader.offset();
+        batch.cache_pos = use_cache ? cache.tell() : 0;
+        return !batch.lines.empty();
+    };
+    function<void(EncodeBatch&, EncodedBatch&)> encode_batch = [&](EncodeBatch& batch, EncodedBatch& encoded) {
+        encoded.input_end = batch.input_end;
+        encoded.cache_pos = batch.cache_pos;
+        bool from_cache = batch.cached.size() == batch.lines.size();
+        vector<vector<int>> ids;
+        vector<string_view> cols;
+        EncodeScratch* sc = nullptr;
+        UserRecord rec;
+        for (size_t li = 0; li < batch.lines.size(); ++li) {
+            TsvReader::split_cells(batch.lines[li], cols);
+            if (cols.empty()) continue;
+            string* row_csv = export_csv ? &encoded.csv : nullptr;
+            bool ok;
+            if (from_cache && cache.decode(batch.cached[li], ids)) {
+                ok = process_profile_line(cols, ids, rec, row_csv);
+            } else {
+                call_once(lem_once, [&]{ lem.reset(new Lemmatiser("data/lem-me-sk.bin")); });
+                if (!sc) {
+                    lock_guard<mutex> lk(scratch_m);
+                    auto &slot = scratch[this_thread::get_id()];
+                    if (!slot) slot.reset(new EncodeScratch());
+                    sc = slot.get();
+                }
+                ok = process_profile_line(cols, tok, *lem, *sc, rec, row_csv);
+            }
+            if (!ok) continue;
+            size_t before = encoded.bin.size();
+            append_user_record(encoded.bin, rec);
+            encoded.records.push_back(make_pair(rec.user_id, (uint32_t)(encoded.bin.size() - before)));
+        }
+    };
+    // Every checkpoint_interval input bytes the output is flushed and the
+    // position recorded, so a crash loses at most that much work.
+    uint64_t last_checkpoint = resume.input_offset;
+    string entries;
+    function<void(EncodedBatch&)> write_batch = [&](EncodedBatch& encoded) {
+        bin.write(encoded.bin.data(), (streamsize)encoded.bin.size());
+        rows_encoded += encoded.records.size();
+        entries.clear();
+        for (auto &r : encoded.records) {
+            append_users_idx_entry(entries, r.first, bin_offset, r.second);
+            bin_offset += r.second;
+        }
+        idx.write(entries.data(), (streamsize)entries.size());
+        if (export_csv) csv.write(encoded.csv.data(), (streamsize)encoded.csv.size());
+        if (checkpoint_path.empty() || encoded.input_end - last_checkpoint < checkpoint_interval) return;
+        bin.flush();
+        idx.flush();
+        if (export_csv) csv.flush();
+        if (!bin || !idx || (export_csv && !csv)) return;
+        Pass2Checkpoint ck;
+        ck.key = checkpoint_key;
+        ck.input_offset = encoded.input_end;
+        ck.bin_size = bin_offset;
+        ck.idx_size = (uint64_t)idx.tellp();
+        ck.csv_size = export_csv ? (uint64_t)csv.tellp() : 0;
+        ck.cache_pos = encoded.cache_pos;
+        if (write_checkpoint(checkpoint_path, ck)) last_checkpoint = encoded.input_end;
+    };
+    run_ordered_pipeline(read_batch, encode_batch, write_batch, num_threads, (size_t)num_threads * 4);
+
+    uint64_t lemma_hits = 0, lemma_misses = 0;
+    for (auto &kv : scratch) { lemma_hits += kv.second->lemmas.hits; lemma_misses += kv.second->lemmas.misses; }
+    if (lemma_hits + lemma_misses > 0) {
+        cout << "[encoder] lemma cache: " << lemma_hits << " hits, " << lemma_misses << " misses ("
+             << (100.0 * (double)lemma_hits / (double)(lemma_hits + lemma_misses)) << "% hit rate)\n";
+    }
+
+    bin.close();
+    idx.close();
+    if (export_csv) csv.close();
+    if (!bin || !idx || (export_csv && !csv) || !finish_users_idx(out_users_idx)) return false;
+    if (!checkpoint_path.empty()) {
+        error_code ec;
+        filesystem::remove(checkpoint_path, ec);
     }
-    out.close();
+    return true;
 }
@@ -8,8 +8,8 @@
 using namespace std;
 
 EvalResult evaluate_recommender_sample(
-    const unordered_map<int, UserProfile>& profiles,
-    const unordered_map<int, vector<int>>& adj_list,
+    const ProfileStore& profiles,
+    const AdjacencyView& adjacency,
     Recommender &rec,
     const vector<string>& text_columns,
     int sample_size,
@@ -17,9 +17,7 @@ EvalResult evaluate_recommender_sample(
 {
     EvalResult res{0.0,0.0,0.0};
     if (profiles.empty()) return res;
-    vector<int> ids;
-    ids.reserve(profiles.size());
-    for (auto &p : profiles) ids.push_back(p.first);
+    vector<int> ids = profiles.user_ids();
     mt19937 rng(123456);
     shuffle(ids.begin(), ids.end(), rng);
     if ((int)ids.size() > sample_size) ids.resize(sample_size);
@@ -30,11 +28,9 @@ EvalResult evaluate_recommender_sample(
     int examined = 0;
 
     for (int uid : ids) {
-        auto itadj = adj_list.find(uid);
-        if (itadj == adj_list.end()) continue;
-        const vector<int>& friends = itadj->second;
+        NeighborRange friends = adjacency.neighbors(uid);
         if (friends.size() < 4) continue;
-        vector<int> shuffled = friends;
+        vector<int> shuffled(friends.begin(), friends.end());
         shuffle(shuffled.begin(), shuffled.end(), rng);
         size_t keep = max<size_t>(1, (shuffled.size() * 3) / 4);
         set<int> kept(shuffled.begin(), shuffled.begin() + keep);
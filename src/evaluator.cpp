@@ -10,8 +10,8 @@
 
 using namespace std;
 
-EvalMetrics evaluate_recommenders_holdout(const unordered_map<int, UserProfile>& profiles,
-                                         const unordered_map<int, vector<int>>& adj_list,
+EvalMetrics evaluate_recommenders_holdout(const ProfileStore& profiles,
+                                         const AdjacencyView& adjacency,
                                          const vector<string>& text_columns,
                                          int sample_size,
                                          int topk,
@@ -19,16 +19,15 @@ EvalMetrics evaluate_recommenders_holdout(const unordered_map<int, UserProfile>&
 {
     EvalMetrics res;
     if (profiles.empty()) return res;
-    vector<int> all;
-    for (auto &kv : profiles) all.push_back(kv.first);
+    vector<int> all = profiles.user_ids();
     mt19937 rng(123456);
     shuffle(all.begin(), all.end(), rng);
 
     vector<int> test_users;
     for (int uid : all) {
-        auto it = adj_list.find(uid);
-        if (it == adj_list.end()) continue;
-        if ((int)it->second.size() >= 4) test_users.push_back(uid);
+        size_t degree = adjacency.degree(uid);
+        if (degree == 0) continue;
+        if ((int)degree >= 4) test_users.push_back(uid);
         if ((int)test_users.size() >= sample_size) break;
     }
     if (test_users.empty()) return res;
@@ -38,7 +37,7 @@ EvalMetrics evaluate_recommenders_holdout(const unordered_map<int, UserProfile>&
 
     int hits_g = 0, hits_c = 0, hits_i = 0, hits_s = 0, tot = 0;
     for (int uid : test_users) {
-        const auto &friends = adj_list.at(uid);
+        NeighborRange friends = adjacency.neighbors(uid);
         if (friends.size() < 4) continue;
         int hold_k = max(1, (int)friends.size() / 4);
         vector<int> idx(friends.size());
@@ -47,12 +46,12 @@ EvalMetrics evaluate_recommenders_holdout(const unordered_map<int, UserProfile>&
         set<int> held;
         for (int i = 0; i < hold_k; ++i) held.insert(friends[idx[i]]);
 
-        unordered_map<int, vector<int>> adj_mod = adj_list;
-        vector<int> newf;
-        for (int f : adj_list.at(uid)) if (held.find(f) == held.end()) newf.push_back(f);
-        adj_mod[uid] = newf;
+        unordered_map<int, vector<int>> held_out;
+        vector<int> &newf = held_out[uid];
+        for (int f : friends) if (held.find(f) == held.end()) newf.push_back(f);
+        AdjacencyView adj_mod = adjacency.with_overrides(&held_out);
 
-        Recommender rec((unordered_map<int, UserProfile>*)&profiles, &adj_mod);
+        Recommender rec(&profiles, adj_mod);
         rec.set_text_columns(text_columns);
         rec.set_tfidf_index(tfidf.idf_per_col);
 
@@ -75,12 +74,12 @@ EvalMetrics evaluate_recommenders_holdout(const unordered_map<int, UserProfile>&
             unordered_map<int, unordered_map<int,float>> temp_user_tfidf;
             TFIDFIndex tmp_tfidf;
             tmp_tfidf.build(profiles, text_columns);
-            for (auto &kv : profiles) {
+            for (int i = 0; i < (int)profiles.size(); ++i) {
                 unordered_map<int,float> vec;
-                tmp_tfidf.compute_tfidf_vector(kv.second, vec);
-                if (!vec.empty()) temp_user_tfidf[kv.first] = std::move(vec);
+                tmp_tfidf.compute_tfidf_vector(profiles, i, vec);
+                if (!vec.empty()) temp_user_tfidf[profiles.user_id(i)] = std::move(vec);
             }
-            Recommender rec_t(&temp_user_tfidf, &adj_mod);
+            Recommender rec_t(&temp_user_tfidf, adj_mod);
             rec_t.set_text_columns(text_columns);
             rec_t.set_tfidf_index(tmp_tfidf.idf_per_col);
             auto out_s = rec_t.recommend_from_supernodes(uid, *super_feats, topk);
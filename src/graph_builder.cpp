@@ -1,75 +1,226 @@
 #include "graph_builder.h"
+#include "tsv_reader.h"
+#include "adjacency_view.h"
 #include <fstream>
-#include <sstream>
 #include <algorithm>
+#include <thread>
 
 using namespace std;
 
-void GraphBuilder::load_edges(const string& path, size_t max_lines) {
-    ifstream in(path);
-    string line;
-    size_t cnt = 0;
-    while (getline(in, line)) {
-        if (line.empty()) continue;
-        stringstream ss(line);
-        int a = 0, b = 0;
-        ss >> a >> b;
-        adjacency[a].push_back(make_pair(b, 1.0f));
-        ++cnt;
-        if (max_lines && cnt >= max_lines) break;
+// Parses one integer, skipping leading blanks; false if there is none.
+static inline bool scan_int(const char*& p, const char* e, int& v) {
+    while (p < e && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    bool neg = false;
+    if (p < e && *p == '-') { neg = true; ++p; }
+    if (p >= e || *p < '0' || *p > '9') return false;
+    int64_t x = 0;
+    while (p < e && *p >= '0' && *p <= '9') x = x * 10 + (*p++ - '0');
+    v = (int)(neg ? -x : x);
+    return true;
+}
+
+// Builds g from text with a two-pass counting sort. Every worker parses its
+// newline-aligned chunk twice: first counting out-degrees per source, then
+// scattering targets to their rows. A worker writes each row after the
+// entries of all earlier chunks, so rows keep the order of the file.
+// for_each_edge(chunk, emit) calls emit(src, dst) for every edge of chunk.
+template <typename ForEachEdge>
+static void build_csr(string_view text, int num_threads, bool drop_self_loops,
+                      const ForEachEdge& for_each_edge, CsrGraph& g) {
+    g.clear();
+    if (num_threads <= 0) num_threads = (int)max(1u, thread::hardware_concurrency());
+    vector<pair<size_t,size_t>> ranges = TsvReader::chunk_ranges(text, (size_t)num_threads);
+    g.offsets.assign(1, 0);
+    if (ranges.empty()) return;
+    const size_t nparts = ranges.size();
+    auto chunk = [&](size_t i) { return text.substr(ranges[i].first, ranges[i].second - ranges[i].first); };
+    auto run_parts = [&](auto fn) {
+        vector<thread> workers;
+        workers.reserve(nparts);
+        for (size_t i = 0; i < nparts; ++i) workers.emplace_back([&, i]() { fn(i); });
+        for (auto &w : workers) w.join();
+    };
+
+    // counts[i][u]: edges from u in chunk i, later the row-relative write cursor of chunk i
+    vector<vector<uint32_t>> counts(nparts);
+    vector<size_t> rows(nparts, 0);
+    run_parts([&](size_t i) {
+        vector<uint32_t> &c = counts[i];
+        for_each_edge(chunk(i), [&](int a, int b) {
+            if (a < 0 || b < 0 || (drop_self_loops && a == b)) return;
+            if ((size_t)a >= c.size()) c.resize(max((size_t)a + 1, c.size() + c.size() / 2));
+            rows[i] = max(rows[i], (size_t)a + 1);
+            ++c[a];
+        });
+    });
+    size_t n = 0;
+    for (size_t r : rows) n = max(n, r);
+    for (auto &c : counts) c.resize(n, 0);
+
+    g.offsets.assign(n + 1, 0);
+    for (size_t u = 0; u < n; ++u) {
+        uint32_t deg = 0;
+        for (size_t i = 0; i < nparts; ++i) {
+            uint32_t c = counts[i][u];
+            counts[i][u] = deg;
+            deg += c;
+        }
+        g.offsets[u + 1] = g.offsets[u] + deg;
     }
+
+    g.cols.resize((size_t)g.offsets[n]);
+    run_parts([&](size_t i) {
+        vector<uint32_t> &cursor = counts[i];
+        for_each_edge(chunk(i), [&](int a, int b) {
+            if (a < 0 || b < 0 || (drop_self_loops && a == b)) return;
+            g.cols[(size_t)g.offsets[a] + cursor[a]++] = b;
+        });
+    });
 }
 
-vector<int> GraphBuilder::neighbors(int uid) {
-    vector<int> out;
-    auto it = adjacency.find(uid);
-    if (it == adjacency.end()) return out;
-    for (auto &p : it->second) out.push_back(p.first);
-    return out;
+// Sorts every row, drops repeats and packs the rows together again.
+static void dedup_rows(CsrGraph& g, int num_threads) {
+    const size_t n = (size_t)g.num_nodes();
+    if (n == 0) return;
+    if (num_threads <= 0) num_threads = (int)max(1u, thread::hardware_concurrency());
+    vector<uint64_t> kept(n, 0);
+    vector<thread> workers;
+    size_t step = (n + (size_t)num_threads - 1) / (size_t)num_threads;
+    for (size_t lo = 0; lo < n; lo += step) {
+        size_t hi = min(n, lo + step);
+        workers.emplace_back([&g, &kept, lo, hi]() {
+            for (size_t u = lo; u < hi; ++u) {
+                int* b = g.cols.data() + g.offsets[u];
+                int* e = g.cols.data() + g.offsets[u + 1];
+                sort(b, e);
+                kept[u] = (uint64_t)(unique(b, e) - b);
+            }
+        });
+    }
+    for (auto &w : workers) w.join();
+    uint64_t out = 0;
+    for (size_t u = 0; u < n; ++u) {
+        uint64_t from = g.offsets[u];
+        g.offsets[u] = out;
+        if (out != from) copy(g.cols.begin() + from, g.cols.begin() + from + kept[u], g.cols.begin() + out);
+        out += kept[u];
+    }
+    g.offsets[n] = out;
+    g.cols.resize((size_t)out);
+    g.cols.shrink_to_fit();
 }
 
-static inline string trim_copy_g(const string& s) {
-    size_t a = 0;
-    while (a < s.size() && isspace((unsigned char)s[a])) ++a;
-    size_t b = s.size();
-    while (b > a && isspace((unsigned char)s[b-1])) --b;
-    return s.substr(a, b - a);
+void GraphBuilder::load_edges(const string& path, size_t max_lines, const EdgeLoadOptions& opts) {
+    graph.clear();
+    MappedFile file;
+    if (!file.open(path)) return;
+    string_view text = file.view();
+    if (max_lines) {
+        TsvReader reader(text);
+        string_view line;
+        size_t cnt = 0;
+        while (cnt < max_lines && reader.next_row(line)) {
+            if (!line.empty()) ++cnt;
+        }
+        if (cnt == max_lines) text = text.substr(0, (size_t)(line.data() + line.size() - text.data()));
+    }
+    auto for_each_edge = [](string_view chunk, auto&& emit) {
+        TsvReader reader(chunk);
+        string_view line;
+        while (reader.next_row(line)) {
+            const char* p = line.data();
+            const char* e = p + line.size();
+            int a = 0, b = 0;
+            if (scan_int(p, e, a) && scan_int(p, e, b)) emit(a, b);
+        }
+    };
+    build_csr(text, opts.num_threads, opts.drop_self_loops, for_each_edge, graph);
+    if (opts.dedup) dedup_rows(graph, opts.num_threads);
 }
 
-bool GraphBuilder::load_serialized(const string& path) {
-    adjacency.clear();
-    ifstream in(path);
-    if (!in.is_open()) return false;
-    string line;
-    while (getline(in, line)) {
-        if (line.empty()) continue;
-        stringstream ss(line);
-        string token;
-        bool first = true;
-        int uid = -1;
-        while (getline(ss, token, ',')) {
-            string t = trim_copy_g(token);
-            if (t.empty()) continue;
-            if (first) { uid = atoi(t.c_str()); first = false; continue; }
-            int nid = atoi(t.c_str());
-            adjacency[uid].push_back(make_pair(nid, 1.0f));
+vector<int> GraphBuilder::add_edges(const CsrGraph& delta) {
+    vector<int> changed;
+    const int n = max(graph.num_nodes(), delta.num_nodes());
+    CsrGraph merged;
+    merged.offsets.assign((size_t)n + 1, 0);
+    merged.cols.reserve(graph.num_edges() + delta.num_edges());
+    vector<int> row;
+    for (int u = 0; u < n; ++u) {
+        if (graph.has_node(u)) merged.cols.insert(merged.cols.end(), graph.begin(u), graph.end(u));
+        if (delta.degree(u) != 0) {
+            row.assign(graph.begin(u), graph.end(u));
+            sort(row.begin(), row.end());
+            size_t before = merged.cols.size();
+            for (const int* p = delta.begin(u); p != delta.end(u); ++p) {
+                auto it = lower_bound(row.begin(), row.end(), *p);
+                if (it != row.end() && *it == *p) continue;
+                row.insert(it, *p);
+                merged.cols.push_back(*p);
+            }
+            if (merged.cols.size() != before) changed.push_back(u);
         }
+        merged.offsets[(size_t)u + 1] = merged.cols.size();
     }
+    graph = std::move(merged);
+    return changed;
+}
+
+vector<int> GraphBuilder::neighbors(int uid) const {
+    if (!graph.has_node(uid)) return vector<int>();
+    return vector<int>(graph.begin(uid), graph.end(uid));
+}
+
+static inline bool is_blank(string_view s) {
+    for (char c : s) if (!isspace((unsigned char)c)) return false;
+    return true;
+}
+
+bool GraphBuilder::load_serialized(const string& path) {
+    graph.clear();
+    MappedFile file;
+    if (!file.open(path)) return false;
+    auto for_each_edge = [](string_view chunk, auto&& emit) {
+        TsvReader reader(chunk);
+        string_view line;
+        vector<string_view> tokens;
+        while (reader.next_row(line)) {
+            TsvReader::split_cells(line, tokens, ',');
+            bool first = true;
+            int uid = -1;
+            for (string_view t : tokens) {
+                if (is_blank(t)) continue;
+                if (first) { uid = parse_int(t); first = false; continue; }
+                emit(uid, parse_int(t));
+            }
+        }
+    };
+    build_csr(file.view(), 0, false, for_each_edge, graph);
     return true;
 }
 
 bool GraphBuilder::save_serialized(const string& path) const {
     ofstream out(path);
     if (!out.is_open()) return false;
-    vector<int> keys;
-    keys.reserve(adjacency.size());
-    for (auto it = adjacency.begin(); it != adjacency.end(); ++it) keys.push_back(it->first);
-    sort(keys.begin(), keys.end());
-    for (int uid : keys) {
+    for (int uid = 0; uid < graph.num_nodes(); ++uid) {
+        if (graph.degree(uid) == 0) continue;
         out << uid;
-        const auto &vec = adjacency.at(uid);
-        for (auto &p : vec) out << "," << p.first;
+        for (const int* p = graph.begin(uid); p != graph.end(uid); ++p) out << "," << *p;
         out << "\n";
     }
     return true;
 }
+
+bool GraphBuilder::load_binary(const string& path) {
+    graph.clear();
+    AdjacencyFile file;
+    if (!file.open(path)) return false;
+    AdjacencyView adj = file.view();
+    graph.offsets.assign(adj.offsets(), adj.offsets() + adj.num_nodes() + 1);
+    graph.cols.assign(adj.cols(), adj.cols() + adj.num_edges());
+    if (adj.num_nodes() == 0) graph.clear();
+    return true;
+}
+
+bool GraphBuilder::save_binary(const string& path) const {
+    return write_adjacency_bin(path, graph);
+}
@@ -1,32 +1,68 @@
 #include "lemmatizer_wrapper.h"
-#include <cstdlib>
+#include <string_view>
 #include "../third_party/lemmagen/include/lemmagen.h"
 
 Lemmatiser::Lemmatiser(const string& model_path) {
-    int status = lem_load_language_library(model_path.c_str());
-    if (status == STATUS_OK) loaded = true; else loaded = false;
+    int status = STATUS_FAILED;
+    model = lem_model_open(model_path.c_str(), &status);
+    loaded = model != nullptr && status == STATUS_OK;
 }
 Lemmatiser::~Lemmatiser() {
-    if (loaded) lem_unload_language_library();
+    if (model) lem_model_close(model);
+    model = nullptr;
     loaded = false;
 }
-string Lemmatiser::lemmatize_word(const string& w) {
+string Lemmatiser::lemmatize_uncached(const string& w) const {
     if (!loaded) return string();
-    char* out = lem_lemmatize_word_alloc(w.c_str());
-    if (out == nullptr) return string();
-    string res(out);
-    free(out);
-    return res;
+    char out[LEM_MAX_OUTPUT_LEN];
+    size_t len = lem_model_lemmatize(model, w.c_str(), out);
+    return string(out, len);
 }
-vector<string> Lemmatiser::lemmatize_tokens(const vector<string>& toks) {
+const string& Lemmatiser::lookup(string_view w, LemmaCache& cache) const {
+    string key(w);
+    auto it = cache.map.find(key);
+    if (it != cache.map.end()) { ++cache.hits; return it->second; }
+    ++cache.misses;
+    string lemma = lemmatize_uncached(key);
+    return cache.map.emplace(std::move(key), std::move(lemma)).first->second;
+}
+string Lemmatiser::lemmatize_word(const string& w, LemmaCache& cache) const {
+    if (!loaded) return string();
+    if (cache.map.size() >= cache.max_entries) cache.map.clear();
+    return lookup(w, cache);
+}
+vector<string> Lemmatiser::lemmatize_tokens(const vector<string>& toks, LemmaCache& cache) const {
+    vector<string_view> views(toks.begin(), toks.end());
+    return lemmatize_tokens(views, cache);
+}
+vector<string> Lemmatiser::lemmatize_tokens(const vector<string_view>& toks, LemmaCache& cache) const {
     vector<string> out;
     out.reserve(toks.size());
+    if (!loaded) return out;
+    if (cache.map.size() >= cache.max_entries) cache.map.clear();
+    // Repeated words within one call are resolved once; the pointers stay
+    // valid because nothing is erased from the cache until the next call.
+    unordered_map<string_view, const string*> seen;
     for (size_t i = 0; i < toks.size(); ++i) {
-        const string &w = toks[i];
+        string_view w = toks[i];
         if (w.empty()) continue;
-        string l = lemmatize_word(w);
-        if (l.empty()) continue;
-        out.push_back(l);
+        const string* l;
+        auto it = seen.find(w);
+        if (it != seen.end()) l = it->second;
+        else {
+            l = &lookup(w, cache);
+            seen.emplace(w, l);
+        }
+        if (l->empty()) continue;
+        out.push_back(*l);
     }
     return out;
 }
+string Lemmatiser::lemmatize_word(const string& w) {
+    lock_guard<mutex> lk(cache_m);
+    return lemmatize_word(w, cache);
+}
+vector<string> Lemmatiser::lemmatize_tokens(const vector<string>& toks) {
+    lock_guard<mutex> lk(cache_m);
+    return lemmatize_tokens(toks, cache);
+}
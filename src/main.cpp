@@ -16,6 +16,9 @@
 #include "user_loader.h"
 #include "ui.h"
 #include "test.h"
+#include "bench.h"
+#include "delta_ingest.h"
+#include "pipeline.h"
 
 #include <iostream>
 #include <vector>
@@ -30,124 +33,88 @@ int main(int argc, char** argv) {
     const string profiles = "data/soc-pokec-profiles.txt";
     const string rels = "data/soc-pokec-relationships.txt";
     const string TEXT_COLS_PATH = "config/text_columns.txt";
+    const string VOCAB_OPTIONS_PATH = "config/vocab_options.txt";
     vector<string> textCols = load_text_columns_from_file(TEXT_COLS_PATH);
-
-    Tokenizer tok;
-    Lemmatiser lemma("data/lem-me-sk.bin");
-
-    VocabBuilder vb(textCols);
-
-    const string DATA_DIR = "data";
-    bool loaded_vocab = vb.load_vocab(DATA_DIR);
-    if (! loaded_vocab) {
-        vb.pass1(profiles, tok, lemma);
-        vb.save_vocab(DATA_DIR);
-        cout << "[main] vocab built and saved to " << DATA_DIR << "\n";
-    } else {
-        cout << "[main] vocab loaded from " << DATA_DIR << "\n";
-    }
-
-    GraphBuilder gb;
-    const string adjacency_csv = "data/adjacency.csv";
-    bool loaded = gb.load_serialized(adjacency_csv);
-    if (! loaded) {
-        gb.load_edges(rels, 0);
-        gb.save_serialized(adjacency_csv);
-        cout << "[main] adjacency built and saved to " << adjacency_csv << "\n";
-    } else {
-        cout << "[main] adjacency loaded from " << adjacency_csv << "\n";
+    // token space of the text columns; ingest has to use what the vocab was built with
+    VocabOptions vocab_opts;
+    if (!load_vocab_options(VOCAB_OPTIONS_PATH, vocab_opts)) {
+        cout << "[main] cannot use " << VOCAB_OPTIONS_PATH << "\n";
+        return 1;
     }
 
-    unordered_map<int, vector<int>> adj_list = build_adj_list(gb.adjacency);
-
-    const string users_encoded = "data/users_encoded.csv";
-    {
-        ifstream f(users_encoded);
-        bool exists = f.is_open();
-        f.close();
-        if (! exists) {
-            Encoder enc(
-                textCols,
-                vb.token2id_per_col,
-                vb.club_to_id,
-                vb.address_part1_to_id,
-                vb.address_part2_to_id,
-                vb.address_part3_to_id,
-                adj_list
-            );
-            enc.pass2(profiles, users_encoded);
-            cout << "[main] users encoded and saved to " << users_encoded << "\n";
-        } else {
-            cout << "[main] encoded users found in " << users_encoded << "\n";
+    // kurs --ingest <profiles_delta.tsv|-> [<edges_delta.txt|->]
+    if (argc > 1 && string(argv[1]) == "--ingest") {
+        string profiles_delta = (argc > 2 && string(argv[2]) != "-") ? argv[2] : "";
+        string edges_delta = (argc > 3 && string(argv[3]) != "-") ? argv[3] : "";
+        if (profiles_delta.empty() && edges_delta.empty()) {
+            cout << "usage: " << argv[0] << " --ingest <profiles_delta.tsv|-> [<edges_delta.txt|->]\n";
+            return 1;
         }
+        Tokenizer tok;
+        Lemmatiser lemma("data/lem-me-sk.bin");
+        bool ok = ingest_delta("data", textCols, profiles_delta, edges_delta, tok, lemma, vocab_opts);
+        cout << (ok ? "[main] delta ingested into data\n" : "[main] delta ingest failed\n");
+        return ok ? 0 : 1;
     }
 
-    unordered_map<int, UserProfile> profiles_map;
+    int bench = 0;
+    if (bench == 1) {
+        run_club_scanner_bench(profiles, 200000);
+    } else if (bench == 2) {
+        run_lemmatizer_bench("data/lem-me-sk.bin", profiles, 200000);
+    } else if (bench == 3) {
+        run_vocab_options_bench(profiles, rels, "data/lem-me-sk.bin", textCols, "config/stopwords_sk.txt", 100000);
+    } else if (bench == 4) {
+        run_record_decode_bench("data/users.bin", "data/users.idx", textCols.size());
+    }
 
     cout << "How many users to load? (enter number, 0 = load all): ";
     size_t to_load = 0;
     if (!(cin >> to_load)) { cin.clear(); string tmp; getline(cin,tmp); to_load = 0; }
 
-    bool ok;
-    ok = load_users_encoded(users_encoded, textCols, profiles_map, to_load);
-
-    if (! ok) {
-        cout << "[main] cannot load users_encoded.csv\n";
+    PipelineConfig cfg;
+    cfg.profiles = profiles;
+    cfg.relationships = rels;
+    cfg.text_columns = textCols;
+    cfg.vocab = vocab_opts;
+    cfg.max_users = to_load;
+    // kurs --export-csv also writes data/users_encoded.csv for inspection
+    cfg.export_csv = argc > 1 && string(argv[1]) == "--export-csv";
+    cfg.tag = "main";
+    PipelineData data(textCols);
+    if (! run_pipeline(cfg, data, cout)) {
+        cout << "[main] pipeline failed\n";
         return 1;
     }
-    cout << "[main] loaded profiles: " << profiles_map.size() << "\n";
-
-    const string median_path = DATA_DIR + "/median_age.txt";
-    int median_age = 0;
-    if (load_median_age(median_path, median_age)) {
-        cout << "[main] loaded median_age=" << median_age << " from " << median_path << "\n";
-    } else {
-        cout << "[main] median not found, computing median from profiles\n";
-        median_age = compute_median_age_from_profiles(profiles_map);
-        if (median_age > 0) {
-            save_median_age(median_path, median_age);
-            cout << "[main] computed median_age=" << median_age << " and saved to " << median_path << "\n";
-        } else {
-            cout << "[main] computed median_age=0\n";
-        }
-    }
-
-    int replaced = fill_missing_ages(profiles_map, median_age);
-    cout << "[main] replaced " << replaced << " zero-ages with median_age=" << median_age << "\n";
-
-    const string norms_path = DATA_DIR + "/column_normalizers.csv";
-    unordered_map<string, pair<float,float>> col_norms_map;
-    if (load_column_normalizers(norms_path, col_norms_map)) {
-        cout << "[main] loaded column normalizers from " << norms_path << " (" << col_norms_map.size() << " entries)\n";
-    } else {
-        cout << "[main] column_normalizers.csv not found or invalid, computing normalizers (sample_size=100000, comps_per_user=5)\n";
-        col_norms_map = compute_column_normalizers(profiles_map, textCols, 100000, 5);
-        if (save_column_normalizers(norms_path, col_norms_map))
-            cout << "[main] saved column normalizers to " << norms_path << " (" << col_norms_map.size() << " entries)\n";
-        else
-            cout << "[main] cannot save column normalizers to " << norms_path << "\n";
-    }
+    ProfileStore &profiles_map = data.profiles;
+    unordered_map<string, pair<float,float>> &col_norms_map = data.col_norms;
 
     cout << "[main] HierCoarsener created (not used for non-coarsened run)\n";
 
-    Recommender rec(&profiles_map, &adj_list);
+    Recommender rec(&profiles_map, data.adjacency);
     rec.set_field_normalizers(col_norms_map);
     rec.set_column_normalizers(col_norms_map);
-    rec.compute_idf_from_profiles(textCols);
+    {
+        StageTimer idf(&data.report, "idf");
+        rec.compute_idf_from_profiles(textCols);
+        idf.metrics.rows = profiles_map.size();
+    }
     rec.set_text_columns(textCols);
     cout << "[main] Recommender ready with precomputed idf for " << textCols.size() << " text columns\n";
+    data.report.print(cout, "main");
+    if (data.report.write_json("data/run_report.json")) cout << "[main] run report saved to data/run_report.json\n";
 
     unordered_map<int,string> club_id_to_name;
-    for (auto &kv : vb.club_to_id) {
-        club_id_to_name[kv.second] = kv.first;
+    if (const VocabTable* clubs = data.vocab_view.table("clubs")) {
+        for (uint32_t id = 0; id < clubs->size(); ++id) club_id_to_name[(int)id] = string(clubs->str(id));
     }
 
     int test = 1;
     if (test == 1) {
-        run_friends_holdout_test(profiles_map, adj_list, textCols, rec, 100, "data/friends_holdout_results.csv");
+        run_friends_holdout_test(profiles_map, data.adjacency, textCols, rec, 100, "data/friends_holdout_results.csv");
     }
 
-    run_terminal_ui(profiles_map, adj_list, rec, club_id_to_name, textCols, profiles_map.size());
+    run_terminal_ui(profiles_map, data.adjacency, rec, club_id_to_name, textCols, profiles_map.size());
 
     return 0;
 }
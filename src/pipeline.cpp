@@ -0,0 +1,222 @@
+#include "pipeline.h"
+#include "stage_dag.h"
+#include "tokenizer.h"
+#include "lemmatizer_wrapper.h"
+#include "encoder.h"
+#include "user_loader.h"
+#include "utils.h"
+#include "graph_builder.h"
+#include <filesystem>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+bool run_pipeline(const PipelineConfig& cfg, PipelineData& data, ostream& log) {
+    auto in_dir = [&](const string& f) { return (fs::path(cfg.data_dir) / f).string(); };
+    const string tag = "[" + cfg.tag + "] ";
+    const string token_cache = in_dir("token_cache.bin");
+    const string vocab_bin = in_dir("vocab.bin");
+    const string adjacency_path = in_dir("adjacency.bin");
+    const string users_bin = in_dir("users.bin");
+    const string users_idx = in_dir("users.idx");
+    const string users_csv = in_dir("users_encoded.csv");
+    const string median_path = in_dir("median_age.txt");
+    const string norms_path = in_dir("column_normalizers.csv");
+    if (!vocab_options_ok(cfg.vocab)) {
+        log << tag << "invalid vocab options\n";
+        return false;
+    }
+
+    StageDag dag;
+
+    Stage vocab;
+    vocab.name = "vocab";
+    vocab.outputs = { in_dir("tokens.csv"), in_dir("clubs_map.csv"),
+                      in_dir("addresses_part1.csv"), in_dir("addresses_part2.csv"), in_dir("addresses_part3.csv"), vocab_bin };
+    // Fresh vocabs are only mapped; the string maps are read once the encoder needs them.
+    bool vocab_maps = false;
+    vocab.inputs = [&](Fingerprint& fp) {
+        fp.add_file(cfg.profiles).add_file(cfg.lemma_model);
+        for (const string &c : cfg.text_columns) fp.add(string_view(c));
+        fp.add((uint64_t)cfg.vocab.min_df).add(string_view(to_string(cfg.vocab.max_df))).add((uint64_t)cfg.vocab.hash_bits);
+        if (!cfg.vocab.stopwords_path.empty()) fp.add_file(cfg.vocab.stopwords_path);
+    };
+    vocab.build = [&](const string&) {
+        Tokenizer tok;
+        Lemmatiser lemma(cfg.lemma_model);
+        data.vocab.token_cache_path = token_cache;
+        data.vocab.options = cfg.vocab;
+        data.vocab.pass1(cfg.profiles, tok, lemma);
+        data.vocab.save_vocab(cfg.data_dir);
+        vocab_maps = true;
+        log << tag << "vocab built and saved to " << cfg.data_dir << "\n";
+        return data.vocab_view.open(vocab_bin);
+    };
+    vocab.load = [&]() { return data.vocab_view.open(vocab_bin); };
+    vocab.counts = [&](StageMetrics& m) {
+        if (m.status == "built") { m.rows = data.vocab.pass1_rows; m.bytes = file_bytes(cfg.profiles); }
+        else m.bytes = file_bytes(vocab_bin);
+    };
+    dag.add(vocab);
+
+    Stage adjacency;
+    adjacency.name = "adjacency";
+    adjacency.outputs = { adjacency_path };
+    adjacency.inputs = [&](Fingerprint& fp) { fp.add_file(cfg.relationships); };
+    // The graph is only in memory while it is built; everything else uses
+    // the mapped file.
+    auto open_adjacency = [&]() {
+        if (!data.adjacency_file.open(adjacency_path)) return false;
+        data.adjacency = data.adjacency_file.view();
+        return true;
+    };
+    adjacency.build = [&](const string&) {
+        GraphBuilder graph;
+        {
+            StageTimer parse(&data.report, "adjacency/graph_build");
+            graph.load_edges(cfg.relationships, 0);
+            parse.metrics.rows = graph.graph.num_edges();
+            parse.metrics.bytes = file_bytes(cfg.relationships);
+        }
+        StageTimer serialize(&data.report, "adjacency/serialize");
+        serialize.metrics.rows = graph.graph.num_edges();
+        if (!graph.save_binary(adjacency_path)) {
+            serialize.metrics.status = "failed";
+            return false;
+        }
+        serialize.metrics.bytes = file_bytes(adjacency_path);
+        serialize.finish();
+        log << tag << "adjacency built and saved to " << adjacency_path << "\n";
+        return open_adjacency();
+    };
+    adjacency.load = open_adjacency;
+    adjacency.counts = [&](StageMetrics& m) {
+        m.rows = data.adjacency.num_edges();
+        m.bytes = file_bytes(m.status == "built" ? cfg.relationships : adjacency_path);
+    };
+    dag.add(adjacency);
+
+    Stage encoded;
+    encoded.name = "users_encoded";
+    encoded.deps = { "vocab", "adjacency" };
+    encoded.outputs = { users_bin, users_idx };
+    if (cfg.export_csv) encoded.outputs.push_back(users_csv);
+    encoded.inputs = [&](Fingerprint& fp) { fp.add(string_view("users.bin v3, users.idx v1")).add((uint64_t)cfg.export_csv); };
+    uint64_t encoded_rows = 0, encoded_bytes = 0;
+    encoded.build = [&](const string& fingerprint) {
+        if (!vocab_maps && !data.vocab.load_vocab(cfg.data_dir)) return false;
+        vocab_maps = true;
+        const VocabBuilder &vb = data.vocab;
+        Encoder enc(cfg.text_columns, vb.token2id_per_col, vb.club_to_id,
+                    vb.address_part1_to_id, vb.address_part2_to_id, vb.address_part3_to_id, data.adjacency);
+        enc.token_cache_path = token_cache;
+        enc.hash_bits = cfg.vocab.hash_bits;
+        if (enc.hash_bits > 0 && !cfg.vocab.stopwords_path.empty()) load_stopwords(cfg.vocab.stopwords_path, enc.stopwords);
+        if (cfg.export_csv) enc.csv_export_path = users_csv;
+        enc.checkpoint_path = users_bin + ".ckpt";
+        enc.checkpoint_key = fingerprint;
+        if (!enc.pass2(cfg.profiles, users_bin, users_idx)) return false;
+        encoded_rows = enc.rows_encoded;
+        encoded_bytes = enc.bytes_encoded;
+        log << tag << "users encoded and saved to " << users_bin << "\n";
+        return true;
+    };
+    encoded.counts = [&](StageMetrics& m) { m.rows = encoded_rows; m.bytes = encoded_bytes; };
+    dag.add(encoded);
+
+    Stage profiles;
+    profiles.name = "profiles";
+    profiles.deps = { "users_encoded", "adjacency" };
+    profiles.inputs = [&](Fingerprint& fp) { fp.add((uint64_t)cfg.max_users); };
+    // Without resident profiles nothing is loaded here; the stages below
+    // read what they need from users.bin.
+    profiles.build = [&](const string&) {
+        if (!cfg.resident_profiles) return true;
+        if (!load_users_bin(users_bin, users_idx, cfg.text_columns, data.adjacency, data.profiles, cfg.max_users)) {
+            log << tag << "cannot load " << users_bin << "\n";
+            return false;
+        }
+        log << tag << "loaded profiles: " << data.profiles.size() << "\n";
+        return true;
+    };
+    profiles.counts = [&](StageMetrics& m) { m.rows = data.profiles.size(); m.bytes = file_bytes(users_bin); };
+    dag.add(profiles);
+
+    Stage median;
+    median.name = "median_age";
+    median.deps = { "profiles" };
+    median.outputs = { median_path };
+    median.build = [&](const string&) {
+        if (cfg.resident_profiles) {
+            data.median_age = compute_median_age_from_profiles(data.profiles);
+        } else if (!compute_median_age_from_bin(users_bin, users_idx, cfg.max_users, data.median_age)) {
+            log << tag << "cannot read ages from " << users_bin << "\n";
+            return false;
+        }
+        if (data.median_age > 0) {
+            save_median_age(median_path, data.median_age);
+            log << tag << "computed median_age=" << data.median_age << " and saved to " << median_path << "\n";
+        } else {
+            log << tag << "computed median_age=0\n";
+        }
+        return true;
+    };
+    median.load = [&]() { return load_median_age(median_path, data.median_age); };
+    median.counts = [&](StageMetrics& m) {
+        if (m.status != "built") return;
+        if (cfg.resident_profiles) m.rows = data.profiles.size();
+        else m.bytes = file_bytes(users_bin);
+    };
+    dag.add(median);
+
+    Stage ages;
+    ages.name = "ages";
+    ages.deps = { "median_age" };
+    ages.build = [&](const string&) {
+        if (!cfg.resident_profiles) return true;
+        int replaced = fill_missing_ages(data.profiles, data.median_age);
+        log << tag << "replaced " << replaced << " zero-ages with median_age=" << data.median_age << "\n";
+        return true;
+    };
+    ages.counts = [&](StageMetrics& m) { m.rows = data.profiles.size(); };
+    dag.add(ages);
+
+    Stage normalizers;
+    normalizers.name = "column_normalizers";
+    normalizers.deps = { "ages" };
+    normalizers.outputs = { norms_path };
+    normalizers.inputs = [&](Fingerprint& fp) {
+        fp.add(string_view("sampled users"));
+        fp.add((uint64_t)cfg.normalizer_sample_size).add((uint64_t)cfg.normalizer_comps_per_user);
+    };
+    // Pairs are drawn from normalizer_sample_size users read from users.bin,
+    // the same with or without resident profiles and never all of them.
+    size_t normalizer_rows = 0;
+    normalizers.build = [&](const string&) {
+        ProfileStore sample;
+        if (!load_users_bin_sample(users_bin, users_idx, cfg.text_columns, data.adjacency, sample, cfg.max_users,
+                                   (size_t)max(cfg.normalizer_sample_size, 0))) {
+            log << tag << "cannot sample profiles from " << users_bin << "\n";
+            return false;
+        }
+        fill_missing_ages(sample, data.median_age);
+        normalizer_rows = sample.size();
+        data.col_norms = compute_column_normalizers(sample, cfg.text_columns,
+                                                    cfg.normalizer_sample_size, cfg.normalizer_comps_per_user);
+        if (save_column_normalizers(norms_path, data.col_norms))
+            log << tag << "saved column normalizers to " << norms_path << " (" << data.col_norms.size() << " entries)\n";
+        else
+            log << tag << "cannot save column normalizers to " << norms_path << "\n";
+        return true;
+    };
+    normalizers.load = [&]() { return load_column_normalizers(norms_path, data.col_norms); };
+    normalizers.counts = [&](StageMetrics& m) {
+        if (m.status == "built") m.rows = normalizer_rows;
+        else { m.rows = data.col_norms.size(); m.bytes = file_bytes(norms_path); }
+    };
+    dag.add(normalizers);
+
+    bool ok = dag.run(log, cfg.tag, &data.report);
+    data.profiles_view = data.profiles.view();
+    return ok;
+}
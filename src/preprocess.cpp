@@ -1,113 +1,171 @@
 #include "preprocess.h"
 #include <fstream>
-#include <sstream>
-#include <regex>
+#include "club_links.h"
+#include "tsv_reader.h"
+#include "ordered_pipeline.h"
+#include <algorithm>
+#include <thread>
 using namespace std;
 
 vector<string> split_tab(const string& line)
 {
-    vector<string> out;
-    string field;
-    stringstream ss(line);
-    while (getline(ss, field, '\t')) out.push_back(field);
-    return out;
+    vector<string_view> cells;
+    TsvReader::split_cells(line, cells);
+    return vector<string>(cells.begin(), cells.end());
 }
 
-vector<vector<string>> preprocess_profiles(const string& path, Tokenizer& tok, size_t max_rows)
+static string join_tokens(const Tokenizer& tok, string_view cell, TokenBuffer& words)
 {
-    ifstream in(path);
-    vector<vector<string>> df;
-    string line;
-    size_t row = 0;
-    regex href_re("href=\"/klub/([^\"]+)\"");
-    while (getline(in, line))
+    tok.tokenize(cell, words);
+    string joined;
+    for (size_t k = 0; k < words.tokens.size(); ++k)
     {
-        if (line.size() == 0) continue;
-        vector<string> cols = split_tab(line);
-        if (cols.size() == 0) continue;
-        vector<string> out;
-        if (cols.size() >= 1) out.push_back(cols[0]);
-        if (cols.size() >= 4) out.push_back(cols[3]);
-        for (size_t i = 10; i < cols.size(); ++i)
+        if (k) joined.push_back(' ');
+        joined += words.tokens[k];
+    }
+    return joined;
+}
+
+static vector<string> preprocess_row(const vector<string_view>& cols, const Tokenizer& tok, TokenBuffer& words, vector<ClubLink>& links)
+{
+    vector<string> out;
+    if (cols.size() >= 1) out.push_back(string(cols[0]));
+    if (cols.size() >= 4) out.push_back(string(cols[3]));
+    for (size_t i = 10; i < cols.size(); ++i)
+    {
+        string_view cell = cols[i];
+        if (cell.find("<a ") != string_view::npos || cell.find("klub") != string_view::npos)
         {
-            string cell = cols[i];
-            if (cell.find("<a ") != string::npos || cell.find("klub") != string::npos)
+            links.clear();
+            scan_club_links(cell, ClubHref, links);
+            string res;
+            for (const ClubLink &link : links)
             {
-                smatch m;
-                string s = cell;
-                string::const_iterator searchStart(s.cbegin());
-                string res;
-                while (regex_search(searchStart, s.cend(), m, href_re))
+                if (res.size()) res.push_back(' ');
+                string_view token = link.slug;
+                for (size_t k = 0; k < token.size(); ++k)
                 {
-                    if (res.size()) res.push_back(' ');
-                    string token = m[1].str();
-                    for (size_t k = 0; k < token.size(); ++k)
+                    char c = token[k];
+                    unsigned char uc = (unsigned char) c;
+                    if ( (uc >= '0' && uc <= '9') || (uc >= 'A' && uc <= 'Z') || (uc >= 'a' && uc <= 'z') || c == '-' )
                     {
-                        char c = token[k];
-                        unsigned char uc = (unsigned char) c;
-                        if ( (uc >= '0' && uc <= '9') || (uc >= 'A' && uc <= 'Z') || (uc >= 'a' && uc <= 'z') || c == '-' )
-                        {
-                            if (uc >= 'A' && uc <= 'Z') res.push_back((char)(uc + 32));
-                            else res.push_back(c);
-                        }
-                        else
-                        {
-                            if (res.empty() == false && res.back() != '-') res.push_back('-');
-                        }
+                        if (uc >= 'A' && uc <= 'Z') res.push_back((char)(uc + 32));
+                        else res.push_back(c);
                     }
-                    searchStart = m.suffix().first;
-                }
-                if (res.size() == 0)
-                {
-                    vector<string> toks = tok.tokenize(cell);
-                    string joined;
-                    for (size_t k = 0; k < toks.size(); ++k)
+                    else
                     {
-                        if (k) joined.push_back(' ');
-                        joined += toks[k];
+                        if (res.empty() == false && res.back() != '-') res.push_back('-');
                     }
-                    out.push_back(joined);
                 }
-                else out.push_back(res);
             }
-            else
+            if (res.size() == 0)
             {
-                vector<string> toks = tok.tokenize(cell);
-                string joined;
-                for (size_t k = 0; k < toks.size(); ++k)
-                {
-                    if (k) joined.push_back(' ');
-                    joined += toks[k];
-                }
-                out.push_back(joined);
+                out.push_back(join_tokens(tok, cell, words));
             }
+            else out.push_back(res);
+        }
+        else
+        {
+            out.push_back(join_tokens(tok, cell, words));
         }
-        df.push_back(out);
-        ++row;
-        if (max_rows && row >= max_rows) break;
     }
-    return df;
+    return out;
 }
 
-void save_df_csv(const string& outpath, const vector<vector<string>>& df)
+struct PreprocessBatch
+{
+    vector<string_view> lines;
+};
+
+struct PreprocessedBatch
+{
+    vector<vector<string>> rows;
+};
+
+size_t preprocess_profiles_stream(const string& path, const Tokenizer& tok, const ProfileRowSink& sink,
+                                  size_t max_rows, int num_threads)
+{
+    MappedFile file;
+    if (!file.open(path)) return 0;
+    TsvReader reader(file.view());
+    if (num_threads <= 0) num_threads = (int)max(1u, thread::hardware_concurrency());
+    const size_t batch_lines = 256;
+    size_t read_rows = 0, written = 0;
+
+    function<bool(PreprocessBatch&)> read_batch = [&](PreprocessBatch& batch)
+    {
+        string_view line;
+        while (batch.lines.size() < batch_lines && (!max_rows || read_rows < max_rows) && reader.next_row(line))
+        {
+            // rows without cells are skipped like empty lines and do not count
+            if (line.size() == 0) continue;
+            batch.lines.push_back(line);
+            ++read_rows;
+        }
+        return !batch.lines.empty();
+    };
+    function<void(PreprocessBatch&, PreprocessedBatch&)> work = [&](PreprocessBatch& batch, PreprocessedBatch& done)
+    {
+        vector<string_view> cols;
+        vector<ClubLink> links;
+        TokenBuffer words;
+        done.rows.reserve(batch.lines.size());
+        for (string_view line : batch.lines)
+        {
+            TsvReader::split_cells(line, cols);
+            if (cols.size() == 0) continue;
+            done.rows.push_back(preprocess_row(cols, tok, words, links));
+        }
+    };
+    function<void(PreprocessedBatch&)> write_batch = [&](PreprocessedBatch& done)
+    {
+        for (vector<string>& row : done.rows)
+        {
+            sink(row);
+            ++written;
+        }
+    };
+    run_ordered_pipeline(read_batch, work, write_batch, num_threads, (size_t)num_threads * 4);
+    return written;
+}
+
+bool preprocess_profiles_to_csv(const string& path, const Tokenizer& tok, const string& outpath,
+                                size_t max_rows, int num_threads)
 {
     ofstream out(outpath);
-    for (size_t r = 0; r < df.size(); ++r)
+    if (!out.is_open()) return false;
+    preprocess_profiles_stream(path, tok, [&](vector<string>& row) { write_csv_row(out, row); }, max_rows, num_threads);
+    out.close();
+    return (bool)out;
+}
+
+vector<vector<string>> preprocess_profiles(const string& path, Tokenizer& tok, size_t max_rows)
+{
+    vector<vector<string>> df;
+    preprocess_profiles_stream(path, tok, [&](vector<string>& row) { df.push_back(std::move(row)); }, max_rows);
+    return df;
+}
+
+void write_csv_row(ostream& out, const vector<string>& row)
+{
+    for (size_t c = 0; c < row.size(); ++c)
     {
-        const vector<string>& row = df[r];
-        for (size_t c = 0; c < row.size(); ++c)
+        const string& cell = row[c];
+        bool need_quote = (cell.find(',') != string::npos) || (cell.find('"') != string::npos);
+        if (need_quote) out << '"';
+        for (size_t i = 0; i < cell.size(); ++i)
         {
-            string cell = row[c];
-            bool need_quote = (cell.find(',') != string::npos) || (cell.find('"') != string::npos);
-            if (need_quote) out << '"';
-            for (size_t i = 0; i < cell.size(); ++i)
-            {
-                char ch = cell[i];
-                if (ch == '"') out << "\"\""; else out << ch;
-            }
-            if (need_quote) out << '"';
-            if (c + 1 < row.size()) out << ',';
+            char ch = cell[i];
+            if (ch == '"') out << "\"\""; else out << ch;
         }
-        out << '\n';
+        if (need_quote) out << '"';
+        if (c + 1 < row.size()) out << ',';
     }
+    out << '\n';
+}
+
+void save_df_csv(const string& outpath, const vector<vector<string>>& df)
+{
+    ofstream out(outpath);
+    for (size_t r = 0; r < df.size(); ++r) write_csv_row(out, df[r]);
 }
@@ -0,0 +1,167 @@
+#include "profile_cache.h"
+#include "serializer.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+static int record_field(uint32_t v) {
+    return v == USER_FIELD_NONE ? -1 : (int)v;
+}
+
+ProfileHandle::ProfileHandle(ProfileHandle&& other) noexcept
+    : r(other.r), owner(other.owner), slot(other.slot) {
+    other.owner = nullptr;
+}
+
+ProfileHandle& ProfileHandle::operator=(ProfileHandle&& other) noexcept {
+    if (this != &other) {
+        release();
+        r = other.r;
+        owner = other.owner;
+        slot = other.slot;
+        other.owner = nullptr;
+    }
+    return *this;
+}
+
+void ProfileHandle::release() {
+    if (owner) owner->unpin(slot);
+    owner = nullptr;
+    r = ProfileRef();
+}
+
+bool ProfileCache::open(const string& users_bin, const string& users_idx, size_t num_text_columns,
+                        const AdjacencyView& adjacency_in, size_t capacity, int default_age_in) {
+    close();
+    if (!reader.open(users_bin, users_idx)) return false;
+    adjacency = adjacency_in;
+    text_cols = num_text_columns;
+    max_entries = max<size_t>(capacity, 1);
+    default_age = default_age_in;
+    mask = RecordMask::fixed_only().add_clubs();
+    for (size_t t = 0; t < text_cols; ++t) mask.add_tokens(t);
+    entries.reserve(min(max_entries, reader.size()));
+    slot_by_id.reserve(min(max_entries, reader.size()));
+    return true;
+}
+
+void ProfileCache::close() {
+    reader.close();
+    entries.clear();
+    slot_by_id.clear();
+    hand = 0;
+    reset_stats();
+}
+
+bool ProfileCache::get(int user_id, ProfileHandle& out) {
+    out.release();
+    uint32_t slot;
+    auto it = slot_by_id.find(user_id);
+    if (it != slot_by_id.end()) {
+        ++hits;
+        slot = it->second;
+        entries[slot].marked = true;
+    } else {
+        auto t0 = chrono::steady_clock::now();
+        if (!reader.read(user_id, view, mask) || view.user_id == 0) return false;
+        slot = take_slot();
+        fill(entries[slot]);
+        slot_by_id[user_id] = slot;
+        ++misses;
+        miss_ns += (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count();
+    }
+    Entry &e = entries[slot];
+    ++e.pins;
+    out.r = ref(e);
+    out.owner = this;
+    out.slot = slot;
+    return true;
+}
+
+uint32_t ProfileCache::take_slot() {
+    if (entries.size() < max_entries) {
+        entries.emplace_back();
+        return (uint32_t)(entries.size() - 1);
+    }
+    // two sweeps clear every mark, so an unpinned entry turns up by then
+    for (size_t step = 0; step < 2 * entries.size(); ++step) {
+        size_t s = hand;
+        hand = (hand + 1) % entries.size();
+        Entry &e = entries[s];
+        if (e.pins > 0) continue;
+        if (e.marked) {
+            e.marked = false;
+            continue;
+        }
+        slot_by_id.erase(e.user_id);
+        ++evictions;
+        return (uint32_t)s;
+    }
+    entries.emplace_back();
+    return (uint32_t)(entries.size() - 1);
+}
+
+void ProfileCache::fill(Entry& e) {
+    e.user_id = (int)view.user_id;
+    e.public_flag = record_field(view.ispublic);
+    e.completion_percentage = record_field(view.completion_percentage);
+    e.gender = record_field(view.gender);
+    e.age = view.age == 0 ? default_age : (int)view.age;
+    e.region_parts = { -1, -1, -1 };
+    for (size_t i = 0; i < view.region.size && i < 3; ++i) e.region_parts[i] = record_field(view.region[i]);
+    e.clubs.assign(view.clubs.begin(), view.clubs.end());
+    NeighborRange friends = adjacency.neighbors(e.user_id);
+    e.friends.assign(friends.begin(), friends.end());
+    sort(e.friends.begin(), e.friends.end());
+    e.tokens.clear();
+    e.token_offsets.assign(1, 0);
+    for (size_t t = 0; t < text_cols; ++t) {
+        if (t < view.token_cols.size()) {
+            const TokenPairSpan &col = view.token_cols[t];
+            for (size_t k = 0; k < col.size; ++k) e.tokens.push_back(TokenCount{ (int32_t)col.token(k), (int32_t)col.count(k) });
+        }
+        e.token_offsets.push_back(e.tokens.size());
+    }
+    e.marked = false;
+}
+
+ProfileRef ProfileCache::ref(const Entry& e) const {
+    ProfileRef r;
+    r.user_id = e.user_id;
+    r.public_flag = e.public_flag;
+    r.completion_percentage = e.completion_percentage;
+    r.gender = e.gender;
+    r.age = e.age;
+    r.region_parts = e.region_parts;
+    r.clubs.first = e.clubs.data();
+    r.clubs.last = e.clubs.data() + e.clubs.size();
+    r.friends.first = e.friends.data();
+    r.friends.last = e.friends.data() + e.friends.size();
+    r.token_data = e.tokens.data();
+    r.token_offsets = e.token_offsets.data();
+    r.text_cols = text_cols;
+    return r;
+}
+
+ProfileCacheStats ProfileCache::stats() const {
+    ProfileCacheStats s;
+    s.capacity = max_entries;
+    s.entries = entries.size();
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    s.miss_ms = (double)miss_ns / 1e6;
+    s.memory_bytes = entries.capacity() * sizeof(Entry) + slot_by_id.size() * (sizeof(int) + sizeof(uint32_t) + 2 * sizeof(void*))
+                   + view.words.capacity() * sizeof(uint32_t);
+    for (const Entry &e : entries) {
+        s.memory_bytes += (e.clubs.capacity() + e.friends.capacity()) * sizeof(uint32_t)
+                        + e.tokens.capacity() * sizeof(TokenCount) + e.token_offsets.capacity() * sizeof(uint64_t);
+    }
+    return s;
+}
+
+void ProfileCache::reset_stats() {
+    hits = misses = evictions = miss_ns = 0;
+}
@@ -0,0 +1,129 @@
+#include "profile_store.h"
+#include "user_profile.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void ProfileStore::clear() {
+    open_col = 0;
+    ids.clear();
+    public_flags.clear();
+    completions.clear();
+    genders.clear();
+    ages.clear();
+    regions.clear();
+    club_offsets.assign(1, 0);
+    club_ids.clear();
+    friend_offsets.assign(1, 0);
+    friend_ids.clear();
+    token_offsets.assign(1, 0);
+    token_counts.clear();
+    index_by_id.clear();
+}
+
+void ProfileStore::reserve(size_t users) {
+    ids.reserve(users);
+    public_flags.reserve(users);
+    completions.reserve(users);
+    genders.reserve(users);
+    ages.reserve(users);
+    regions.reserve(users);
+    club_offsets.reserve(users + 1);
+    friend_offsets.reserve(users + 1);
+    token_offsets.reserve(users * text_cols + 1);
+}
+
+int ProfileStore::begin_user(int user_id, int public_flag, int completion_percentage, int gender, int age,
+                             const array<int,3>& region_parts)
+{
+    int i = (int)ids.size();
+    ids.push_back(user_id);
+    public_flags.push_back(public_flag);
+    completions.push_back(completion_percentage);
+    genders.push_back(gender);
+    ages.push_back(age);
+    regions.push_back(region_parts);
+    if (user_id >= 0) {
+        if ((size_t)user_id >= index_by_id.size()) index_by_id.resize((size_t)user_id + 1, -1);
+        index_by_id[user_id] = i;
+    }
+    open_col = 0;
+    return i;
+}
+
+void ProfileStore::add_token(size_t col, int token, int count) {
+    if (col >= text_cols) return;
+    for (; open_col < col; ++open_col) token_offsets.push_back(token_counts.size());
+    token_counts.push_back(TokenCount{ token, count });
+}
+
+void ProfileStore::end_user() {
+    for (; open_col < text_cols; ++open_col) token_offsets.push_back(token_counts.size());
+    sort(club_ids.begin() + (ptrdiff_t)club_offsets.back(), club_ids.end());
+    club_offsets.push_back(club_ids.size());
+    sort(friend_ids.begin() + (ptrdiff_t)friend_offsets.back(), friend_ids.end());
+    friend_offsets.push_back(friend_ids.size());
+    size_t r = token_offsets.size() - 1 - text_cols;
+    for (size_t t = 0; t < text_cols; ++t, ++r) {
+        sort(token_counts.begin() + (ptrdiff_t)token_offsets[r], token_counts.begin() + (ptrdiff_t)token_offsets[r + 1],
+             [](const TokenCount& a, const TokenCount& b) { return a.token < b.token; });
+    }
+}
+
+int ProfileStore::add(const UserProfile& p) {
+    int i = begin_user(p.user_id, p.public_flag, p.completion_percentage, p.gender, p.age, p.region_parts);
+    for (uint32_t c : p.clubs) add_club(c);
+    for (uint32_t f : p.friends) add_friend(f);
+    for (size_t t = 0; t < p.token_cols.size() && t < text_cols; ++t)
+        for (auto &pr : p.token_cols[t]) add_token(t, pr.first, pr.second);
+    end_user();
+    return i;
+}
+
+ProfileView ProfileStore::view() const {
+    ProfileView::Arrays a;
+    a.ids = ids.data();
+    a.public_flags = public_flags.data();
+    a.completions = completions.data();
+    a.genders = genders.data();
+    a.ages = ages.data();
+    a.regions = regions.data();
+    a.club_offsets = club_offsets.data();
+    a.club_ids = club_ids.data();
+    a.friend_offsets = friend_offsets.data();
+    a.friend_ids = friend_ids.data();
+    a.token_offsets = token_offsets.data();
+    a.token_counts = token_counts.data();
+    a.index_by_id = index_by_id.data();
+    a.index_size = index_by_id.size();
+    return ProfileView(a, ids.size(), text_cols);
+}
+
+UserProfile ProfileStore::profile(int i) const {
+    UserProfile p;
+    p.user_id = ids[i];
+    p.public_flag = public_flags[i];
+    p.completion_percentage = completions[i];
+    p.gender = genders[i];
+    p.age = ages[i];
+    p.region_parts = regions[i];
+    ProfileRange<uint32_t> c = clubs(i), f = friends(i);
+    p.clubs.assign(c.begin(), c.end());
+    p.friends.assign(f.begin(), f.end());
+    p.token_cols.resize(text_cols);
+    for (size_t t = 0; t < text_cols; ++t)
+        for (const TokenCount& tc : tokens(i, t)) p.token_cols[t][tc.token] = tc.count;
+    return p;
+}
+
+size_t ProfileStore::memory_bytes() const {
+    size_t fixed = ids.capacity() + public_flags.capacity() + completions.capacity()
+                 + genders.capacity() + ages.capacity();
+    return fixed * sizeof(int)
+         + regions.capacity() * sizeof(array<int,3>)
+         + (club_offsets.capacity() + friend_offsets.capacity() + token_offsets.capacity()) * sizeof(uint64_t)
+         + (club_ids.capacity() + friend_ids.capacity()) * sizeof(uint32_t)
+         + token_counts.capacity() * sizeof(TokenCount)
+         + index_by_id.capacity() * sizeof(int);
+}
@@ -1,5 +1,4 @@
 #include "recommendation_tests.h"
-#include "user_profile.h"
 #include "recommender.h"
 
 #include <random>
@@ -10,8 +9,8 @@
 
 using namespace std;
 
-void print_example_recommendations(const unordered_map<int, UserProfile>& profiles,
-                                   const unordered_map<int, vector<int>>& adj_list,
+void print_example_recommendations(const ProfileStore& profiles,
+                                   const AdjacencyView& adjacency,
                                    Recommender& rec,
                                    const unordered_map<int, string>& club_id_to_name,
                                    const vector<string>& text_columns)
@@ -21,26 +20,32 @@ void print_example_recommendations(const unordered_map<int, UserProfile>& profil
         return;
     }
     int uid = -1;
-    for (auto &kv : profiles) {
-        if (adj_list.find(kv.first) != adj_list.end()) { uid = kv.first; break; }
+    for (int id : profiles.user_ids()) {
+        if (adjacency.degree(id) > 0) { uid = id; break; }
     }
-    if (uid == -1) uid = profiles.begin()->first;
+    if (uid == -1) uid = profiles.user_id(0);
 
     uid = 35967; //set id as an option in this function
 
     cout << "=== Example recommendations for user " << uid << " ===\n";
-    const UserProfile &p = profiles.at(uid);
+    int pi = profiles.index_of(uid);
+    if (pi < 0) {
+        cout << "[example] user " << uid << " not loaded\n";
+        return;
+    }
+    ProfileRange<uint32_t> friends = profiles.friends(pi);
+    ProfileRange<uint32_t> clubs = profiles.clubs(pi);
 
-    cout << "Existing friends (" << p.friends.size() << "): ";
-    for (size_t i = 0; i < p.friends.size() && i < 50; ++i) cout << p.friends[i] << (i+1<p.friends.size() ? "," : "");
+    cout << "Existing friends (" << friends.size() << "): ";
+    for (size_t i = 0; i < friends.size() && i < 50; ++i) cout << friends[i] << (i+1<friends.size() ? "," : "");
     cout << "\n";
 
     cout << "Non-empty properties:\n";
-    if (p.age > 0) cout << "  age=" << p.age << "\n";
-    if (p.gender >= 0) cout << "  gender=" << p.gender << "\n";
-    if (!p.clubs.empty()) {
-        cout << "  clubs (" << p.clubs.size() << "):\n";
-        for (auto cid : p.clubs) {
+    if (profiles.age(pi) > 0) cout << "  age=" << profiles.age(pi) << "\n";
+    if (profiles.gender(pi) >= 0) cout << "  gender=" << profiles.gender(pi) << "\n";
+    if (!clubs.empty()) {
+        cout << "  clubs (" << clubs.size() << "):\n";
+        for (auto cid : clubs) {
             auto it = club_id_to_name.find((int)cid);
             cout << "    " << cid << " : " << (it != club_id_to_name.end() ? it->second : string("<name?>")) << "\n";
         }
@@ -65,8 +70,8 @@ void print_example_recommendations(const unordered_map<int, UserProfile>& profil
     cout << "=== End example ===\n\n";
 }
 
-RecommendTestMetrics run_recommendation_tests_sample(const unordered_map<int, UserProfile>& profiles,
-                                                     const unordered_map<int, vector<int>>& adj_list,
+RecommendTestMetrics run_recommendation_tests_sample(const ProfileStore& profiles,
+                                                     const AdjacencyView& adjacency,
                                                      const unordered_map<int, string>& club_id_to_name,
                                                      Recommender& base_rec,
                                                      const vector<string>& text_columns,
@@ -74,10 +79,9 @@ RecommendTestMetrics run_recommendation_tests_sample(const unordered_map<int, Us
                                                      int topk)
 {
     RecommendTestMetrics metrics;
-    if (profiles.empty() || adj_list.empty()) return metrics;
+    if (profiles.empty() || adjacency.num_edges() == 0) return metrics;
 
-    vector<int> all;
-    for (auto &kv : profiles) all.push_back(kv.first);
+    vector<int> all = profiles.user_ids();
     mt19937 rng(1234567);
     shuffle(all.begin(), all.end(), rng);
 
@@ -97,9 +101,8 @@ RecommendTestMetrics run_recommendation_tests_sample(const unordered_map<int, Us
         c++;
 
         if (taken >= sample_size) break;
-        auto itadj = adj_list.find(uid);
-        if (itadj == adj_list.end()) continue;
-        const auto &friends = itadj->second;
+        NeighborRange friends = adjacency.neighbors(uid);
+        if (friends.empty()) continue;
         if (friends.size() < 4) continue; 
         int hold_k = max(1, (int)friends.size() / 4);
         vector<int> idx(friends.size());
@@ -108,12 +111,11 @@ RecommendTestMetrics run_recommendation_tests_sample(const unordered_map<int, Us
         unordered_set<int> held;
         for (int i = 0; i < hold_k; ++i) held.insert(friends[idx[i]]);
 
-        unordered_map<int, vector<int>> adj_mod = adj_list;
-        vector<int> newf;
+        unordered_map<int, vector<int>> held_out;
+        vector<int> &newf = held_out[uid];
         for (int f : friends) if (held.find(f) == held.end()) newf.push_back(f);
-        adj_mod[uid] = newf;
 
-        Recommender rec(&profiles, &adj_mod);
+        Recommender rec(&profiles, adjacency.with_overrides(&held_out));
         rec.set_field_normalizers(base_rec.field_normalizers);
         rec.set_column_normalizers(base_rec.column_normalizers);
         rec.set_text_columns(text_columns);
@@ -138,9 +140,8 @@ RecommendTestMetrics run_recommendation_tests_sample(const unordered_map<int, Us
         if (hiti) ++hits_interest;
 
         auto club_pred = rec.recommend_clubs_collab(uid, topk, 5000);
-        const UserProfile &up = profiles.at(uid);
         unordered_set<int> actual_clubs;
-        for (auto c : up.clubs) actual_clubs.insert((int)c);
+        for (auto c : profiles.clubs(profiles.index_of(uid))) actual_clubs.insert((int)c);
         if (!actual_clubs.empty()) {
             int hit_club_count = 0;
             for (size_t i = 0; i < club_pred.size() && i < (size_t)topk; ++i) {
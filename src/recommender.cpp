@@ -1,29 +1,55 @@
 #include "recommender.h"
-#include "user_profile.h"
 
 #include <cmath>
 #include <algorithm>
 
 using namespace std;
 
-Recommender::Recommender(const unordered_map<int, UserProfile>* profiles_in,
-                         const unordered_map<int, vector<int>>* al)
+IdfColumn::IdfColumn(vector<IdfEntry> entries) : owned(std::move(entries)) {
+    sort(owned.begin(), owned.end(), [](const IdfEntry& a, const IdfEntry& b) { return a.token < b.token; });
+    n = owned.size();
+}
+
+float IdfColumn::find(int token, float fallback) const {
+    const IdfEntry* it = lower_bound(begin(), end(), token, [](const IdfEntry& e, int t) { return e.token < t; });
+    return (it != end() && it->token == token) ? it->idf : fallback;
+}
+
+Recommender::Recommender(const ProfileStore* profiles_in,
+                         const AdjacencyView& al)
+{
+    if (profiles_in) profiles = profiles_in->view();
+    user_feats = nullptr;
+    adjacency = al;
+    total_users = profiles.size();
+}
+
+Recommender::Recommender(ProfileCache* cache_in,
+                         const AdjacencyView& al)
 {
-    profiles = profiles_in;
+    cache = cache_in;
     user_feats = nullptr;
-    adj_list = al;
-    total_users = profiles ? profiles->size() : 0;
+    adjacency = al;
+    total_users = cache ? cache->num_users() : 0;
 }
 
 Recommender::Recommender(const unordered_map<int, unordered_map<int,float>>* user_feats_in,
-                         const unordered_map<int, vector<int>>* al)
+                         const AdjacencyView& al)
 {
     user_feats = user_feats_in;
-    profiles = nullptr;
-    adj_list = al;
+    adjacency = al;
     total_users = user_feats ? user_feats->size() : 0;
 }
 
+bool Recommender::find_profile(int user_id, ProfileHandle& out) const {
+    if (cache) return cache->get(user_id, out);
+    out.release();
+    int i = profiles.index_of(user_id);
+    if (i < 0) return false;
+    out = ProfileHandle(profiles.ref(i));
+    return true;
+}
+
 void Recommender::set_field_normalizers(const unordered_map<string, pair<float,float>>& m) {
     field_normalizers = m;
 }
@@ -37,78 +63,98 @@ void Recommender::set_text_columns(const vector<string>& cols) {
 }
 
 void Recommender::set_tfidf_index(const unordered_map<string, unordered_map<int,float>>& idf_map) {
+    idf_per_col.clear();
+    for (auto &kv : idf_map) {
+        vector<IdfEntry> entries;
+        entries.reserve(kv.second.size());
+        for (auto &pr : kv.second) entries.push_back(IdfEntry{ pr.first, pr.second });
+        idf_per_col[kv.first] = IdfColumn(std::move(entries));
+    }
+}
+
+void Recommender::set_tfidf_index(const unordered_map<string, IdfColumn>& idf_map) {
     idf_per_col = idf_map;
 }
 
 void Recommender::compute_idf_from_profiles(const vector<string>& text_columns)
 {
     idf_per_col.clear();
-    if (!profiles) return;
-    total_users = profiles->size();
-    for (size_t t = 0; t < text_columns.size(); ++t) {
-        unordered_map<int,int> df;
-        for (auto &kv : *profiles) {
-            const UserProfile &p = kv.second;
-            if (t < p.token_cols.size()) {
-                const auto &mp = p.token_cols[t];
-                for (auto &pr : mp) {
-                    df[pr.first] += 1;
+    if (!has_profiles()) return;
+    auto set_idf = [&](size_t t, const unordered_map<int,int>& df) {
+        vector<IdfEntry> entries;
+        entries.reserve(df.size());
+        for (auto &pr : df) {
+            float idf = logf(1.0f + (float)total_users / (1.0f + (float)pr.second));
+            entries.push_back(IdfEntry{ pr.first, idf });
+        }
+        idf_per_col[text_columns[t]] = IdfColumn(std::move(entries));
+    };
+    if (!profiles.empty()) {
+        total_users = profiles.size();
+        for (size_t t = 0; t < text_columns.size(); ++t) {
+            unordered_map<int,int> df;
+            for (int i = 0; i < (int)profiles.size(); ++i) {
+                for (const TokenCount &tc : profiles.tokens(i, t)) {
+                    df[tc.token] += 1;
                 }
             }
+            set_idf(t, df);
         }
-        unordered_map<int,float> idfmap;
-        for (auto &pr : df) {
-            float idf = logf(1.0f + (float)total_users / (1.0f + (float)pr.second));
-            idfmap[pr.first] = idf;
+        return;
+    }
+    // one pass over the records, past the cache
+    const UserRecordReader &records = cache->records();
+    RecordMask mask = RecordMask::fixed_only();
+    for (size_t t = 0; t < text_columns.size(); ++t) mask.add_tokens(t);
+    vector<unordered_map<int,int>> dfs(text_columns.size());
+    UserRecordView rec;
+    total_users = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (!records.read_at(i, rec, mask) || rec.user_id == 0) continue;
+        ++total_users;
+        for (size_t t = 0; t < text_columns.size() && t < rec.token_cols.size(); ++t) {
+            const TokenPairSpan &col = rec.token_cols[t];
+            for (size_t k = 0; k < col.size; ++k) dfs[t][(int)col.token(k)] += 1;
         }
-        idf_per_col[text_columns[t]] = std::move(idfmap);
     }
+    for (size_t t = 0; t < text_columns.size(); ++t) set_idf(t, dfs[t]);
 }
 
-float Recommender::tfidf_cosine_for_column(const unordered_map<int,int>& A,
-                                           const unordered_map<int,int>& B,
-                                           const unordered_map<int,float>& idf_map) const
+// Token rows are sorted by token, so each product is a single merge; tokens
+// without an idf weigh 1. The merge visits tokens in ascending order, so
+// each idf lookup only searches past the previous one.
+float Recommender::tfidf_cosine_for_column(ProfileRange<TokenCount> A,
+                                           ProfileRange<TokenCount> B,
+                                           const IdfColumn& idf) const
 {
     if (A.empty() || B.empty()) return 0.0f;
+    const IdfEntry* cur = idf.begin();
+    const IdfEntry* idf_end = idf.end();
+    auto idf_of = [&](int token)->double {
+        cur = lower_bound(cur, idf_end, token, [](const IdfEntry& e, int t) { return e.token < t; });
+        return (cur != idf_end && cur->token == token) ? cur->idf : 1.0f;
+    };
     double dot = 0.0;
     double na = 0.0, nb = 0.0;
-    if (A.size() < B.size()) {
-        for (auto &pa : A) {
-            int token = pa.first;
-            double idf = (idf_map.count(token) ? idf_map.at(token) : 1.0f);
-            double wA = (double)pa.second * idf;
+    size_t i = 0, j = 0;
+    while (i < A.size() || j < B.size()) {
+        if (j == B.size() || (i < A.size() && A[i].token < B[j].token)) {
+            double wA = (double)A[i].count * idf_of(A[i].token);
             na += wA * wA;
-            auto it = B.find(token);
-            if (it != B.end()) {
-                double idf_b = (idf_map.count(token) ? idf_map.at(token) : 1.0f);
-                double wB = (double)it->second * idf_b;
-                dot += wA * wB;
-            }
-        }
-        for (auto &pb : B) {
-            int token = pb.first;
-            double idf = (idf_map.count(token) ? idf_map.at(token) : 1.0f);
-            double wB = (double)pb.second * idf;
+            ++i;
+        } else if (i == A.size() || B[j].token < A[i].token) {
+            double wB = (double)B[j].count * idf_of(B[j].token);
             nb += wB * wB;
-        }
-    } else {
-        for (auto &pb : B) {
-            int token = pb.first;
-            double idf = (idf_map.count(token) ? idf_map.at(token) : 1.0f);
-            double wB = (double)pb.second * idf;
-            nb += wB * wB;
-            auto it = A.find(token);
-            if (it != A.end()) {
-                double idf_a = (idf_map.count(token) ? idf_map.at(token) : 1.0f);
-                double wA = (double)it->second * idf_a;
-                dot += wA * wB;
-            }
-        }
-        for (auto &pa : A) {
-            int token = pa.first;
-            double idf = (idf_map.count(token) ? idf_map.at(token) : 1.0f);
-            double wA = (double)pa.second * idf;
+            ++j;
+        } else {
+            double idf = idf_of(A[i].token);
+            double wA = (double)A[i].count * idf;
+            double wB = (double)B[j].count * idf;
             na += wA * wA;
+            nb += wB * wB;
+            dot += wA * wB;
+            ++i;
+            ++j;
         }
     }
     double denom = sqrt(na) * sqrt(nb);
@@ -116,12 +162,14 @@ float Recommender::tfidf_cosine_for_column(const unordered_map<int,int>& A,
     return (float)(dot / denom);
 }
 
-float Recommender::vec_set_similarity(const vector<uint32_t>& A, const vector<uint32_t>& B) {
+float Recommender::vec_set_similarity(ProfileRange<uint32_t> A, ProfileRange<uint32_t> B) {
     if (A.empty() || B.empty()) return 0.0f;
-    unordered_map<uint32_t,int> cnt;
-    for (auto v : A) cnt[v] = 1;
     int inter = 0;
-    for (auto v : B) if (cnt.find(v) != cnt.end()) ++inter;
+    size_t i = 0;
+    for (auto v : B) {
+        while (i < A.size() && A[i] < v) ++i;
+        if (i < A.size() && A[i] == v) ++inter;
+    }
     double denom = sqrt((double)A.size()) * sqrt((double)B.size());
     if (denom <= 0.0) return 0.0f;
     return (float)((double)inter / denom);
@@ -138,24 +186,19 @@ float Recommender::region_similarity_local(const array<int,3>& A, const array<in
     return (float)((double)matches / (sqrt((double)a_cnt) * sqrt((double)b_cnt)));
 }
 
-float Recommender::cosine_counts_maps_local(const unordered_map<int,int>& A, const unordered_map<int,int>& B) {
+float Recommender::cosine_counts_local(ProfileRange<TokenCount> A, ProfileRange<TokenCount> B) {
     if (A.empty() || B.empty()) return 0.0f;
     double dot = 0.0;
     double suma2 = 0.0;
     double sumb2 = 0.0;
-    for (auto &pa : A) suma2 += (double)pa.second * pa.second;
-    for (auto &pb : B) sumb2 += (double)pb.second * pb.second;
+    for (auto &pa : A) suma2 += (double)pa.count * pa.count;
+    for (auto &pb : B) sumb2 += (double)pb.count * pb.count;
     if (suma2 <= 0.0 || sumb2 <= 0.0) return 0.0f;
-    if (A.size() < B.size()) {
-        for (auto it = A.begin(); it != A.end(); ++it) {
-            auto jt = B.find(it->first);
-            if (jt != B.end()) dot += (double) it->second * jt->second;
-        }
-    } else {
-        for (auto it = B.begin(); it != B.end(); ++it) {
-            auto jt = A.find(it->first);
-            if (jt != A.end()) dot += (double) it->second * jt->second;
-        }
+    size_t i = 0, j = 0;
+    while (i < A.size() && j < B.size()) {
+        if (A[i].token < B[j].token) ++i;
+        else if (B[j].token < A[i].token) ++j;
+        else { dot += (double)A[i].count * B[j].count; ++i; ++j; }
     }
     double norm = sqrt(suma2) * sqrt(sumb2);
     if (norm <= 0.0) return 0.0f;
@@ -1,5 +1,4 @@
 #include "recommender.h"
-#include "user_profile.h"
 
 #include <unordered_set>
 #include <algorithm>
@@ -10,53 +9,47 @@ using namespace std;
 vector<pair<int,float>> Recommender::recommend_clubs_collab(int user, int topk, int candidate_limit) const
 {
     vector<pair<int,float>> out;
-    if (!profiles || !adj_list) return out;
+    if (!has_profiles()) return out;
 
-    auto itq = profiles->find(user);
-    if (itq == profiles->end()) return out;
-    const UserProfile &q = itq->second;
+    ProfileHandle q;
+    if (!find_profile(user, q)) return out;
 
-    vector<int> friends;
-    auto itf = adj_list->find(user);
-    if (itf != adj_list->end()) friends = itf->second;
+    NeighborRange friends = adjacency.neighbors(user);
 
     unordered_map<int,float> sim_u_f;
+    ProfileHandle hf, hfof;
     for (int f : friends) {
-        auto itpf = profiles->find(f);
-        if (itpf == profiles->end()) continue;
-        sim_u_f[f] = profile_similarity(q, itpf->second);
+        if (!find_profile(f, hf)) continue;
+        sim_u_f[f] = profile_similarity(q.ref(), hf.ref(), text_columns_internal);
     }
 
     unordered_map<int,double> club_scores;
     unordered_set<int> user_clubs;
-    for (auto c : q.clubs) user_clubs.insert((int)c);
+    for (auto c : q->clubs) user_clubs.insert((int)c);
 
     for (int f : friends) {
-        auto itpf = profiles->find(f);
-        if (itpf == profiles->end()) continue;
         double w = (sim_u_f.count(f) ? sim_u_f.at(f) : 0.0);
         if (w <= 0.0) continue;
-        for (auto cid : itpf->second.clubs) {
+        if (!find_profile(f, hf)) continue;
+        for (auto cid : hf->clubs) {
             if (user_clubs.find((int)cid) != user_clubs.end()) continue;
             club_scores[(int)cid] += w;
         }
     }
 
     for (int f : friends) {
-        auto itff = adj_list->find(f);
-        if (itff == adj_list->end()) continue;
-        auto itpf = profiles->find(f);
-        if (itpf == profiles->end()) continue;
+        NeighborRange fofs = adjacency.neighbors(f);
+        if (fofs.empty()) continue;
         double wuf = (sim_u_f.count(f) ? sim_u_f.at(f) : 0.0);
         if (wuf <= 0.0) continue;
-        for (int fof : itff->second) {
+        if (!find_profile(f, hf)) continue;
+        for (int fof : fofs) {
             if (fof == user) continue;
-            auto itpfof = profiles->find(fof);
-            if (itpfof == profiles->end()) continue;
-            double s_f_fof = profile_similarity(itpf->second, itpfof->second);
+            if (!find_profile(fof, hfof)) continue;
+            double s_f_fof = profile_similarity(hf.ref(), hfof.ref(), text_columns_internal);
             if (s_f_fof <= 0.0) continue;
             double contrib = wuf * s_f_fof;
-            for (auto cid : itpfof->second.clubs) {
+            for (auto cid : hfof->clubs) {
                 if (user_clubs.find((int)cid) != user_clubs.end()) continue;
                 club_scores[(int)cid] += contrib;
             }
@@ -75,7 +68,6 @@ vector<pair<int,float>> Recommender::recommend_clubs_collab(int user, int topk,
 vector<pair<int,float>> Recommender::recommend_from_supernodes(int user, const unordered_map<int, unordered_map<int,float>>& super_feats, int topk) const
 {
     vector<pair<int,float>> out;
-    if (!adj_list) return out;
 
     if (user_feats) {
         auto itq = user_feats->find(user);
@@ -101,24 +93,21 @@ vector<pair<int,float>> Recommender::recommend_from_supernodes(int user, const u
             out.emplace_back(sid, (float)dot);
         }
     } else {
-        if (!profiles) return out;
-        auto itq = profiles->find(user);
-        if (itq == profiles->end()) return out;
+        if (!has_profiles()) return out;
+        ProfileHandle q;
+        if (!find_profile(user, q)) return out;
         unordered_map<int,float> qvec;
         if (!idf_per_col.empty()) {
             for (auto &kv : idf_per_col) {
                 const string &colname = kv.first;
-                const auto &idfmap = kv.second;
+                const IdfColumn &idf = kv.second;
                 int col_idx = -1;
                 for (size_t i = 0; i < text_columns_internal.size(); ++i) if (text_columns_internal[i] == colname) { col_idx = (int)i; break; }
                 if (col_idx < 0) continue;
-                const UserProfile &p = itq->second;
-                if (col_idx >= (int)p.token_cols.size()) continue;
-                for (auto &pr : p.token_cols[col_idx]) {
-                    int token = pr.first;
-                    float tf = (float)pr.second;
-                    float idf = (idfmap.count(token) ? idfmap.at(token) : 1.0f);
-                    qvec[token] += tf * idf;
+                for (const TokenCount &tc : q->tokens((size_t)col_idx)) {
+                    int token = tc.token;
+                    float tf = (float)tc.count;
+                    qvec[token] += tf * idf.find(token, 1.0f);
                 }
             }
         }
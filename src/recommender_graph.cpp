@@ -1,5 +1,4 @@
 #include "recommender.h"
-#include "user_profile.h"
 
 #include <unordered_set>
 #include <algorithm>
@@ -7,20 +6,16 @@
 
 using namespace std;
 
-static void gather_candidates_local(const unordered_map<int, vector<int>>* adj_list, int user, vector<int>& out, int candidate_limit) {
+static void gather_candidates_local(const AdjacencyView& adjacency, int user, vector<int>& out, int candidate_limit) {
     out.clear();
-    if (!adj_list) return;
-    auto it = adj_list->find(user);
-    if (it == adj_list->end()) return;
-    const vector<int>& friends = it->second;
+    NeighborRange friends = adjacency.neighbors(user);
+    if (friends.empty()) return;
     unordered_set<int> seen;
     for (int f : friends) {
         if (f == user) continue;
         if (seen.insert(f).second) out.push_back(f);
         if ((int)out.size() >= candidate_limit) return;
-        auto it2 = adj_list->find(f);
-        if (it2 == adj_list->end()) continue;
-        for (int ff : it2->second) {
+        for (int ff : adjacency.neighbors(f)) {
             if (ff == user) continue;
             if (seen.insert(ff).second) {
                 out.push_back(ff);
@@ -33,26 +28,24 @@ static void gather_candidates_local(const unordered_map<int, vector<int>>* adj_l
 vector<pair<int,float>> Recommender::recommend_graph_registration(int user, int topk, int candidate_limit) const
 {
     vector<pair<int,float>> out;
-    if ((!profiles && !user_feats) || !adj_list) return out;
+    if (!has_profiles() && !user_feats) return out;
 
-    if (profiles) {
-        auto itq = profiles->find(user);
-        if (itq == profiles->end()) return out;
-        const UserProfile &q = itq->second;
+    if (has_profiles()) {
+        ProfileHandle q;
+        if (!find_profile(user, q)) return out;
 
         vector<int> candidates;
-        gather_candidates_local(adj_list, user, candidates, candidate_limit);
+        gather_candidates_local(adjacency, user, candidates, candidate_limit);
 
         unordered_set<int> existing;
-        auto itne = adj_list->find(user);
-        if (itne != adj_list->end()) for (int v : itne->second) existing.insert(v);
+        for (int v : adjacency.neighbors(user)) existing.insert(v);
         existing.insert(user);
 
+        ProfileHandle hc;
         for (int c : candidates) {
             if (existing.find(c) != existing.end()) continue;
-            auto itc = profiles->find(c);
-            if (itc == profiles->end()) continue;
-            float s = profile_similarity(q, itc->second);
+            if (!find_profile(c, hc)) continue;
+            float s = profile_similarity(q.ref(), hc.ref(), text_columns_internal);
             out.emplace_back(c, s);
         }
     } else {
@@ -60,10 +53,9 @@ vector<pair<int,float>> Recommender::recommend_graph_registration(int user, int
         if (itq == user_feats->end()) return out;
         const auto &qvec = itq->second;
         vector<int> candidates;
-        gather_candidates_local(adj_list, user, candidates, candidate_limit);
+        gather_candidates_local(adjacency, user, candidates, candidate_limit);
         unordered_set<int> existing;
-        auto itne = adj_list->find(user);
-        if (itne != adj_list->end()) for (int v : itne->second) existing.insert(v);
+        for (int v : adjacency.neighbors(user)) existing.insert(v);
         existing.insert(user);
         for (int c : candidates) {
             if (existing.find(c) != existing.end()) continue;
@@ -105,18 +97,14 @@ vector<pair<int,float>> Recommender::recommend_graph_registration(int user, int
 vector<pair<int,float>> Recommender::recommend_collaborative(int user, int topk, int candidate_limit) const
 {
     vector<pair<int,float>> out;
-    if ((!profiles && !user_feats) || !adj_list) return out;
+    if (!has_profiles() && !user_feats) return out;
 
-    vector<int> friends;
-    auto itf = adj_list->find(user);
-    if (itf != adj_list->end()) friends = itf->second;
+    NeighborRange friends = adjacency.neighbors(user);
 
     vector<int> candidates;
     unordered_set<int> candidate_set;
     for (int f : friends) {
-        auto itff = adj_list->find(f);
-        if (itff == adj_list->end()) continue;
-        for (int fof : itff->second) {
+        for (int fof : adjacency.neighbors(f)) {
             if (fof == user) continue;
             if (candidate_set.insert(fof).second) candidates.push_back(fof);
             if ((int)candidates.size() >= candidate_limit) break;
@@ -125,14 +113,12 @@ vector<pair<int,float>> Recommender::recommend_collaborative(int user, int topk,
     }
 
     unordered_map<int,float> sim_u_f;
-    if (profiles) {
-        auto itq = profiles->find(user);
-        if (itq == profiles->end()) return out;
-        const UserProfile &q = itq->second;
+    if (has_profiles()) {
+        ProfileHandle q, hf;
+        if (!find_profile(user, q)) return out;
         for (int f : friends) {
-            auto itpf = profiles->find(f);
-            if (itpf == profiles->end()) continue;
-            sim_u_f[f] = profile_similarity(q, itpf->second);
+            if (!find_profile(f, hf)) continue;
+            sim_u_f[f] = profile_similarity(q.ref(), hf.ref(), text_columns_internal);
         }
     } else {
         auto itq = user_feats->find(user);
@@ -164,18 +150,17 @@ vector<pair<int,float>> Recommender::recommend_collaborative(int user, int topk,
         }
     }
 
+    ProfileHandle hc, hf;
     for (int cand : candidates) {
         if (cand == user) continue;
         double score = 0.0;
-        if (profiles) {
-            auto itpc = profiles->find(cand);
-            if (itpc == profiles->end()) continue;
+        if (has_profiles()) {
+            if (!find_profile(cand, hc)) continue;
             for (int f : friends) {
                 auto itsim = sim_u_f.find(f);
                 if (itsim == sim_u_f.end()) continue;
-                auto itpf = profiles->find(f);
-                if (itpf == profiles->end()) continue;
-                double s_f_fof = profile_similarity(itpf->second, itpc->second);
+                if (!find_profile(f, hf)) continue;
+                double s_f_fof = profile_similarity(hf.ref(), hc.ref(), text_columns_internal);
                 score += (double)itsim->second * s_f_fof;
             }
         } else {
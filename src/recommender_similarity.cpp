@@ -1,5 +1,4 @@
 #include "recommender.h"
-#include "user_profile.h"
 
 #include <cmath>
 #include <unordered_map>
@@ -7,7 +6,7 @@
 
 using namespace std;
 
-float Recommender::profile_similarity(const UserProfile &A, const UserProfile &B, const vector<string> &text_columns) const
+float Recommender::profile_similarity(const ProfileRef& a, const ProfileRef& b, const vector<string> &text_columns) const
 {
     const int NUM_FIXED = 7;
     int total_possible = NUM_FIXED + (int)text_columns.size();
@@ -35,72 +34,75 @@ float Recommender::profile_similarity(const UserProfile &A, const UserProfile &B
         return 6.0 * (s - 0.5);
     };
 
-    if (A.public_flag >= 0 && B.public_flag >= 0) {
-        double s_pub = (A.public_flag == B.public_flag) ? 1.0 : 0.0;
+    if (a.public_flag >= 0 && b.public_flag >= 0) {
+        double s_pub = (a.public_flag == b.public_flag) ? 1.0 : 0.0;
         double z = compute_z("public", s_pub);
         sum_Si += sigmoid(z);
         ++used;
     }
 
-    if (A.gender >= 0 && B.gender >= 0) {
-        double s_gen = (A.gender == B.gender) ? 1.0 : 0.0;
+    if (a.gender >= 0 && b.gender >= 0) {
+        double s_gen = (a.gender == b.gender) ? 1.0 : 0.0;
         double z = compute_z("gender", s_gen);
         sum_Si += sigmoid(z);
         ++used;
     }
 
-    if (A.completion_percentage > 0 && B.completion_percentage > 0) {
-        int amin = min(A.completion_percentage, B.completion_percentage);
-        int amax = max(A.completion_percentage, B.completion_percentage);
+    if (a.completion_percentage > 0 && b.completion_percentage > 0) {
+        int amin = min(a.completion_percentage, b.completion_percentage);
+        int amax = max(a.completion_percentage, b.completion_percentage);
         double s_comp = (amax > 0) ? ((double)amin / (double)amax) : 0.0;
         double z = compute_z("completion", s_comp);
         sum_Si += sigmoid(z);
         ++used;
     }
 
-    if (A.age > 0 && B.age > 0) {
-        int amin = min(A.age, B.age);
-        int amax = max(A.age, B.age);
+    if (a.age > 0 && b.age > 0) {
+        int amin = min(a.age, b.age);
+        int amax = max(a.age, b.age);
         double s_age = (amax > 0) ? ((double)amin / (double)amax) : 0.0;
         double z = compute_z("age", s_age);
         sum_Si += sigmoid(z);
         ++used;
     }
 
-    bool nonemptyA = (A.region_parts[0] >= 0 || A.region_parts[1] >= 0 || A.region_parts[2] >= 0);
-    bool nonemptyB = (B.region_parts[0] >= 0 || B.region_parts[1] >= 0 || B.region_parts[2] >= 0);
+    const array<int,3> &regA = a.region_parts;
+    const array<int,3> &regB = b.region_parts;
+    bool nonemptyA = (regA[0] >= 0 || regA[1] >= 0 || regA[2] >= 0);
+    bool nonemptyB = (regB[0] >= 0 || regB[1] >= 0 || regB[2] >= 0);
     if (nonemptyA && nonemptyB) {
-        double s_reg = region_similarity_local(A.region_parts, B.region_parts);
+        double s_reg = region_similarity_local(regA, regB);
         double z = compute_z("region", s_reg);
         sum_Si += sigmoid(z);
         ++used;
     }
 
-    if (!A.clubs.empty() && !B.clubs.empty()) {
-        double s_clubs = vec_set_similarity(A.clubs, B.clubs);
+    ProfileRange<uint32_t> clubsA = a.clubs, clubsB = b.clubs;
+    if (!clubsA.empty() && !clubsB.empty()) {
+        double s_clubs = vec_set_similarity(clubsA, clubsB);
         double z = compute_z("clubs", s_clubs);
         sum_Si += sigmoid(z);
         ++used;
     }
 
-    if (!A.friends.empty() && !B.friends.empty()) {
-        double s_friends = vec_set_similarity(A.friends, B.friends);
+    ProfileRange<uint32_t> friendsA = a.friends, friendsB = b.friends;
+    if (!friendsA.empty() && !friendsB.empty()) {
+        double s_friends = vec_set_similarity(friendsA, friendsB);
         double z = compute_z("friends", s_friends);
         sum_Si += sigmoid(z);
         ++used;
     }
 
     for (size_t t = 0; t < text_columns.size(); ++t) {
-        bool ta = (t < A.token_cols.size() && !A.token_cols[t].empty());
-        bool tb = (t < B.token_cols.size() && !B.token_cols[t].empty());
-        if (!ta || !tb) continue;
+        ProfileRange<TokenCount> ta = a.tokens(t), tb = b.tokens(t);
+        if (ta.empty() || tb.empty()) continue;
         const string &colname = text_columns[t];
         double s_text = 0.0;
         auto itidf = idf_per_col.find(colname);
         if (itidf != idf_per_col.end()) {
-            s_text = tfidf_cosine_for_column(A.token_cols[t], B.token_cols[t], itidf->second);
+            s_text = tfidf_cosine_for_column(ta, tb, itidf->second);
         } else {
-            s_text = cosine_counts_maps_local(A.token_cols[t], B.token_cols[t]);
+            s_text = cosine_counts_local(ta, tb);
         }
         auto itcol = column_normalizers.find(colname);
         double z;
@@ -123,6 +125,12 @@ float Recommender::profile_similarity(const UserProfile &A, const UserProfile &B
     return (float)fas;
 }
 
-float Recommender::profile_similarity(const UserProfile &A, const UserProfile &B) const {
-    return profile_similarity(A, B, text_columns_internal);
+float Recommender::profile_similarity(int a, int b, const vector<string> &text_columns) const {
+    // indices need loaded profiles; a cache is only looked up by user id
+    if (a < 0 || b < 0 || (size_t)a >= profiles.size() || (size_t)b >= profiles.size()) return 0.0f;
+    return profile_similarity(profiles.ref(a), profiles.ref(b), text_columns);
+}
+
+float Recommender::profile_similarity(int a, int b) const {
+    return profile_similarity(a, b, text_columns_internal);
 }
@@ -0,0 +1,130 @@
+#include "run_report.h"
+#include <fstream>
+#include <filesystem>
+#include <cstdio>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+static const int RUN_REPORT_VERSION = 1;
+
+#ifdef _WIN32
+double process_cpu_seconds() {
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+    auto ticks = [](const FILETIME& ft) { return ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime; };
+    return (double)(ticks(kernel) + ticks(user)) / 1e7;  // 100 ns ticks
+}
+
+uint64_t peak_rss_kb() {
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return (uint64_t)pmc.PeakWorkingSetSize / 1024;
+}
+#else
+double process_cpu_seconds() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+uint64_t peak_rss_kb() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return (uint64_t)ru.ru_maxrss / 1024;  // bytes on macOS
+#else
+    return (uint64_t)ru.ru_maxrss;  // kilobytes on Linux
+#endif
+}
+#endif
+
+uint64_t file_bytes(const string& path) {
+    error_code ec;
+    uint64_t size = (uint64_t)filesystem::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+void RunReport::add(const StageMetrics& metrics) {
+    lock_guard<mutex> lk(m);
+    entries.push_back(metrics);
+}
+
+vector<StageMetrics> RunReport::stages() const {
+    lock_guard<mutex> lk(m);
+    return entries;
+}
+
+static string json_string(const string& s) {
+    string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') { out.push_back('\\'); out.push_back((char)c); }
+        else if (c < 0x20) { char buf[8]; snprintf(buf, sizeof(buf), "\\u%04x", c); out += buf; }
+        else out.push_back((char)c);
+    }
+    return out + "\"";
+}
+
+static string json_number(double v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.6f", v);
+    return buf;
+}
+
+bool RunReport::write_json(const string& path) const {
+    vector<StageMetrics> all = stages();
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    ofstream out(path);
+    if (!out.is_open()) return false;
+    out << "{\n"
+        << "  \"version\": " << RUN_REPORT_VERSION << ",\n"
+        << "  \"started\": " << (long long)started << ",\n"
+        << "  \"wall_s\": " << json_number(wall) << ",\n"
+        << "  \"cpu_s\": " << json_number(process_cpu_seconds()) << ",\n"
+        << "  \"peak_rss_kb\": " << peak_rss_kb() << ",\n"
+        << "  \"stages\": [";
+    for (size_t i = 0; i < all.size(); ++i) {
+        const StageMetrics &s = all[i];
+        out << (i ? ",\n" : "\n")
+            << "    {\"name\": " << json_string(s.name)
+            << ", \"status\": " << json_string(s.status)
+            << ", \"wall_s\": " << json_number(s.wall_s)
+            << ", \"cpu_s\": " << json_number(s.cpu_s)
+            << ", \"rows\": " << s.rows
+            << ", \"bytes\": " << s.bytes
+            << ", \"rows_per_s\": " << json_number(s.rows_per_s())
+            << ", \"bytes_per_s\": " << json_number(s.bytes_per_s())
+            << ", \"peak_rss_kb\": " << s.peak_rss_kb << "}";
+    }
+    out << (all.empty() ? "]\n" : "\n  ]\n") << "}\n";
+    return (bool)out;
+}
+
+void RunReport::print(ostream& log, const string& tag) const {
+    for (const StageMetrics &s : stages()) {
+        char line[256];
+        snprintf(line, sizeof(line), "%-20s %-6s wall %8.3fs cpu %8.3fs rows %10llu (%.0f/s) %.1f MB/s rss %llu MB",
+                 s.name.c_str(), s.status.c_str(), s.wall_s, s.cpu_s, (unsigned long long)s.rows, s.rows_per_s(),
+                 s.bytes_per_s() / 1e6, (unsigned long long)(s.peak_rss_kb / 1024));
+        log << "[" << tag << "] " << line << "\n";
+    }
+}
+
+StageTimer::StageTimer(RunReport* report, const string& name)
+    : report(report), start(chrono::steady_clock::now()), cpu_start(process_cpu_seconds()) {
+    metrics.name = name;
+}
+
+void StageTimer::finish() {
+    if (done) return;
+    done = true;
+    metrics.wall_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    metrics.cpu_s = process_cpu_seconds() - cpu_start;
+    metrics.peak_rss_kb = peak_rss_kb();
+    if (report) report->add(metrics);
+}
@@ -1,10 +1,12 @@
 #include "serializer.h"
+#include "varint.h"
 #include <fstream>
 #include <sstream>
 #include <vector>
 #include <cstdint>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 
 using namespace std;
 
@@ -53,13 +55,180 @@ static vector<pair<uint32_t,uint32_t>> parse_pairs(const string& s)
     return out;
 }
 
+void append_users_bin_header(string& out)
+{
+    const uint32_t version = USERS_BIN_VERSION;
+    char b[sizeof(uint32_t)];
+    memcpy(b, &version, sizeof(version));
+    out.append(USERS_BIN_MAGIC, 4);
+    out.append(b, sizeof(b));
+}
+
+// Ids ascending: the first as is, the rest as the gap to the one before.
+static void put_sorted_ids(string& out, const vector<uint32_t>& ids)
+{
+    put_varint(out, ids.size());
+    uint32_t prev = 0;
+    for (uint32_t v : ids) {
+        put_varint(out, v - prev);
+        prev = v;
+    }
+}
+
+static void put_token_column(string& out, const vector<pair<uint32_t,uint32_t>>& col)
+{
+    put_varint(out, col.size());
+    uint32_t prev = 0;
+    for (const auto &pr : col) {
+        put_varint(out, pr.first - prev);
+        prev = pr.first;
+    }
+    for (const auto &pr : col) put_varint(out, pr.second);
+}
+
+void append_user_record(string& out, const UserRecord& rec)
+{
+    put_varint(out, rec.user_id);
+    put_varint(out, (uint32_t)(rec.ispublic + 1));
+    put_varint(out, (uint32_t)(rec.completion_percentage + 1));
+    put_varint(out, (uint32_t)(rec.gender + 1));
+    put_varint(out, rec.region.size());
+    for (uint32_t v : rec.region) put_varint(out, (uint32_t)(v + 1));
+    put_varint(out, rec.age);
+
+    // The sections are written first and their lengths put in front of them.
+    const size_t body = out.size();
+    vector<size_t> ends;
+    ends.reserve(rec.token_cols.size() + 1);
+    // an empty section has no body
+    if (is_sorted(rec.clubs.begin(), rec.clubs.end())) {
+        if (!rec.clubs.empty()) put_sorted_ids(out, rec.clubs);
+    } else {
+        vector<uint32_t> clubs = rec.clubs;
+        sort(clubs.begin(), clubs.end());
+        put_sorted_ids(out, clubs);
+    }
+    ends.push_back(out.size());
+    for (const auto &col : rec.token_cols) {
+        if (is_sorted(col.begin(), col.end())) {
+            if (!col.empty()) put_token_column(out, col);
+        } else {
+            vector<pair<uint32_t,uint32_t>> sorted_col = col;
+            sort(sorted_col.begin(), sorted_col.end());
+            put_token_column(out, sorted_col);
+        }
+        ends.push_back(out.size());
+    }
+    string lengths;
+    put_varint(lengths, ends.size());
+    size_t begin = body;
+    for (size_t e : ends) {
+        put_varint(lengths, e - begin);
+        begin = e;
+    }
+    out.insert(body, lengths);
+}
+
+static void append_u32(string& out, uint32_t v)
+{
+    char b[sizeof(v)];
+    memcpy(b, &v, sizeof(v));
+    out.append(b, sizeof(b));
+}
+
+static void append_u64(string& out, uint64_t v)
+{
+    char b[sizeof(v)];
+    memcpy(b, &v, sizeof(v));
+    out.append(b, sizeof(b));
+}
+
+static void append_users_idx_header(string& out, uint32_t layout, uint64_t count, uint64_t table_size)
+{
+    out.append(USERS_IDX_MAGIC, 4);
+    append_u32(out, USERS_IDX_VERSION);
+    append_u32(out, layout);
+    append_u32(out, 0);
+    append_u64(out, count);
+    append_u64(out, table_size);
+}
+
+void append_users_idx_header(string& out)
+{
+    append_users_idx_header(out, USERS_IDX_DIRECT, 0, 0);
+}
+
+void append_users_idx_entry(string& out, int user_id, uint64_t offset, uint32_t length)
+{
+    UsersIndexEntry e{ user_id, length, offset };
+    out.append(reinterpret_cast<const char*>(&e), sizeof(e));
+}
+
+// Lookup table and final header for n entries. The table is direct unless
+// it would take more room than the entries themselves (ids under 25% dense).
+static void build_users_idx_table(const UsersIndexEntry* entries, size_t n, string& header, vector<uint32_t>& table)
+{
+    int64_t max_id = -1;
+    bool negative = false;
+    for (size_t i = 0; i < n; ++i) {
+        if (entries[i].user_id < 0) negative = true;
+        else max_id = max(max_id, (int64_t)entries[i].user_id);
+    }
+    uint32_t layout = (!negative && (uint64_t)(max_id + 1) <= 4 * (uint64_t)n) ? USERS_IDX_DIRECT : USERS_IDX_SORTED;
+    if (layout == USERS_IDX_DIRECT) {
+        table.assign((size_t)(max_id + 1), USERS_IDX_NONE);
+        for (size_t i = 0; i < n; ++i) table[entries[i].user_id] = (uint32_t)i;
+    } else {
+        table.resize(n);
+        for (size_t i = 0; i < n; ++i) table[i] = (uint32_t)i;
+        // stable, so of two entries with one id the later sorts last
+        stable_sort(table.begin(), table.end(),
+                    [&](uint32_t a, uint32_t b) { return entries[a].user_id < entries[b].user_id; });
+    }
+    header.clear();
+    append_users_idx_header(header, layout, n, table.size());
+}
+
+bool finish_users_idx(const string& path)
+{
+    string header;
+    vector<uint32_t> table;
+    {
+        MappedFile f;
+        if (!f.open(path) || f.size() < USERS_IDX_HEADER_SIZE
+            || (f.size() - USERS_IDX_HEADER_SIZE) % sizeof(UsersIndexEntry) != 0) return false;
+        build_users_idx_table(reinterpret_cast<const UsersIndexEntry*>(f.view().data() + USERS_IDX_HEADER_SIZE),
+                              (f.size() - USERS_IDX_HEADER_SIZE) / sizeof(UsersIndexEntry), header, table);
+    }
+    fstream out(path, ios::in | ios::out | ios::binary);
+    if (!out.is_open()) return false;
+    out.seekp(0, ios::end);
+    out.write(reinterpret_cast<const char*>(table.data()), (streamsize)(table.size() * sizeof(uint32_t)));
+    out.seekp(0);
+    out.write(header.data(), (streamsize)header.size());
+    return (bool)out;
+}
+
+bool write_users_idx(const string& path, const vector<UsersIndexEntry>& entries)
+{
+    string header;
+    vector<uint32_t> table;
+    build_users_idx_table(entries.data(), entries.size(), header, table);
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out.is_open()) return false;
+    out.write(header.data(), (streamsize)header.size());
+    out.write(reinterpret_cast<const char*>(entries.data()), (streamsize)(entries.size() * sizeof(UsersIndexEntry)));
+    out.write(reinterpret_cast<const char*>(table.data()), (streamsize)(table.size() * sizeof(uint32_t)));
+    return (bool)out;
+}
+
 bool csv_to_bin_index(const string& users_csv, const string& out_bin, const string& out_index, int num_token_cols)
 {
     ifstream in(users_csv);
     if (! in.is_open()) return false;
     ofstream bout(out_bin, ios::binary);
-    ofstream idxout(out_index);
-    if (! bout.is_open() || ! idxout.is_open()) return false;
+    if (! bout.is_open()) return false;
+    vector<UsersIndexEntry> entries;
     string header;
     if (! getline(in, header)) return false;
 
@@ -110,110 +279,63 @@ bool csv_to_bin_index(const string& users_csv, const string& out_bin, const stri
         }
     }
 
-    uint64_t offset = 0;
+    string buf;
+    append_users_bin_header(buf);
+    bout.write(buf.data(), (streamsize)buf.size());
+    uint64_t offset = buf.size();
     string line;
     while (getline(in, line)) {
         if (line.empty()) continue;
         vector<string> cols = split_csv_line(line);
         if (cols.size() == 0) continue;
 
-        uint32_t user_id = 0;
-        if (idx_user >= 0 && (size_t)idx_user < cols.size()) user_id = (uint32_t) atoi(cols[idx_user].c_str());
-
-        uint32_t ispublic = 0;
-        if (idx_public >= 0 && (size_t)idx_public < cols.size() && cols[idx_public].size()) ispublic = (uint32_t) atoi(cols[idx_public].c_str());
-
-        uint32_t completion = 0;
-        if (idx_completion >= 0 && (size_t)idx_completion < cols.size() && cols[idx_completion].size()) completion = (uint32_t) atoi(cols[idx_completion].c_str());
+        UserRecord rec;
+        auto field = [&](int idx) -> const string* {
+            return (idx >= 0 && (size_t)idx < cols.size() && cols[idx].size()) ? &cols[idx] : nullptr;
+        };
+        auto number = [&](int idx, uint32_t missing) {
+            const string* f = field(idx);
+            return f ? (uint32_t) atoi(f->c_str()) : missing;
+        };
+        rec.user_id = number(idx_user, 0);
+        rec.ispublic = number(idx_public, USER_FIELD_NONE);
+        rec.completion_percentage = number(idx_completion, USER_FIELD_NONE);
+        rec.gender = number(idx_gender, USER_FIELD_NONE);
+        rec.age = number(idx_age, 0);
 
-        uint32_t gender = 0;
-        if (idx_gender >= 0 && (size_t)idx_gender < cols.size() && cols[idx_gender].size()) gender = (uint32_t) atoi(cols[idx_gender].c_str());
-
-        vector<uint32_t> region_parts;
-        if (idx_region >= 0 && (size_t)idx_region < cols.size() && cols[idx_region].size()) {
-            string rf = cols[idx_region];
+        rec.region.assign(3, USER_FIELD_NONE);
+        if (const string* f = field(idx_region)) {
+            string rf = *f;
             if (rf.size() >= 2 && rf.front() == '"' && rf.back() == '"') rf = rf.substr(1, rf.size()-2);
             stringstream rs(rf);
             string tok;
-            while (getline(rs, tok, ';')) {
-                if (tok.empty()) continue;
-                region_parts.push_back((uint32_t) atoi(tok.c_str()));
+            for (size_t pi = 0; pi < 3 && getline(rs, tok, ';'); ++pi) {
+                if (!tok.empty()) rec.region[pi] = (uint32_t) atoi(tok.c_str());
             }
         }
 
-        uint32_t age = 0;
-        if (idx_age >= 0 && (size_t)idx_age < cols.size() && cols[idx_age].size()) {
-            age = (uint32_t) atoi(cols[idx_age].c_str());
-        }
-
-        vector<uint32_t> clubs;
-        if (idx_clubs >= 0 && (size_t)idx_clubs < cols.size() && cols[idx_clubs].size()) {
-            string clubs_field = cols[idx_clubs];
-            stringstream sc(clubs_field);
+        if (const string* f = field(idx_clubs)) {
+            stringstream sc(*f);
             string part;
             while (getline(sc, part, ';')) {
                 if (part.size() == 0) continue;
-                clubs.push_back((uint32_t) atoi(part.c_str()));
+                rec.clubs.push_back((uint32_t) atoi(part.c_str()));
             }
         }
 
-        uint32_t start_offset = (uint32_t) offset;
-
-        bout.write(reinterpret_cast<const char*>(&user_id), sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-
-        bout.write(reinterpret_cast<const char*>(&ispublic), sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-
-        bout.write(reinterpret_cast<const char*>(&completion), sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-
-        bout.write(reinterpret_cast<const char*>(&gender), sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-
-        uint32_t region_count = (uint32_t) region_parts.size();
-        bout.write(reinterpret_cast<const char*>(&region_count), sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-        for (uint32_t v : region_parts) {
-            bout.write(reinterpret_cast<const char*>(&v), sizeof(uint32_t));
-            offset += sizeof(uint32_t);
-        }
-
-        bout.write(reinterpret_cast<const char*>(&age), sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-
-        uint32_t clubs_count = (uint32_t) clubs.size();
-        bout.write(reinterpret_cast<const char*>(&clubs_count), sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-        for (size_t i = 0; i < clubs.size(); ++i) { uint32_t cid = clubs[i]; bout.write(reinterpret_cast<const char*>(&cid), sizeof(uint32_t)); offset += sizeof(uint32_t); }
-
-        uint32_t cols_num = (uint32_t) num_token_cols;
-        bout.write(reinterpret_cast<const char*>(&cols_num), sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-        for (int ci = 0; ci < num_token_cols; ++ci)
-        {
-            string field;
-            if (idx_token_cols[ci] >= 0 && (size_t) idx_token_cols[ci] < cols.size()) field = cols[idx_token_cols[ci]];
-            vector<pair<uint32_t,uint32_t>> pairs = parse_pairs(field);
-            uint32_t pairs_count = (uint32_t) pairs.size();
-            bout.write(reinterpret_cast<const char*>(&pairs_count), sizeof(uint32_t));
-            offset += sizeof(uint32_t);
-            for (size_t pi = 0; pi < pairs.size(); ++pi) {
-                uint32_t tid = pairs[pi].first;
-                uint32_t cnt = pairs[pi].second;
-                bout.write(reinterpret_cast<const char*>(&tid), sizeof(uint32_t));
-                offset += sizeof(uint32_t);
-                bout.write(reinterpret_cast<const char*>(&cnt), sizeof(uint32_t));
-                offset += sizeof(uint32_t);
-            }
+        rec.token_cols.resize((size_t)num_token_cols);
+        for (int ci = 0; ci < num_token_cols; ++ci) {
+            if (const string* f = field(idx_token_cols[ci])) rec.token_cols[ci] = parse_pairs(*f);
         }
 
-        uint32_t rec_len = (uint32_t) (offset - start_offset);
-        idxout << user_id << "," << start_offset << "," << rec_len << "\n";
+        buf.clear();
+        append_user_record(buf, rec);
+        bout.write(buf.data(), (streamsize)buf.size());
+        entries.push_back(UsersIndexEntry{ (int32_t)rec.user_id, (uint32_t)buf.size(), offset });
+        offset += buf.size();
     }
 
     bout.close();
-    idxout.close();
     in.close();
-    return true;
+    return write_users_idx(out_index, entries);
 }
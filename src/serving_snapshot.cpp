@@ -0,0 +1,294 @@
+#include "serving_snapshot.h"
+#include "pipeline.h"
+#include "recommender.h"
+#include "stage_dag.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static const char SNAPSHOT_MAGIC[4] = { 'P', 'K', 'S', 'N' };
+static const uint32_t SNAPSHOT_VERSION = 2;
+static const size_t SNAPSHOT_KEY_LEN = 16;
+static const size_t SECTION_NAME_LEN = 24;
+
+struct SnapshotSectionEntry {
+    char name[SECTION_NAME_LEN];
+    uint64_t offset;
+    uint64_t size;
+};
+
+string serving_snapshot_key(const PipelineConfig& cfg) {
+    Fingerprint fp;
+    fp.add(string_view("serving.snap v2"));
+    fp.add_file(cfg.profiles).add_file(cfg.relationships).add_file(cfg.lemma_model);
+    fp.add((uint64_t)cfg.vocab.min_df).add(string_view(to_string(cfg.vocab.max_df))).add((uint64_t)cfg.vocab.hash_bits);
+    // The files themselves, not their stamps: ingest_delta rewrites the
+    // stores in place and leaves their stamps as they were.
+    const char* artifacts[] = { "vocab.bin", "adjacency.bin", "users.bin", "users.idx", "median_age.txt", "column_normalizers.csv" };
+    for (const char* a : artifacts) fp.add_file((fs::path(cfg.data_dir) / a).string());
+    for (const string &c : cfg.text_columns) fp.add(string_view(c));
+    fp.add((uint64_t)cfg.max_users);
+    return fp.hex();
+}
+
+namespace {
+
+// Sections of a snapshot being written, in file order.
+struct SnapshotBuilder {
+    vector<pair<string, string>> sections;
+
+    template <typename T>
+    void add(const string& name, const T* values, size_t count) {
+        sections.emplace_back(name, string(reinterpret_cast<const char*>(values), count * sizeof(T)));
+    }
+    template <typename T>
+    void add(const string& name, const vector<T>& values) { add(name, values.data(), values.size()); }
+    void add_strings(const string& name, const vector<string_view>& strings) {
+        vector<uint32_t> offsets;
+        string arena;
+        for (string_view s : strings) { offsets.push_back((uint32_t)arena.size()); arena.append(s.data(), s.size()); }
+        offsets.push_back((uint32_t)arena.size());
+        add(name + ".off", offsets);
+        sections.emplace_back(name, std::move(arena));
+    }
+};
+
+}
+
+bool write_serving_snapshot(const string& path, const string& key, const vector<string>& text_columns,
+                            const PipelineData& data, const Recommender& rec,
+                            const unordered_map<int,string>& club_id_to_name) {
+    SnapshotBuilder b;
+    b.add_strings("columns", vector<string_view>(text_columns.begin(), text_columns.end()));
+
+    // The store's own arrays, so restore can serve them in place.
+    const ProfileView profiles = data.profiles.view();
+    const ProfileView::Arrays &pa = profiles.arrays();
+    const size_t n_users = profiles.size();
+    const size_t n_token_rows = n_users * text_columns.size();
+    b.add("users.id", pa.ids, n_users);
+    b.add("users.public", pa.public_flags, n_users);
+    b.add("users.completion", pa.completions, n_users);
+    b.add("users.gender", pa.genders, n_users);
+    b.add("users.age", pa.ages, n_users);
+    b.add("users.region", pa.regions, n_users);
+    b.add("users.index", pa.index_by_id, pa.index_size);
+    b.add("clubs.off", pa.club_offsets, n_users + 1);
+    b.add("clubs", pa.club_ids, (size_t)pa.club_offsets[n_users]);
+    b.add("friends.off", pa.friend_offsets, n_users + 1);
+    b.add("friends", pa.friend_ids, (size_t)pa.friend_offsets[n_users]);
+    b.add("tokens.off", pa.token_offsets, n_token_rows + 1);
+    b.add("tokens", pa.token_counts, (size_t)pa.token_offsets[n_token_rows]);
+
+    const AdjacencyView &adj = data.adjacency;
+    const int nodes = adj.num_nodes();
+    b.add("graph.off", nodes ? vector<uint64_t>(adj.offsets(), adj.offsets() + nodes + 1) : vector<uint64_t>());
+    b.add("graph", vector<int32_t>(adj.cols(), adj.cols() + adj.num_edges()));
+
+    vector<uint64_t> idf_off(1, 0);
+    vector<IdfEntry> idf;
+    for (const string &col : text_columns) {
+        auto it = rec.idf_per_col.find(col);
+        if (it != rec.idf_per_col.end()) idf.insert(idf.end(), it->second.begin(), it->second.end());
+        idf_off.push_back(idf.size());
+    }
+    b.add("idf.off", idf_off);
+    b.add("idf", idf);
+    b.add("idf.total", vector<uint64_t>(1, (uint64_t)rec.total_users));
+
+    vector<string_view> norm_names;
+    vector<float> norm_values;
+    for (auto &kv : data.col_norms) {
+        norm_names.push_back(kv.first);
+        norm_values.push_back(kv.second.first);
+        norm_values.push_back(kv.second.second);
+    }
+    b.add_strings("norms", norm_names);
+    b.add("norms.values", norm_values);
+
+    int max_club = -1;
+    for (auto &kv : club_id_to_name) max_club = max(max_club, kv.first);
+    vector<string_view> club_names(max_club + 1);
+    for (auto &kv : club_id_to_name) if (kv.first >= 0) club_names[kv.first] = kv.second;
+    b.add_strings("club_names", club_names);
+
+    for (auto &s : b.sections) if (s.first.size() >= SECTION_NAME_LEN) return false;
+    uint64_t pos = 16 + SNAPSHOT_KEY_LEN + b.sections.size() * sizeof(SnapshotSectionEntry);
+    vector<SnapshotSectionEntry> table(b.sections.size());
+    for (size_t i = 0; i < b.sections.size(); ++i) {
+        memset(&table[i], 0, sizeof(table[i]));
+        memcpy(table[i].name, b.sections[i].first.data(), b.sections[i].first.size());
+        pos += (8 - pos % 8) % 8;
+        table[i].offset = pos;
+        table[i].size = b.sections[i].second.size();
+        pos += table[i].size;
+    }
+
+    const string tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        if (!out.is_open()) return false;
+        uint32_t head[3] = { SNAPSHOT_VERSION, (uint32_t)b.sections.size(), 0 };
+        out.write(SNAPSHOT_MAGIC, 4);
+        out.write(reinterpret_cast<const char*>(head), sizeof(head));
+        string k = key;
+        k.resize(SNAPSHOT_KEY_LEN, '\0');
+        out.write(k.data(), (streamsize)k.size());
+        out.write(reinterpret_cast<const char*>(table.data()), (streamsize)(table.size() * sizeof(SnapshotSectionEntry)));
+        uint64_t written = 16 + SNAPSHOT_KEY_LEN + table.size() * sizeof(SnapshotSectionEntry);
+        static const char zeros[8] = { 0 };
+        for (size_t i = 0; i < b.sections.size(); ++i) {
+            out.write(zeros, (streamsize)(table[i].offset - written));
+            out.write(b.sections[i].second.data(), (streamsize)table[i].size);
+            written = table[i].offset + table[i].size;
+        }
+        if (!out) return false;
+    }
+    error_code ec;
+    fs::rename(tmp, path, ec);
+    return !ec;
+}
+
+bool ServingSnapshot::open(const string& path) {
+    close();
+    if (!file.open(path)) return false;
+    const char* base = file.view().data();
+    const size_t size = file.size();
+    uint32_t head[3];
+    if (size < 16 + SNAPSHOT_KEY_LEN || memcmp(base, SNAPSHOT_MAGIC, 4) != 0) { close(); return false; }
+    memcpy(head, base + 4, sizeof(head));
+    const uint64_t table_end = 16 + SNAPSHOT_KEY_LEN + (uint64_t)head[1] * sizeof(SnapshotSectionEntry);
+    if (head[0] != SNAPSHOT_VERSION || table_end > size) { close(); return false; }
+    snap_key = string_view(base + 16, SNAPSHOT_KEY_LEN);
+    snap_key = snap_key.substr(0, snap_key.find('\0'));
+    for (uint32_t i = 0; i < head[1]; ++i) {
+        const char* entry = base + 16 + SNAPSHOT_KEY_LEN + i * sizeof(SnapshotSectionEntry);
+        SnapshotSectionEntry e;
+        memcpy(&e, entry, sizeof(e));
+        if (e.offset % 8 || e.offset > size || e.size > size - e.offset) { close(); return false; }
+        string_view name(entry, strnlen(entry, SECTION_NAME_LEN));
+        sections.emplace_back(name, string_view(base + e.offset, (size_t)e.size));
+    }
+    return true;
+}
+
+void ServingSnapshot::close() {
+    sections.clear();
+    snap_key = string_view();
+    file.close();
+}
+
+string_view ServingSnapshot::raw(string_view name) const {
+    for (auto &s : sections) if (s.first == name) return s.second;
+    return string_view();
+}
+
+// Strings of a section written by SnapshotBuilder::add_strings.
+static bool read_strings(const ServingSnapshot& snap, const string& name, vector<string_view>& out) {
+    size_t n = 0;
+    const uint32_t* off = snap.section<uint32_t>(name + ".off", n);
+    string_view arena = snap.raw(name);
+    out.clear();
+    if (!off || n == 0 || off[n - 1] != arena.size()) return false;
+    for (size_t i = 0; i + 1 < n; ++i) {
+        if (off[i] > off[i + 1]) return false;
+        out.push_back(arena.substr(off[i], off[i + 1] - off[i]));
+    }
+    return true;
+}
+
+// A CSR offsets section of rows + 1 entries that starts at 0, never
+// decreases and ends at the size of its data section.
+static bool offsets_ok(const uint64_t* off, size_t n_off, size_t rows, size_t data_size) {
+    if (!off || n_off != rows + 1 || off[0] != 0 || off[rows] != data_size) return false;
+    for (size_t i = 0; i < rows; ++i) if (off[i] > off[i + 1]) return false;
+    return true;
+}
+
+bool ServingSnapshot::restore(const vector<string>& text_columns, PipelineData& data, Recommender& rec,
+                              unordered_map<int,string>& club_id_to_name) const {
+    vector<string_view> columns;
+    if (!read_strings(*this, "columns", columns) || columns != vector<string_view>(text_columns.begin(), text_columns.end()))
+        return false;
+    const size_t cols = text_columns.size();
+
+    // Every field section has one value per user.
+    ProfileView::Arrays pa;
+    size_t n_users = 0, n = 0;
+    pa.ids = section<int>("users.id", n_users);
+    if (!pa.ids) return false;
+    pa.public_flags = section<int>("users.public", n);
+    if (!pa.public_flags || n != n_users) return false;
+    pa.completions = section<int>("users.completion", n);
+    if (!pa.completions || n != n_users) return false;
+    pa.genders = section<int>("users.gender", n);
+    if (!pa.genders || n != n_users) return false;
+    pa.ages = section<int>("users.age", n);
+    if (!pa.ages || n != n_users) return false;
+    pa.regions = section<array<int,3>>("users.region", n);
+    if (!pa.regions || n != n_users) return false;
+    pa.index_by_id = section<int>("users.index", pa.index_size);
+    if (!pa.index_by_id) return false;
+    for (size_t id = 0; id < pa.index_size; ++id)
+        if (pa.index_by_id[id] < -1 || pa.index_by_id[id] >= (int64_t)n_users) return false;
+
+    size_t n_off = 0, n_data = 0;
+    pa.club_offsets = section<uint64_t>("clubs.off", n_off);
+    pa.club_ids = section<uint32_t>("clubs", n_data);
+    if (!pa.club_ids || !offsets_ok(pa.club_offsets, n_off, n_users, n_data)) return false;
+    pa.friend_offsets = section<uint64_t>("friends.off", n_off);
+    pa.friend_ids = section<uint32_t>("friends", n_data);
+    if (!pa.friend_ids || !offsets_ok(pa.friend_offsets, n_off, n_users, n_data)) return false;
+    pa.token_offsets = section<uint64_t>("tokens.off", n_off);
+    pa.token_counts = section<TokenCount>("tokens", n_data);
+    if (!pa.token_counts || !offsets_ok(pa.token_offsets, n_off, n_users * cols, n_data)) return false;
+
+    size_t n_graph_off = 0, n_graph = 0;
+    const uint64_t* graph_off = section<uint64_t>("graph.off", n_graph_off);
+    const int32_t* graph = section<int32_t>("graph", n_graph);
+    if (!graph_off || !graph) return false;
+    if (n_graph_off > 0 && !offsets_ok(graph_off, n_graph_off, n_graph_off - 1, n_graph)) return false;
+
+    size_t n_idf_off = 0, n_idf = 0, n_total = 0;
+    const uint64_t* idf_off = section<uint64_t>("idf.off", n_idf_off);
+    const IdfEntry* idf = section<IdfEntry>("idf", n_idf);
+    const uint64_t* total = section<uint64_t>("idf.total", n_total);
+    if (!idf || !offsets_ok(idf_off, n_idf_off, cols, n_idf) || n_total != 1) return false;
+    // columns are searched by token
+    for (size_t t = 0; t < cols; ++t)
+        for (uint64_t k = idf_off[t] + 1; k < idf_off[t + 1]; ++k)
+            if (idf[k - 1].token >= idf[k].token) return false;
+
+    vector<string_view> norm_names;
+    size_t n_norm_values = 0;
+    const float* norm_values = section<float>("norms.values", n_norm_values);
+    if (!read_strings(*this, "norms", norm_names) || n_norm_values != 2 * norm_names.size()) return false;
+    vector<string_view> club_names;
+    if (!read_strings(*this, "club_names", club_names)) return false;
+
+    data.adjacency = n_graph_off > 0 ? AdjacencyView(graph_off, graph, (int)(n_graph_off - 1)) : AdjacencyView();
+    rec.adjacency = data.adjacency;
+    data.profiles.clear();
+    data.profiles_view = ProfileView(pa, n_users, cols);
+    rec.profiles = data.profiles_view;
+    rec.cache = nullptr;
+
+    rec.idf_per_col.clear();
+    for (size_t t = 0; t < cols; ++t)
+        rec.idf_per_col[text_columns[t]] = IdfColumn(idf + idf_off[t], (size_t)(idf_off[t + 1] - idf_off[t]));
+    rec.total_users = (size_t)total[0];
+
+    data.col_norms.clear();
+    for (size_t i = 0; i < norm_names.size(); ++i)
+        data.col_norms[string(norm_names[i])] = make_pair(norm_values[2 * i], norm_values[2 * i + 1]);
+    rec.set_field_normalizers(data.col_norms);
+    rec.set_column_normalizers(data.col_norms);
+
+    club_id_to_name.clear();
+    for (size_t id = 0; id < club_names.size(); ++id) club_id_to_name[(int)id] = string(club_names[id]);
+    return true;
+}
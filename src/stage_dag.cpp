@@ -0,0 +1,164 @@
+#include "stage_dag.h"
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <map>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+Fingerprint& Fingerprint::add(string_view s) {
+    add((uint64_t)s.size());
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ull; }
+    return *this;
+}
+
+Fingerprint& Fingerprint::add(uint64_t v) {
+    for (int i = 0; i < 8; ++i) { h ^= (unsigned char)(v >> (8 * i)); h *= 1099511628211ull; }
+    return *this;
+}
+
+Fingerprint& Fingerprint::add_file(const string& path) {
+    error_code ec;
+    uint64_t size = (uint64_t)fs::file_size(path, ec);
+    if (ec) return add(string_view("<missing>"));
+    auto mtime = fs::last_write_time(path, ec);
+    add(size);
+    add((uint64_t)(ec ? 0 : mtime.time_since_epoch().count()));
+    const uint64_t sample = 1 << 20;
+    ifstream in(path, ios::binary);
+    string buf;
+    auto take = [&](uint64_t off, uint64_t len) {
+        buf.resize((size_t)len);
+        in.clear();
+        in.seekg((streamoff)off);
+        in.read(&buf[0], (streamsize)len);
+        buf.resize((size_t)in.gcount());
+        add(string_view(buf));
+    };
+    take(0, min(size, sample));
+    if (size > sample) {
+        uint64_t tail = min(size - sample, sample);
+        take(size - tail, tail);
+    }
+    return *this;
+}
+
+string Fingerprint::hex() const {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return string(buf);
+}
+
+bool read_stamp(const string& artifact, string& fingerprint) {
+    ifstream in(artifact + ".stamp");
+    return in.is_open() && (bool)getline(in, fingerprint);
+}
+
+bool write_stamp(const string& artifact, const string& fingerprint) {
+    ofstream out(artifact + ".stamp");
+    if (!out.is_open()) return false;
+    out << fingerprint << "\n";
+    return (bool)out;
+}
+
+void remove_stamp(const string& artifact) {
+    error_code ec;
+    fs::remove(artifact + ".stamp", ec);
+}
+
+void StageDag::add(Stage stage) {
+    stages.push_back(std::move(stage));
+}
+
+bool StageDag::run(ostream& log, const string& tag, RunReport* report) {
+    map<string, size_t> index;
+    for (size_t i = 0; i < stages.size(); ++i) index[stages[i].name] = i;
+    for (const Stage &s : stages) {
+        for (const string &d : s.deps) {
+            if (index.find(d) == index.end()) {
+                log << "[" << tag << "] stage " << s.name << " depends on unknown stage " << d << "\n";
+                return false;
+            }
+        }
+    }
+
+    vector<string> fingerprints(stages.size());
+    vector<bool> done(stages.size(), false);
+    mutex log_m;
+    size_t remaining = stages.size();
+    while (remaining > 0) {
+        // every stage whose deps are done forms the next wave
+        vector<size_t> wave;
+        for (size_t i = 0; i < stages.size(); ++i) {
+            if (done[i]) continue;
+            bool ready = true;
+            for (const string &d : stages[i].deps) ready = ready && done[index[d]];
+            if (ready) wave.push_back(i);
+        }
+        if (wave.empty()) {
+            log << "[" << tag << "] stage dependencies form a cycle\n";
+            return false;
+        }
+        for (size_t i : wave) {
+            Fingerprint fp;
+            fp.add(string_view(stages[i].name));
+            for (const string &d : stages[i].deps) fp.add(string_view(fingerprints[index[d]]));
+            if (stages[i].inputs) stages[i].inputs(fp);
+            fingerprints[i] = fp.hex();
+        }
+
+        vector<char> ok(wave.size(), 0);
+        auto run_stage = [&](size_t w) {
+            Stage &s = stages[wave[w]];
+            const string &fp = fingerprints[wave[w]];
+            StageTimer timer(report, s.name);
+            bool fresh = !s.outputs.empty();
+            for (const string &o : s.outputs) {
+                string stamp;
+                fresh = fresh && fs::exists(o) && read_stamp(o, stamp) && stamp == fp;
+            }
+            if (fresh && (!s.load || s.load())) {
+                timer.metrics.status = "loaded";
+                if (s.counts) s.counts(timer.metrics);
+                lock_guard<mutex> lk(log_m);
+                log << "[" << tag << "] stage " << s.name << " up to date (" << fp << ")\n";
+                ok[w] = 1;
+                return;
+            }
+            if (!s.outputs.empty()) {
+                lock_guard<mutex> lk(log_m);
+                log << "[" << tag << "] stage " << s.name << " stale, building\n";
+            }
+            // a build that dies halfway must not leave a matching stamp behind
+            for (const string &o : s.outputs) remove_stamp(o);
+            if (!s.build || !s.build(fp)) {
+                timer.metrics.status = "failed";
+                lock_guard<mutex> lk(log_m);
+                log << "[" << tag << "] stage " << s.name << " failed\n";
+                return;
+            }
+            for (const string &o : s.outputs) {
+                if (fs::exists(o)) write_stamp(o, fp);
+            }
+            if (s.counts) s.counts(timer.metrics);
+            ok[w] = 1;
+        };
+        if (wave.size() == 1) {
+            run_stage(0);
+        } else {
+            vector<thread> workers;
+            for (size_t w = 0; w < wave.size(); ++w) workers.emplace_back(run_stage, w);
+            for (auto &t : workers) t.join();
+        }
+        for (size_t w = 0; w < wave.size(); ++w) {
+            if (!ok[w]) return false;
+            done[wave[w]] = true;
+            --remaining;
+        }
+    }
+    return true;
+}
@@ -1,6 +1,5 @@
 #include "test.h"
 #include "recommender.h"
-#include "user_profile.h"
 #include <random>
 #include <algorithm>
 #include <fstream>
@@ -10,19 +9,16 @@
 
 using namespace std;
 
-void run_friends_holdout_test(const unordered_map<int, UserProfile>& profiles,
-                              const unordered_map<int, vector<int>>& adj_list,
+void run_friends_holdout_test(const ProfileStore& profiles,
+                              const AdjacencyView& adjacency,
                               const vector<string>& text_columns,
                               const Recommender& base_rec,
                               int sample_size,
                               const string& out_path)
 {
     vector<int> candidates;
-    for (auto &kv : profiles) {
-        int uid = kv.first;
-        auto it = adj_list.find(uid);
-        if (it == adj_list.end()) continue;
-        if ((int)it->second.size() >= 20) candidates.push_back(uid);
+    for (int uid : profiles.user_ids()) {
+        if ((int)adjacency.degree(uid) >= 20) candidates.push_back(uid);
     }
     if (candidates.empty()) {
         cout << "[test] no suitable users found\n";
@@ -32,8 +28,9 @@ void run_friends_holdout_test(const unordered_map<int, UserProfile>& profiles,
     mt19937 rng(1234567);
     shuffle(candidates.begin(), candidates.end(), rng);
 
-    unordered_map<int, vector<int>> adj_mod = adj_list;
-    Recommender rec(&profiles, &adj_mod);
+    // held-out friends stay out for the rest of the run
+    unordered_map<int, vector<int>> held_out;
+    Recommender rec(&profiles, adjacency.with_overrides(&held_out));
     rec.set_field_normalizers(base_rec.field_normalizers);
     rec.set_column_normalizers(base_rec.column_normalizers);
     rec.set_text_columns(text_columns);
@@ -50,9 +47,8 @@ void run_friends_holdout_test(const unordered_map<int, UserProfile>& profiles,
         if (taken >= sample_size) break;
         ++processed;
 
-        auto itadj = adj_list.find(uid);
-        if (itadj == adj_list.end()) continue;
-        const vector<int> &friends = itadj->second;
+        NeighborRange friends = adjacency.neighbors(uid);
+        if (friends.empty()) continue;
         int F = (int)friends.size();
         if (F < 2) continue;
 
@@ -70,7 +66,7 @@ void run_friends_holdout_test(const unordered_map<int, UserProfile>& profiles,
         newf.reserve(F - hold_k);
         for (int f : friends) if (held.find(f) == held.end()) newf.push_back(f);
 
-        adj_mod[uid] = std::move(newf);
+        held_out[uid] = std::move(newf);
 
         auto preds = rec.recommend_collaborative(uid, hold_k, 1000);
 
@@ -1,19 +1,17 @@
 #include "tfidf_index.h"
-#include "user_profile.h"
+#include "profile_store.h"
 #include <cmath>
 
 using namespace std;
 
-void TFIDFIndex::build(const unordered_map<int, UserProfile>& profiles, const vector<string>& text_columns) {
+void TFIDFIndex::build(const ProfileStore& profiles, const vector<string>& text_columns) {
     N = (int)profiles.size();
     doc_freqs.clear();
     doc_freqs.resize(text_columns.size());
-    for (auto &kv : profiles) {
-        const UserProfile &p = kv.second;
+    for (int i = 0; i < (int)profiles.size(); ++i) {
         for (size_t t = 0; t < text_columns.size(); ++t) {
-            if (t >= p.token_cols.size()) continue;
-            for (auto &pr : p.token_cols[t]) {
-                doc_freqs[t][pr.first] += 1;
+            for (const TokenCount &tc : profiles.tokens(i, t)) {
+                doc_freqs[t][tc.token] += 1;
             }
         }
     }
@@ -75,15 +73,15 @@ float TFIDFIndex::weighted_cosine(const unordered_map<int,int>& A, const unorder
     return (float)(dot / norm);
 }
 
-void TFIDFIndex::compute_tfidf_vector(const UserProfile& p, unordered_map<int,float>& out) const {
+void TFIDFIndex::compute_tfidf_vector(const ProfileStore& profiles, int i, unordered_map<int,float>& out) const {
     out.clear();
     if (N <= 0) return;
     size_t T = doc_freqs.size();
-    for (size_t t = 0; t < T && t < p.token_cols.size(); ++t) {
+    for (size_t t = 0; t < T; ++t) {
         const auto &dfmap = doc_freqs[t];
-        for (auto &pr : p.token_cols[t]) {
-            int token = pr.first;
-            int tf = pr.second;
+        for (const TokenCount &tc : profiles.tokens(i, t)) {
+            int token = tc.token;
+            int tf = tc.count;
             double idf = idf_val_local(dfmap, N, token);
             double w = (double)tf * idf;
             out[token] += (float)w;
@@ -0,0 +1,199 @@
+#include "token_cache.h"
+#include "varint.h"
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+static const char TOKEN_CACHE_MAGIC[4] = { 'P', 'K', 'T', 'C' };
+static const uint32_t TOKEN_CACHE_VERSION = 1;
+
+template <typename T>
+static void write_pod(ofstream& out, const T& v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template <typename T>
+static bool read_pod(ifstream& in, T& v) {
+    in.read(reinterpret_cast<char*>(&v), sizeof(T));
+    return (bool)in;
+}
+
+static bool read_varint_stream(ifstream& in, uint64_t& v, uint64_t& consumed) {
+    v = 0;
+    int shift = 0;
+    char c;
+    while (shift < 64 && in.get(c)) {
+        ++consumed;
+        uint8_t b = (uint8_t)c;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+        shift += 7;
+    }
+    return false;
+}
+
+bool TokenCacheWriter::open_part(const string& part_path) {
+    out.open(part_path, ios::binary | ios::trunc);
+    buf.clear();
+    return out.is_open();
+}
+
+void TokenCacheWriter::add(uint32_t user_id, const vector<vector<int>>& ids_per_col) {
+    body.clear();
+    for (const auto &ids : ids_per_col) {
+        put_varint(body, ids.size());
+        for (int id : ids) put_varint(body, (uint32_t)id);
+    }
+    put_varint(buf, user_id);
+    put_varint(buf, body.size());
+    buf += body;
+    if (buf.size() >= (1u << 20)) {
+        out.write(buf.data(), (streamsize)buf.size());
+        buf.clear();
+    }
+}
+
+void TokenCacheWriter::close() {
+    if (!out.is_open()) return;
+    if (!buf.empty()) out.write(buf.data(), (streamsize)buf.size());
+    buf.clear();
+    out.close();
+}
+
+bool TokenCacheWriter::finalize(const string& path,
+                                const vector<string>& part_paths,
+                                const vector<vector<vector<int>>>& remaps,
+                                uint64_t source_size,
+                                const vector<uint32_t>& vocab_sizes)
+{
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out.is_open()) return false;
+    uint32_t num_cols = (uint32_t)vocab_sizes.size();
+    uint32_t num_chunks = (uint32_t)part_paths.size();
+    uint64_t dir_offset = 0;
+    out.write(TOKEN_CACHE_MAGIC, 4);
+    write_pod(out, TOKEN_CACHE_VERSION);
+    write_pod(out, num_cols);
+    write_pod(out, num_chunks);
+    write_pod(out, source_size);
+    write_pod(out, dir_offset);
+
+    vector<pair<uint64_t,uint64_t>> ranges;
+    vector<char> block(1 << 20);
+    for (const string &pp : part_paths) {
+        uint64_t begin = (uint64_t)out.tellp();
+        ifstream in(pp, ios::binary);
+        while (in) {
+            in.read(block.data(), (streamsize)block.size());
+            streamsize got = in.gcount();
+            if (got > 0) out.write(block.data(), got);
+        }
+        in.close();
+        remove(pp.c_str());
+        ranges.push_back(make_pair(begin, (uint64_t)out.tellp()));
+    }
+
+    dir_offset = (uint64_t)out.tellp();
+    for (auto &r : ranges) { write_pod(out, r.first); write_pod(out, r.second); }
+    for (uint32_t v : vocab_sizes) write_pod(out, v);
+    for (uint32_t c = 0; c < num_chunks; ++c) {
+        for (uint32_t col = 0; col < num_cols; ++col) {
+            const vector<int> empty;
+            const vector<int> &rm = (c < remaps.size() && col < remaps[c].size()) ? remaps[c][col] : empty;
+            uint32_t n = (uint32_t)rm.size();
+            write_pod(out, n);
+            if (n) out.write(reinterpret_cast<const char*>(rm.data()), (streamsize)(n * sizeof(int)));
+        }
+    }
+    out.seekp(4 + 3 * sizeof(uint32_t) + sizeof(uint64_t));
+    write_pod(out, dir_offset);
+    out.close();
+    return (bool)out;
+}
+
+bool TokenCacheReader::open(const string& path, uint64_t source_size, const vector<uint32_t>& vocab_sizes) {
+    in.open(path, ios::binary);
+    if (!in.is_open()) return false;
+    char magic[4];
+    uint32_t version = 0, num_chunks = 0;
+    uint64_t src = 0, dir_offset = 0;
+    in.read(magic, 4);
+    if (!in || memcmp(magic, TOKEN_CACHE_MAGIC, 4) != 0) return false;
+    if (!read_pod(in, version) || version != TOKEN_CACHE_VERSION) return false;
+    if (!read_pod(in, num_cols) || num_cols != vocab_sizes.size()) return false;
+    if (!read_pod(in, num_chunks) || !read_pod(in, src) || !read_pod(in, dir_offset)) return false;
+    if (src != source_size) return false;
+    uint64_t data_begin = (uint64_t)in.tellg();
+
+    in.seekg((streamoff)dir_offset);
+    vector<uint64_t> chunk_begin(num_chunks);
+    chunk_end.assign(num_chunks, 0);
+    for (uint32_t c = 0; c < num_chunks; ++c) {
+        if (!read_pod(in, chunk_begin[c]) || !read_pod(in, chunk_end[c])) return false;
+    }
+    for (uint32_t col = 0; col < num_cols; ++col) {
+        uint32_t v = 0;
+        if (!read_pod(in, v) || v != vocab_sizes[col]) return false;
+    }
+    remaps.assign(num_chunks, vector<vector<int>>(num_cols));
+    for (uint32_t c = 0; c < num_chunks; ++c) {
+        for (uint32_t col = 0; col < num_cols; ++col) {
+            uint32_t n = 0;
+            if (!read_pod(in, n)) return false;
+            remaps[c][col].resize(n);
+            if (n) in.read(reinterpret_cast<char*>(remaps[c][col].data()), (streamsize)(n * sizeof(int)));
+            if (!in) return false;
+        }
+    }
+    pos = num_chunks ? chunk_begin[0] : data_begin;
+    in.seekg((streamoff)pos);
+    cur_chunk = 0;
+    return true;
+}
+
+bool TokenCacheReader::next(TokenCacheRecord& rec) {
+    while (cur_chunk < chunk_end.size() && pos >= chunk_end[cur_chunk]) ++cur_chunk;
+    if (cur_chunk >= chunk_end.size()) return false;
+    uint64_t uid = 0, len = 0;
+    if (!read_varint_stream(in, uid, pos) || !read_varint_stream(in, len, pos)) return false;
+    rec.user_id = (uint32_t)uid;
+    rec.chunk = cur_chunk;
+    rec.body.resize((size_t)len);
+    if (len) in.read(&rec.body[0], (streamsize)len);
+    if (!in) return false;
+    pos += len;
+    return true;
+}
+
+bool TokenCacheReader::seek(uint64_t record_pos) {
+    if (chunk_end.empty() || record_pos > chunk_end.back()) return false;
+    in.clear();
+    in.seekg((streamoff)record_pos);
+    if (!in) return false;
+    pos = record_pos;
+    cur_chunk = 0;
+    return true;
+}
+
+bool TokenCacheReader::decode(const TokenCacheRecord& rec, vector<vector<int>>& ids_per_col) const {
+    ids_per_col.resize(num_cols);
+    if (rec.chunk >= remaps.size()) return false;
+    const auto &rm = remaps[rec.chunk];
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(rec.body.data());
+    const uint8_t* end = p + rec.body.size();
+    for (uint32_t col = 0; col < num_cols; ++col) {
+        auto &ids = ids_per_col[col];
+        ids.clear();
+        uint64_t n = 0;
+        if (!get_varint(p, end, n)) return false;
+        for (uint64_t i = 0; i < n; ++i) {
+            uint64_t local = 0;
+            if (!get_varint(p, end, local)) return false;
+            if (local >= rm[col].size()) return false;
+            int id = rm[col][(size_t)local];
+            if (id >= 0) ids.push_back(id);
+        }
+    }
+    return true;
+}
@@ -1,40 +1,139 @@
 #include "tokenizer.h"
-#include <sstream>
-#include <cctype>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TOKENIZER_SSE2 1
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline unsigned lowest_bit(unsigned m) { unsigned long k; _BitScanForward(&k, m); return (unsigned)k; }
+#else
+static inline unsigned lowest_bit(unsigned m) { return (unsigned)__builtin_ctz(m); }
+#endif
+#endif
 
 Tokenizer::Tokenizer() {}
 Tokenizer::~Tokenizer() {}
 
-void Tokenizer::normalize_inplace(string& s) {
-    for (size_t i = 0; i < s.size(); ++i) {
-        unsigned char c = (unsigned char)s[i];
-        if (c >= 'A' && c <= 'Z') s[i] = (char)(c + 32);
-        if (!((c >= '0' && c <= '9') || (s[i] >= 'a' && s[i] <= 'z') || s[i] == '-')) s[i] = ' ';
+static inline bool is_ascii_word_byte(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-';
+}
+
+// Lowercase of a Latin-1 Supplement / Latin Extended-A letter, or 0 if cp is
+// not a letter of those blocks. Both forms always take two UTF-8 bytes.
+static inline uint32_t fold_latin_letter(uint32_t cp) {
+    if (cp >= 0xC0 && cp <= 0xDE) return cp == 0xD7 ? 0 : cp + 0x20;
+    if (cp >= 0xDF && cp <= 0xFF) return cp == 0xF7 ? 0 : cp;
+    if (cp < 0x100 || cp > 0x17F) return 0;
+    if (cp == 0x130 || cp == 0x138 || cp == 0x149 || cp == 0x17F) return cp;  // no 2-byte lowercase pair
+    if (cp == 0x178) return 0xFF;
+    bool odd_upper = (cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E);
+    bool upper = odd_upper ? (cp & 1) != 0 : (cp & 1) == 0;
+    return upper ? cp + 1 : cp;
+}
+
+// Handles the byte at in[i] (and the rest of its UTF-8 sequence), writing the
+// folded bytes to out; returns the number of bytes consumed and sets word.
+static inline size_t fold_scalar(const unsigned char* in, size_t i, size_t n, char* out, bool& word) {
+    unsigned char c = in[i];
+    if (c < 0x80) {
+        word = is_ascii_word_byte(c);
+        out[i] = (char)(c >= 'A' && c <= 'Z' ? c + 32 : c);
+        return 1;
+    }
+    word = false;
+    if ((c == 0xC3 || c == 0xC4 || c == 0xC5) && i + 1 < n && (in[i + 1] & 0xC0) == 0x80) {
+        uint32_t cp = ((uint32_t)(c & 0x1F) << 6) | (in[i + 1] & 0x3F);
+        uint32_t lower = fold_latin_letter(cp);
+        if (lower) {
+            word = true;
+            out[i] = (char)(0xC0 | (lower >> 6));
+            out[i + 1] = (char)(0x80 | (lower & 0x3F));
+            return 2;
+        }
     }
-    string r;
-    bool prev_space = false;
-    for (size_t i = 0; i < s.size(); ++i) {
-        char ch = s[i];
-        if (ch == ' ') {
-            if (prev_space) continue;
-            prev_space = true;
-            r.push_back(' ');
-        } else {
-            prev_space = false;
-            r.push_back(ch);
+    // any other non-ASCII byte separates words; keep whole sequences together
+    // so that a continuation byte is never taken for the start of a letter
+    out[i] = (char)c;
+    size_t len = 1;
+    if (c >= 0xC0) {
+        size_t want = c >= 0xF0 ? 4 : (c >= 0xE0 ? 3 : 2);
+        while (len < want && i + len < n && (in[i + len] & 0xC0) == 0x80) {
+            out[i + len] = (char)in[i + len];
+            ++len;
+        }
+    }
+    return len;
+}
+
+void Tokenizer::tokenize(string_view text, TokenBuffer& out) const {
+    const size_t n = text.size();
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(text.data());
+    out.tokens.clear();
+    out.text.resize(n);
+    char* dst = n ? &out.text[0] : nullptr;
+
+    size_t start = 0;
+    bool in_word = false;
+    auto word_at = [&](size_t pos) {
+        if (!in_word) { start = pos; in_word = true; }
+    };
+    auto gap_at = [&](size_t pos) {
+        if (in_word) { out.tokens.emplace_back(dst + start, pos - start); in_word = false; }
+    };
+
+    size_t i = 0;
+    while (i < n) {
+#ifdef TOKENIZER_SSE2
+        if (i + 16 <= n) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            if (_mm_movemask_epi8(v) == 0) {
+                // 16 ASCII bytes: lowercase A-Z and classify all of them at once
+                __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                              _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+                __m128i lower = _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), lower);
+                __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                              _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+                __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                              _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+                __m128i dash = _mm_cmpeq_epi8(v, _mm_set1_epi8('-'));
+                unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), dash));
+                if (mask == 0xFFFF) { word_at(i); i += 16; continue; }
+                if (mask == 0) { gap_at(i); i += 16; continue; }
+                // walk the word/gap transitions inside the block
+                size_t k = 0;
+                while (k < 16) {
+                    if (mask & (1u << k)) {
+                        word_at(i + k);
+                        unsigned rest = ~mask & (0xFFFFu << k) & 0xFFFFu;
+                        if (!rest) break;
+                        k = lowest_bit(rest);
+                    } else {
+                        gap_at(i + k);
+                        unsigned rest = mask & (0xFFFFu << k);
+                        if (!rest) break;
+                        k = lowest_bit(rest);
+                    }
+                }
+                i += 16;
+                continue;
+            }
         }
+#endif
+        bool word;
+        size_t len = fold_scalar(in, i, n, dst, word);
+        if (word) word_at(i); else gap_at(i);
+        i += len;
     }
-    while (!r.empty() && r.front() == ' ') r.erase(r.begin());
-    while (!r.empty() && r.back() == ' ') r.pop_back();
-    s = move(r);
+    gap_at(n);
 }
 
-vector<string> Tokenizer::tokenize(const string& text) {
-    string s = text;
-    normalize_inplace(s);
-    istringstream ss(s);
+vector<string> Tokenizer::tokenize(const string& text) const {
+    TokenBuffer buf;
+    tokenize(text, buf);
     vector<string> out;
-    string tok;
-    while (ss >> tok) out.push_back(tok);
+    out.reserve(buf.tokens.size());
+    for (string_view t : buf.tokens) out.emplace_back(t);
     return out;
 }
@@ -0,0 +1,122 @@
+#include "tsv_reader.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const string& path, bool random_access) {
+    close();
+#ifdef _WIN32
+    HANDLE fh = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | (random_access ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN), nullptr);
+    LARGE_INTEGER file_size;
+    if (fh == INVALID_HANDLE_VALUE) return false;
+    if (!GetFileSizeEx(fh, &file_size)) { CloseHandle(fh); return false; }
+    file = fh;
+    len = (size_t)file_size.QuadPart;
+    if (len > 0) {
+        HANDLE mh = CreateFileMappingA(fh, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mh == nullptr) { close(); return false; }
+        mapping = mh;
+        base = (const char*)MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+        if (base == nullptr) { close(); return false; }
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+    len = (size_t)st.st_size;
+    if (len > 0) {
+        void* addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) { ::close(fd); len = 0; return false; }
+        base = (const char*)addr;
+        madvise(addr, len, random_access ? MADV_RANDOM : MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+#endif
+    opened = true;
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (base != nullptr) UnmapViewOfFile(base);
+    if (mapping != nullptr) CloseHandle((HANDLE)mapping);
+    if (file != nullptr) CloseHandle((HANDLE)file);
+    mapping = nullptr;
+    file = nullptr;
+#else
+    if (base != nullptr) munmap((void*)base, len);
+#endif
+    base = nullptr;
+    len = 0;
+    opened = false;
+}
+
+void MappedFile::will_need(size_t offset, size_t length) const {
+#ifndef _WIN32
+    if (base == nullptr || offset >= len) return;
+    if (length > len - offset) length = len - offset;
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t first = offset / page * page;
+    madvise((void*)(base + first), offset + length - first, MADV_WILLNEED);
+#else
+    (void)offset;
+    (void)length;
+#endif
+}
+
+bool TsvReader::next_row(string_view& row) {
+    if (cur >= end) return false;
+    const char* nl = (const char*)memchr(cur, '\n', (size_t)(end - cur));
+    const char* stop = nl ? nl : end;
+    row = string_view(cur, (size_t)(stop - cur));
+    cur = nl ? nl + 1 : end;
+    return true;
+}
+
+void TsvReader::split_cells(string_view row, vector<string_view>& cells, char delim) {
+    cells.clear();
+    size_t start = 0;
+    while (start < row.size()) {
+        size_t pos = row.find(delim, start);
+        if (pos == string_view::npos) { cells.push_back(row.substr(start)); break; }
+        cells.push_back(row.substr(start, pos - start));
+        start = pos + 1;
+    }
+}
+
+vector<pair<size_t,size_t>> TsvReader::chunk_ranges(string_view text, size_t parts) {
+    vector<pair<size_t,size_t>> out;
+    size_t size = text.size();
+    if (size == 0) return out;
+    if (parts == 0) parts = 1;
+    size_t step = size / parts;
+    if (step == 0) step = size;
+    size_t begin = 0;
+    while (begin < size) {
+        size_t end = begin + step;
+        if (end >= size || out.size() + 1 >= parts) end = size;
+        else {
+            // move the cut forward to just past the next newline
+            size_t nl = text.find('\n', end - 1);
+            end = nl == string_view::npos ? size : nl + 1;
+        }
+        out.push_back(make_pair(begin, end));
+        begin = end;
+    }
+    return out;
+}
@@ -47,17 +47,17 @@ static int menu_choose_numbered(const vector<string>& items) {
     }
 }
 
-static string format_user_brief(const UserProfile& p) {
-    string s = "id=" + to_string(p.user_id);
-    if (p.age > 0) s += " age=" + to_string(p.age);
-    if (p.gender >= 0) s += " gender=" + to_string(p.gender);
-    s += " clubs=" + to_string(p.clubs.size());
-    s += " friends=" + to_string(p.friends.size());
+static string format_user_brief(const ProfileStore& profiles, int i) {
+    string s = "id=" + to_string(profiles.user_id(i));
+    if (profiles.age(i) > 0) s += " age=" + to_string(profiles.age(i));
+    if (profiles.gender(i) >= 0) s += " gender=" + to_string(profiles.gender(i));
+    s += " clubs=" + to_string(profiles.clubs(i).size());
+    s += " friends=" + to_string(profiles.friends(i).size());
     return s;
 }
 
-void run_terminal_ui(unordered_map<int, UserProfile>& profiles,
-                     const unordered_map<int, vector<int>>& adj_list,
+void run_terminal_ui(const ProfileStore& profiles,
+                     const AdjacencyView& adjacency,
                      Recommender& rec,
                      const unordered_map<int, string>& club_id_to_name,
                      const vector<string>& text_columns,
@@ -74,24 +74,25 @@ void run_terminal_ui(unordered_map<int, UserProfile>& profiles,
             continue;
         }
         if (uid == 0) return;
-        auto it = profiles.find(uid);
-        if (it == profiles.end()) {
+        int pi = profiles.index_of(uid);
+        if (pi < 0) {
             cout << "User not found. Press Enter to continue.";
             string tmp; getline(cin, tmp); getline(cin, tmp);
             continue;
         }
-        const UserProfile &p = it->second;
+        ProfileRange<uint32_t> clubs = profiles.clubs(pi);
+        ProfileRange<uint32_t> friends = profiles.friends(pi);
         while (true) {
             cout << "User overview:\n\n";
-            cout << "  " << format_user_brief(p) << "\n\n";
-            cout << "  Clubs (" << p.clubs.size() << "):\n";
-            for (size_t i = 0; i < p.clubs.size() && i < 10; ++i) {
-                int cid = (int)p.clubs[i];
+            cout << "  " << format_user_brief(profiles, pi) << "\n\n";
+            cout << "  Clubs (" << clubs.size() << "):\n";
+            for (size_t i = 0; i < clubs.size() && i < 10; ++i) {
+                int cid = (int)clubs[i];
                 auto itn = club_id_to_name.find(cid);
                 cout << "    " << cid << " : " << (itn != club_id_to_name.end() ? itn->second : string("<name?>")) << "\n";
             }
-            cout << "\n  Friends (" << p.friends.size() << "):\n";
-            for (size_t i = 0; i < p.friends.size() && i < 20; ++i) cout << "    " << p.friends[i] << (i+1<p.friends.size() ? "," : "") << "\n";
+            cout << "\n  Friends (" << friends.size() << "):\n";
+            for (size_t i = 0; i < friends.size() && i < 20; ++i) cout << "    " << friends[i] << (i+1<friends.size() ? "," : "") << "\n";
             cout << "\nChoose action:\n";
             vector<string> actions = {
                 "Recommend friends (graph + friends-of-friends)",
@@ -1,12 +1,157 @@
 #include "user_loader.h"
 #include "utils.h"
+#include "bin_reader.h"
+#include "serializer.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <random>
+#include <unordered_set>
 
 using namespace std;
 
+static int record_field(uint32_t v) {
+    return v == USER_FIELD_NONE ? -1 : (int)v;
+}
+
+static void add_record(const UserRecordView& rec, const vector<string>& text_columns,
+                       const AdjacencyView& adjacency, ProfileStore& out_profiles)
+{
+    int uid = (int)rec.user_id;
+    array<int,3> region = { -1, -1, -1 };
+    for (size_t i = 0; i < rec.region.size && i < 3; ++i) region[i] = record_field(rec.region[i]);
+    out_profiles.begin_user(uid, record_field(rec.ispublic), record_field(rec.completion_percentage),
+                            record_field(rec.gender), (int)rec.age, region);
+    for (uint32_t club : rec.clubs) out_profiles.add_club(club);
+    for (int f : adjacency.neighbors(uid)) out_profiles.add_friend((uint32_t)f);
+    for (size_t t = 0; t < text_columns.size() && t < rec.token_cols.size(); ++t) {
+        const TokenPairSpan &col = rec.token_cols[t];
+        for (size_t k = 0; k < col.size; ++k) out_profiles.add_token(t, (int)col.token(k), (int)col.count(k));
+    }
+    out_profiles.end_user();
+}
+
+// the store keeps only text_columns, so later token columns are skipped
+static RecordMask store_mask(const vector<string>& text_columns) {
+    RecordMask mask = RecordMask::fixed_only().add_clubs();
+    for (size_t t = 0; t < text_columns.size(); ++t) mask.add_tokens(t);
+    return mask;
+}
+
+bool load_users_bin(const string& users_bin,
+                    const string& users_idx,
+                    const vector<string>& text_columns,
+                    const AdjacencyView& adjacency,
+                    ProfileStore& out_profiles,
+                    size_t max_users)
+{
+    out_profiles.clear();
+    out_profiles.set_num_text_columns(text_columns.size());
+    UserRecordReader reader;
+    if (!reader.open(users_bin, users_idx)) return false;
+    size_t limit = reader.size();
+    if (max_users > 0 && max_users < limit) limit = max_users;
+    out_profiles.reserve(limit);
+
+    const RecordMask mask = store_mask(text_columns);
+    UserRecordView rec;
+    for (size_t c = 0; c < limit; ++c) {
+        if (!reader.read_at(c, rec, mask)) {
+            cout << "Corrupt record for user " << reader.user_id_at(c) << " in " << users_bin << endl;
+            return false;
+        }
+        if (rec.user_id == 0) continue;
+        add_record(rec, text_columns, adjacency, out_profiles);
+    }
+    cout << "Loaded " << out_profiles.size() << " users total" << endl;
+    return true;
+}
+
+bool load_users_bin_sample(const string& users_bin,
+                           const string& users_idx,
+                           const vector<string>& text_columns,
+                           const AdjacencyView& adjacency,
+                           ProfileStore& out_profiles,
+                           size_t max_users,
+                           size_t sample_size)
+{
+    out_profiles.clear();
+    out_profiles.set_num_text_columns(text_columns.size());
+    UserRecordReader reader;
+    if (!reader.open(users_bin, users_idx)) return false;
+    size_t limit = reader.size();
+    if (max_users > 0 && max_users < limit) limit = max_users;
+
+    vector<size_t> rows;
+    if (limit <= sample_size) {
+        rows.resize(limit);
+        for (size_t c = 0; c < limit; ++c) rows[c] = c;
+    } else {
+        // Floyd's algorithm: sample_size distinct rows without a table of all of them
+        mt19937_64 rng(12345);
+        unordered_set<size_t> picked;
+        picked.reserve(sample_size);
+        for (size_t j = limit - sample_size; j < limit; ++j) {
+            size_t r = uniform_int_distribution<size_t>(0, j)(rng);
+            if (!picked.insert(r).second) picked.insert(j);
+        }
+        rows.assign(picked.begin(), picked.end());
+        sort(rows.begin(), rows.end());
+    }
+    out_profiles.reserve(rows.size());
+
+    const RecordMask mask = store_mask(text_columns);
+    UserRecordView rec;
+    for (size_t c : rows) {
+        if (!reader.read_at(c, rec, mask)) {
+            cout << "Corrupt record for user " << reader.user_id_at(c) << " in " << users_bin << endl;
+            return false;
+        }
+        if (rec.user_id == 0) continue;
+        add_record(rec, text_columns, adjacency, out_profiles);
+    }
+    return true;
+}
+
+bool compute_median_age_from_bin(const string& users_bin, const string& users_idx, size_t max_users, int& out_median) {
+    out_median = 0;
+    UserRecordReader reader;
+    if (!reader.open(users_bin, users_idx)) return false;
+    size_t limit = reader.size();
+    if (max_users > 0 && max_users < limit) limit = max_users;
+
+    // real ages are small, so a histogram stands in for the sorted list;
+    // anything past it is kept and sorted on its own
+    vector<uint64_t> hist(256, 0);
+    vector<int> large;
+    uint64_t n = 0;
+    const RecordMask mask = RecordMask::fixed_only();
+    UserRecordView rec;
+    for (size_t c = 0; c < limit; ++c) {
+        if (!reader.read_at(c, rec, mask)) {
+            cout << "Corrupt record for user " << reader.user_id_at(c) << " in " << users_bin << endl;
+            return false;
+        }
+        if (rec.user_id == 0 || (int)rec.age <= 0) continue;
+        if (rec.age < hist.size()) ++hist[rec.age];
+        else large.push_back((int)rec.age);
+        ++n;
+    }
+    if (n == 0) return true;
+    sort(large.begin(), large.end());
+    // k-th smallest age, 0-based
+    auto nth = [&](uint64_t k) {
+        for (size_t a = 0; a < hist.size(); ++a) {
+            if (k < hist[a]) return (int)a;
+            k -= hist[a];
+        }
+        return large[(size_t)k];
+    };
+    out_median = n % 2 ? nth(n / 2) : (nth(n / 2 - 1) + nth(n / 2)) / 2;
+    return true;
+}
+
 bool load_users_encoded(const string& users_encoded_csv,
                         const vector<string>& text_columns,
                         unordered_map<int, UserProfile>& out_profiles,
@@ -30,11 +175,8 @@ bool load_users_encoded(const string& users_encoded_csv,
     
     
     string line;
-    int c = 0;
-    while (getline(in, line) && c < 100000) {
-        if (!(c % 10000)) {
-            cout << "Loaded " << c << " users " << endl;
-        }
+    size_t c = 0;
+    while (getline(in, line) && (max_users == 0 || c < max_users)) {
         c++;
 
         if (line.empty()) continue;
@@ -95,11 +237,11 @@ bool load_users_encoded(const string& users_encoded_csv,
     return true;
 }
 
-int compute_median_age_from_profiles(const unordered_map<int, UserProfile>& profiles) {
+int compute_median_age_from_profiles(const ProfileStore& profiles) {
     vector<int> ages;
     ages.reserve(profiles.size());
-    for (auto &kv : profiles) {
-        int a = kv.second.age;
+    for (int i = 0; i < (int)profiles.size(); ++i) {
+        int a = profiles.age(i);
         if (a > 0) ages.push_back(a);
     }
     if (ages.empty()) return 0;
@@ -128,11 +270,11 @@ bool save_median_age(const string& path, int median) {
     return true;
 }
 
-int fill_missing_ages(unordered_map<int, UserProfile>& profiles, int median_age) {
+int fill_missing_ages(ProfileStore& profiles, int median_age) {
     int cnt = 0;
-    for (auto &kv : profiles) {
-        if (kv.second.age == 0) {
-            kv.second.age = median_age;
+    for (int i = 0; i < (int)profiles.size(); ++i) {
+        if (profiles.age(i) == 0) {
+            profiles.set_age(i, median_age);
             ++cnt;
         }
     }
@@ -1,5 +1,6 @@
 #include "utils.h"
-#include "user_profile.h"
+#include "profile_store.h"
+#include "graph_builder.h"
 #include <fstream>
 #include <sstream>
 #include <algorithm>
@@ -23,12 +24,11 @@ vector<string> load_text_columns_from_file(const string& path) {
     return out;
 }
 
-unordered_map<int, vector<int>> build_adj_list(const unordered_map<int, vector<pair<int,float>>>& adj_weighted) {
+unordered_map<int, vector<int>> build_adj_list(const CsrGraph& graph) {
     unordered_map<int, vector<int>> out;
-    for (auto it = adj_weighted.begin(); it != adj_weighted.end(); ++it) {
-        int u = it->first;
-        const vector<pair<int,float>>& vec = it->second;
-        for (size_t i = 0; i < vec.size(); ++i) out[u].push_back(vec[i].first);
+    for (int u = 0; u < graph.num_nodes(); ++u) {
+        if (graph.degree(u) == 0) continue;
+        out[u].assign(graph.begin(u), graph.end(u));
     }
     return out;
 }
@@ -74,12 +74,14 @@ static inline uint64_t pair_key_uint64(int a, int b) {
     return ( (uint64_t)A << 32 ) | (uint64_t)B;
 }
 
-static float vec_set_similarity_local(const std::vector<uint32_t>& A, const std::vector<uint32_t>& B) {
+static float vec_set_similarity_local(ProfileRange<uint32_t> A, ProfileRange<uint32_t> B) {
     if (A.empty() || B.empty()) return 0.0f;
-    std::unordered_map<uint32_t,int> cnt;
-    for (auto v : A) cnt[v] = 1;
     int inter = 0;
-    for (auto v : B) if (cnt.find(v) != cnt.end()) ++inter;
+    size_t i = 0;
+    for (auto v : B) {
+        while (i < A.size() && A[i] < v) ++i;
+        if (i < A.size() && A[i] == v) ++inter;
+    }
     double denom = sqrt((double)A.size()) * sqrt((double)B.size());
     if (denom <= 0.0) return 0.0f;
     return (float)((double)inter / denom);
@@ -96,24 +98,19 @@ static float region_similarity_local(const std::array<int,3>& A, const std::arra
     return (float)((double)matches / (sqrt((double)a_cnt) * sqrt((double)b_cnt)));
 }
 
-static float cosine_counts_maps_local(const std::unordered_map<int,int>& A, const std::unordered_map<int,int>& B) {
+static float cosine_counts_local(ProfileRange<TokenCount> A, ProfileRange<TokenCount> B) {
     if (A.empty() || B.empty()) return 0.0f;
     double dot = 0.0;
     double suma2 = 0.0;
     double sumb2 = 0.0;
-    for (auto &pa : A) suma2 += (double)pa.second * pa.second;
-    for (auto &pb : B) sumb2 += (double)pb.second * pb.second;
+    for (auto &pa : A) suma2 += (double)pa.count * pa.count;
+    for (auto &pb : B) sumb2 += (double)pb.count * pb.count;
     if (suma2 <= 0.0 || sumb2 <= 0.0) return 0.0f;
-    if (A.size() < B.size()) {
-        for (auto it = A.begin(); it != A.end(); ++it) {
-            auto jt = B.find(it->first);
-            if (jt != B.end()) dot += (double) it->second * jt->second;
-        }
-    } else {
-        for (auto it = B.begin(); it != B.end(); ++it) {
-            auto jt = A.find(it->first);
-            if (jt != A.end()) dot += (double) it->second * jt->second;
-        }
+    size_t i = 0, j = 0;
+    while (i < A.size() && j < B.size()) {
+        if (A[i].token < B[j].token) ++i;
+        else if (B[j].token < A[i].token) ++j;
+        else { dot += (double)A[i].count * B[j].count; ++i; ++j; }
     }
     double norm = sqrt(suma2) * sqrt(sumb2);
     if (norm <= 0.0) return 0.0f;
@@ -153,18 +150,15 @@ bool save_column_normalizers(const string& path, const unordered_map<string, pai
 }
 
 unordered_map<string, pair<float,float>> compute_column_normalizers(
-    const unordered_map<int, UserProfile>& profiles,
+    const ProfileStore& profiles,
     const vector<string>& text_columns,
     int sample_size,
     int comps_per_user)
 {
     unordered_map<string, pair<float,float>> result;
     if (profiles.empty()) return result;
-    vector<int> ids;
-    ids.reserve(profiles.size());
-    for (auto &kv : profiles) ids.push_back(kv.first);
     mt19937 rng(12345);
-    uniform_int_distribution<size_t> dist(0, ids.size() - 1);
+    uniform_int_distribution<size_t> dist(0, profiles.size() - 1);
     size_t total_needed = (size_t)sample_size * (size_t)comps_per_user;
     unordered_set<uint64_t> seen_pairs;
     vector<vector<double>> vals_text(text_columns.size());
@@ -174,44 +168,43 @@ unordered_map<string, pair<float,float>> compute_column_normalizers(
     size_t attempts = 0;
     while (seen_pairs.size() < total_needed && attempts < total_needed * 10) {
         ++attempts;
-        int a = ids[ dist(rng) ];
-        int b = ids[ dist(rng) ];
+        int a = (int)dist(rng);
+        int b = (int)dist(rng);
         if (a == b) continue;
         uint64_t key = pair_key_uint64(a,b);
         if (!seen_pairs.insert(key).second) continue;
-        const UserProfile &A = profiles.at(a);
-        const UserProfile &B = profiles.at(b);
         double s_pub = 0.0;
-        if (A.public_flag >= 0 && B.public_flag >= 0 && A.public_flag == B.public_flag) s_pub = 1.0;
+        int pub_a = profiles.public_flag(a), pub_b = profiles.public_flag(b);
+        if (pub_a >= 0 && pub_b >= 0 && pub_a == pub_b) s_pub = 1.0;
         vals_field["public"].push_back(s_pub);
         double s_gen = 0.0;
-        if (A.gender >= 0 && B.gender >= 0 && A.gender == B.gender) s_gen = 1.0;
+        int gen_a = profiles.gender(a), gen_b = profiles.gender(b);
+        if (gen_a >= 0 && gen_b >= 0 && gen_a == gen_b) s_gen = 1.0;
         vals_field["gender"].push_back(s_gen);
         double s_comp = 0.0;
-        if (A.completion_percentage > 0 && B.completion_percentage > 0) {
-            int amin = std::min(A.completion_percentage, B.completion_percentage);
-            int amax = std::max(A.completion_percentage, B.completion_percentage);
+        int comp_a = profiles.completion_percentage(a), comp_b = profiles.completion_percentage(b);
+        if (comp_a > 0 && comp_b > 0) {
+            int amin = std::min(comp_a, comp_b);
+            int amax = std::max(comp_a, comp_b);
             if (amax > 0) s_comp = (double)amin / (double)amax;
         }
         vals_field["completion"].push_back(s_comp);
         double s_age = 0.0;
-        if (A.age > 0 && B.age > 0) {
-            int amin = std::min(A.age, B.age);
-            int amax = std::max(A.age, B.age);
+        int age_a = profiles.age(a), age_b = profiles.age(b);
+        if (age_a > 0 && age_b > 0) {
+            int amin = std::min(age_a, age_b);
+            int amax = std::max(age_a, age_b);
             if (amax > 0) s_age = (double)amin / (double)amax;
         }
         vals_field["age"].push_back(s_age);
-        double s_reg = region_similarity_local(A.region_parts, B.region_parts);
+        double s_reg = region_similarity_local(profiles.region_parts(a), profiles.region_parts(b));
         vals_field["region"].push_back(s_reg);
-        double s_clubs = vec_set_similarity_local(A.clubs, B.clubs);
+        double s_clubs = vec_set_similarity_local(profiles.clubs(a), profiles.clubs(b));
         vals_field["clubs"].push_back(s_clubs);
-        double s_friends = vec_set_similarity_local(A.friends, B.friends);
+        double s_friends = vec_set_similarity_local(profiles.friends(a), profiles.friends(b));
         vals_field["friends"].push_back(s_friends);
         for (size_t t = 0; t < text_columns.size(); ++t) {
-            double s = 0.0;
-            if (t < A.token_cols.size() && t < B.token_cols.size()) {
-                s = cosine_counts_maps_local(A.token_cols[t], B.token_cols[t]);
-            }
+            double s = cosine_counts_local(profiles.tokens(a, t), profiles.tokens(b, t));
             vals_text[t].push_back(s);
         }
     }
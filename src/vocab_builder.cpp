@@ -1,10 +1,15 @@
 #include "vocab_builder.h"
 #include <fstream>
-#include <sstream>
-#include <regex>
 #include <filesystem>
 #include <algorithm>
 #include <unordered_set>
+#include <thread>
+#include <iostream>
+#include "utils.h"
+#include "club_links.h"
+#include "token_cache.h"
+#include "tsv_reader.h"
+#include "vocab_view.h"
 
 using namespace std;
 namespace fs = std::filesystem;
@@ -50,56 +55,75 @@ string VocabBuilder::normalize_address(const string& raw) {
     return out.substr(a, b - a);
 }
 
-void VocabBuilder::process_line_clubs(const string& line) {
-    regex href_re("<a[^>]*href=\"/klub/([^\"]+)\"[^>]*>([^<]*)</a>");
-    string::const_iterator start = line.cbegin();
-    smatch m;
-    while (regex_search(start, line.cend(), m, href_re)) {
-        string raw_slug = m[1].str();
-        string title = m[2].str();
-        string slug = normalize_slug(raw_slug);
-        if (slug.empty() && title.empty()) { start = m.suffix().first; continue; }
-        if (club_to_id.find(slug) == club_to_id.end()) {
-            int nid = (int)club_to_id.size();
-            club_to_id[slug] = nid;
-            club_slug_to_title[slug] = title;
-        }
-        start = m.suffix().first;
+// Ids handed out by one chunk of pass1, in order of first appearance.
+// Merging chunks in file order reproduces the ids of a sequential scan.
+struct OrderedIds {
+    unordered_map<string,int> ids;
+    vector<string> order;
+    int add(const string &s) {
+        auto it = ids.find(s);
+        if (it != ids.end()) return it->second;
+        int nid = (int)order.size();
+        ids.emplace(s, nid);
+        order.push_back(s);
+        return nid;
+    }
+};
+
+struct VocabBuilder::Partial {
+    vector<OrderedIds> tokens;
+    vector<vector<int>> docfreq;
+    OrderedIds clubs;
+    vector<string> club_titles;
+    OrderedIds part1, part2, part3;
+    bool write_cache = false;
+    TokenCacheWriter cache;
+    vector<vector<int>> line_ids;
+    LemmaCache lemmas;
+    TokenBuffer words;
+    uint64_t docs = 0;
+};
+
+void VocabBuilder::process_line_clubs(string_view line, Partial &part) {
+    vector<ClubLink> links;
+    scan_club_links(line, ClubAnchor, links);
+    for (const ClubLink &link : links) {
+        string title(link.title);
+        string slug = normalize_slug(string(link.slug));
+        if (slug.empty() && title.empty()) continue;
+        size_t known = part.clubs.order.size();
+        part.clubs.add(slug);
+        if (part.clubs.order.size() != known) part.club_titles.push_back(title);
     }
 }
 
-void VocabBuilder::process_line_tokens(const vector<string>& cols, Tokenizer &tok, Lemmatiser &lem) {
+void VocabBuilder::process_line_tokens(const vector<string_view>& cols, Tokenizer &tok, Lemmatiser &lem, Partial &part) const {
     const size_t base_idx = 9;
+    part.line_ids.resize(colKeys.size());
+    for (auto &ids : part.line_ids) ids.clear();
     for (size_t ci = 0; ci < colKeys.size(); ++ci) {
-        const string &key = colKeys[ci];
         size_t idx = base_idx + ci;
         if (idx >= cols.size()) continue;
-        string text = cols[idx];
+        string_view text = cols[idx];
         if (text.empty() || text == "null") continue;
-        vector<string> tokens = tok.tokenize(text);
-        vector<string> lem_tokens = lem.lemmatize_tokens(tokens);
+        tok.tokenize(text, part.words);
+        vector<string> lem_tokens = lem.lemmatize_tokens(part.words.tokens, part.lemmas);
+        OrderedIds &ids = part.tokens[ci];
+        vector<int> &df = part.docfreq[ci];
         unordered_set<int> seen_terms;
         for (const string &t : lem_tokens) {
             if (t.empty()) continue;
-            auto it = token2id_per_col[key].find(t);
-            if (it == token2id_per_col[key].end()) {
-                int nid = (int)token2id_per_col[key].size();
-                token2id_per_col[key][t] = nid;
-                docfreq_per_col[key][nid] = 0;
-                it = token2id_per_col[key].find(t);
-            }
-            int tid = it->second;
-            if (seen_terms.find(tid) == seen_terms.end()) {
-                docfreq_per_col[key][tid] += 1;
-                seen_terms.insert(tid);
-            }
+            int tid = ids.add(t);
+            if (tid == (int)df.size()) df.push_back(0);
+            part.line_ids[ci].push_back(tid);
+            if (seen_terms.insert(tid).second) df[tid] += 1;
         }
     }
 }
 
-void VocabBuilder::process_region_parts_from_cols(const vector<string>& cols) {
+void VocabBuilder::process_region_parts_from_cols(const vector<string_view>& cols, Partial &part) {
     if (cols.size() <= 4) return;
-    string raw_region = cols[4];
+    string raw_region(cols[4]);
     if (raw_region.empty() || raw_region == "null") return;
     string nr = normalize_address(raw_region);
     string part1, rest;
@@ -115,9 +139,9 @@ void VocabBuilder::process_region_parts_from_cols(const vector<string>& cols) {
         else { part2 = rest; part3.clear(); }
     }
     trim(part2); trim(part3);
-    if (!part1.empty() && part1 != "null") if (address_part1_to_id.find(part1) == address_part1_to_id.end()) address_part1_to_id[part1] = (int)address_part1_to_id.size();
-    if (!part2.empty() && part2 != "null") if (address_part2_to_id.find(part2) == address_part2_to_id.end()) address_part2_to_id[part2] = (int)address_part2_to_id.size();
-    if (!part3.empty() && part3 != "null") if (address_part3_to_id.find(part3) == address_part3_to_id.end()) address_part3_to_id[part3] = (int)address_part3_to_id.size();
+    if (!part1.empty() && part1 != "null") part.part1.add(part1);
+    if (!part2.empty() && part2 != "null") part.part2.add(part2);
+    if (!part3.empty() && part3 != "null") part.part3.add(part3);
 }
 
 static vector<string> split_csv_line_local(const string& line) {
@@ -130,6 +154,47 @@ static vector<string> split_csv_line_local(const string& line) {
     out.push_back(cur); return out;
 }
 
+bool VocabBuilder::load_vocab_bin(const string &path) {
+    VocabView view;
+    if (!view.open(path)) return false;
+    auto strings_to_map = [](const VocabTable &t, unordered_map<string,int> &m) {
+        m.reserve(t.size());
+        for (uint32_t id = 0; id < t.size(); ++id) {
+            string_view s = t.str(id);
+            if (!s.empty() || (int)id == t.empty_id()) m.emplace(string(s), (int)id);
+        }
+    };
+    const string token_prefix = "tokens/";
+    for (const auto &entry : view.tables()) {
+        const VocabTable &t = entry.second;
+        string name(entry.first);
+        if (name.compare(0, token_prefix.size(), token_prefix) == 0) {
+            string col = name.substr(token_prefix.size());
+            auto &t2id = token2id_per_col[col];
+            auto &dfmap = docfreq_per_col[col];
+            if (t.has_strings()) {
+                strings_to_map(t, t2id);
+                for (uint32_t id = 0; id < t.size(); ++id) if (!t.str(id).empty()) dfmap[(int)id] = (int)t.df(id);
+            } else {
+                for (uint32_t i = 0; i < t.size(); ++i) dfmap[(int)t.df_pair(i).first] = (int)t.df_pair(i).second;
+            }
+        } else if (name == "clubs") {
+            strings_to_map(t, club_to_id);
+        } else if (name == "club_titles") {
+            const VocabTable* slugs = view.table("clubs");
+            for (uint32_t id = 0; slugs && id < t.size() && id < slugs->size(); ++id)
+                if (!slugs->str(id).empty() || (int)id == slugs->empty_id()) club_slug_to_title[string(slugs->str(id))] = string(t.str(id));
+        } else if (name == "address_part1") {
+            strings_to_map(t, address_part1_to_id);
+        } else if (name == "address_part2") {
+            strings_to_map(t, address_part2_to_id);
+        } else if (name == "address_part3") {
+            strings_to_map(t, address_part3_to_id);
+        }
+    }
+    return true;
+}
+
 bool VocabBuilder::load_vocab(const string &in_dir) {
     token2id_per_col.clear();
     docfreq_per_col.clear();
@@ -138,6 +203,9 @@ bool VocabBuilder::load_vocab(const string &in_dir) {
     address_part1_to_id.clear();
     address_part2_to_id.clear();
     address_part3_to_id.clear();
+    if (load_vocab_bin((fs::path(in_dir) / "vocab.bin").string())) return true;
+    token2id_per_col.clear();
+    docfreq_per_col.clear();
     ifstream tok_in((fs::path(in_dir) / "tokens.csv").string());
     if (!tok_in.is_open()) return false;
     string header;
@@ -155,7 +223,8 @@ bool VocabBuilder::load_vocab(const string &in_dir) {
             token2id_per_col[col] = unordered_map<string,int>();
             docfreq_per_col[col] = unordered_map<int,int>();
         }
-        token2id_per_col[col][token] = tid;
+        // hashed vocabs store no token strings, only the counts per id
+        if (!token.empty()) token2id_per_col[col][token] = tid;
         docfreq_per_col[col][tid] = df;
     }
     tok_in.close();
@@ -196,22 +265,224 @@ bool VocabBuilder::load_vocab(const string &in_dir) {
     return true;
 }
 
-void VocabBuilder::pass1(const string &profiles_tsv, Tokenizer &tok, Lemmatiser &lem) {
-    ifstream in(profiles_tsv);
-    if (!in.is_open()) return;
-    string line;
-    while (getline(in, line)) {
+void VocabBuilder::pass1_range(string_view chunk, Tokenizer &tok, Lemmatiser &lem, Partial &part) const {
+    part.tokens.assign(colKeys.size(), OrderedIds());
+    part.docfreq.assign(colKeys.size(), vector<int>());
+    TsvReader reader(chunk);
+    string_view line;
+    vector<string_view> cols;
+    while (reader.next_row(line)) {
         if (line.empty()) continue;
-        vector<string> cols;
-        string cell;
-        stringstream ss(line);
-        while (getline(ss, cell, '\t')) cols.push_back(cell);
+        TsvReader::split_cells(line, cols);
         if (cols.empty()) continue;
-        process_region_parts_from_cols(cols);
-        process_line_clubs(line);
-        process_line_tokens(cols, tok, lem);
+        process_region_parts_from_cols(cols, part);
+        process_line_clubs(line, part);
+        process_line_tokens(cols, tok, lem, part);
+        ++part.docs;
+        if (part.write_cache) part.cache.add((uint32_t)parse_int(cols[0]), part.line_ids);
+    }
+    if (part.write_cache) part.cache.close();
+}
+
+void VocabBuilder::merge_partial(const Partial &part, const unordered_set<string> &stopwords, vector<vector<int>> &remap) {
+    remap.assign(colKeys.size(), vector<int>());
+    for (size_t ci = 0; ci < colKeys.size() && ci < part.tokens.size(); ++ci) {
+        const string &key = colKeys[ci];
+        auto &t2id = token2id_per_col[key];
+        auto &dfmap = docfreq_per_col[key];
+        const OrderedIds &ids = part.tokens[ci];
+        for (size_t li = 0; li < ids.order.size(); ++li) {
+            const string &t = ids.order[li];
+            if (options.hash_bits > 0) {
+                if (stopwords.count(t)) { remap[ci].push_back(-1); continue; }
+                int hid = hashed_token_id(t, options.hash_bits);
+                dfmap[hid] += part.docfreq[ci][li];
+                remap[ci].push_back(hid);
+                continue;
+            }
+            auto it = t2id.find(t);
+            if (it == t2id.end() && stopwords.count(t)) { remap[ci].push_back(-1); continue; }
+            if (it == t2id.end()) {
+                int nid = (int)t2id.size();
+                it = t2id.emplace(t, nid).first;
+                dfmap[nid] = 0;
+            }
+            dfmap[it->second] += part.docfreq[ci][li];
+            remap[ci].push_back(it->second);
+        }
+    }
+    for (size_t i = 0; i < part.clubs.order.size(); ++i) {
+        const string &slug = part.clubs.order[i];
+        if (club_to_id.find(slug) != club_to_id.end()) continue;
+        int nid = (int)club_to_id.size();
+        club_to_id[slug] = nid;
+        club_slug_to_title[slug] = part.club_titles[i];
+    }
+    auto merge_part = [](const OrderedIds &src, unordered_map<string,int> &dst) {
+        for (const string &v : src.order)
+            if (dst.find(v) == dst.end()) dst[v] = (int)dst.size();
+    };
+    merge_part(part.part1, address_part1_to_id);
+    merge_part(part.part2, address_part2_to_id);
+    merge_part(part.part3, address_part3_to_id);
+}
+
+// Drops the tokens with ids from first_new[ci] on whose df is outside
+// [min_df, max_df * docs] and renumbers the rest densely after first_new.
+void VocabBuilder::prune_tokens(const vector<size_t> &first_new, uint64_t docs, vector<vector<vector<int>>> &remaps) {
+    const uint64_t max_count = options.max_df < 1.0 ? (uint64_t)(options.max_df * (double)docs) : UINT64_MAX;
+    size_t seen = 0, dropped = 0;
+    for (size_t ci = 0; ci < colKeys.size(); ++ci) {
+        auto &t2id = token2id_per_col[colKeys[ci]];
+        auto &dfmap = docfreq_per_col[colKeys[ci]];
+        const size_t first = first_new[ci];
+        vector<int> new_id(t2id.size(), -1);
+        for (size_t id = 0; id < first && id < new_id.size(); ++id) new_id[id] = (int)id;
+        int next = (int)first;
+        for (size_t id = first; id < new_id.size(); ++id) {
+            int df = dfmap[(int)id];
+            if (df >= options.min_df && (uint64_t)df <= max_count) new_id[id] = next++;
+        }
+        seen += new_id.size() - first;
+        vector<pair<int,int>> moved;  // new id, df
+        for (auto it = t2id.begin(); it != t2id.end();) {
+            size_t id = (size_t)it->second;
+            if (id < first || id >= new_id.size()) { ++it; continue; }
+            moved.emplace_back(new_id[id], dfmap[it->second]);
+            dfmap.erase(it->second);
+            if (new_id[id] < 0) { it = t2id.erase(it); ++dropped; continue; }
+            it->second = new_id[id];
+            ++it;
+        }
+        for (auto &pr : moved) if (pr.first >= 0) dfmap[pr.first] = pr.second;
+        for (auto &chunk : remaps)
+            for (int &id : chunk[ci])
+                if (id >= 0) id = (size_t)id < new_id.size() ? new_id[id] : -1;
+    }
+    cout << "[vocab] pruned " << dropped << " of " << seen << " new tokens (min_df=" << options.min_df
+         << ", max_df=" << options.max_df << ")\n";
+}
+
+void VocabBuilder::pass1(const string &profiles_tsv, Tokenizer &tok, Lemmatiser &lem, int num_threads) {
+    if (num_threads <= 0) num_threads = (int)max(1u, thread::hardware_concurrency());
+    pass1_rows = 0;
+    MappedFile profiles;
+    if (!profiles.open(profiles_tsv)) return;
+    vector<pair<size_t,size_t>> ranges = TsvReader::chunk_ranges(profiles.view(), (size_t)num_threads);
+    if (ranges.empty()) return;
+
+    // tok and lem are shared (see tokenizer.h); lemmas are memoized per Partial.
+    vector<Partial> parts(ranges.size());
+    vector<string> cache_parts;
+    if (!token_cache_path.empty()) {
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            cache_parts.push_back(token_cache_path + ".part" + to_string(i));
+            parts[i].write_cache = parts[i].cache.open_part(cache_parts.back());
+        }
+    }
+    vector<thread> workers;
+    workers.reserve(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        workers.emplace_back([&, i]() {
+            pass1_range(profiles.view().substr(ranges[i].first, ranges[i].second - ranges[i].first), tok, lem, parts[i]);
+        });
+    }
+    for (auto &w : workers) w.join();
+
+    unordered_set<string> stopwords;
+    if (!options.stopwords_path.empty() && !load_stopwords(options.stopwords_path, stopwords))
+        cout << "[vocab] cannot read stopwords from " << options.stopwords_path << "\n";
+    vector<size_t> first_new;
+    for (const auto &key : colKeys) first_new.push_back(token2id_per_col[key].size());
+
+    vector<vector<vector<int>>> remaps(parts.size());
+    bool cache_ok = !cache_parts.empty();
+    uint64_t lemma_hits = 0, lemma_misses = 0, docs = 0;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        lemma_hits += parts[i].lemmas.hits;
+        lemma_misses += parts[i].lemmas.misses;
+        docs += parts[i].docs;
+        cache_ok = cache_ok && parts[i].write_cache;
+        merge_partial(parts[i], stopwords, remaps[i]);
+        parts[i] = Partial();
+    }
+    pass1_rows = docs;
+    if (options.hash_bits <= 0 && (options.min_df > 1 || options.max_df < 1.0))
+        prune_tokens(first_new, docs, remaps);
+    if (lemma_hits + lemma_misses > 0) {
+        cout << "[vocab] lemma cache: " << lemma_hits << " hits, " << lemma_misses << " misses ("
+             << (100.0 * (double)lemma_hits / (double)(lemma_hits + lemma_misses)) << "% hit rate)\n";
+    }
+
+    if (cache_ok) {
+        vector<uint32_t> vocab_sizes;
+        for (const auto &key : colKeys) vocab_sizes.push_back((uint32_t)token2id_per_col[key].size());
+        uint64_t source_size = (uint64_t)profiles.size();
+        TokenCacheWriter::finalize(token_cache_path, cache_parts, remaps, source_size, vocab_sizes);
+    } else {
+        error_code ec;
+        for (const string &pp : cache_parts) fs::remove(pp, ec);
     }
-    in.close();
+}
+
+bool load_stopwords(const string &path, unordered_set<string> &out) {
+    ifstream in(path);
+    if (!in.is_open()) return false;
+    string line;
+    while (getline(in, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        out.insert(line);
+    }
+    return true;
+}
+
+bool vocab_options_ok(const VocabOptions &opts) {
+    return opts.min_df >= 1 && opts.max_df > 0.0 && opts.max_df <= 1.0
+        && opts.hash_bits >= 0 && opts.hash_bits <= VOCAB_MAX_HASH_BITS;
+}
+
+static string trim_spaces(const string &s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    if (b == string::npos) return "";
+    size_t e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+bool load_vocab_options(const string &path, VocabOptions &out) {
+    ifstream in(path);
+    if (!in.is_open()) return true;
+    VocabOptions opts;
+    string line;
+    for (int line_no = 1; getline(in, line); ++line_no) {
+        line = trim_spaces(line);
+        if (line.empty() || line[0] == '#') continue;
+        size_t eq = line.find('=');
+        string key = trim_spaces(line.substr(0, eq));
+        string value = eq == string::npos ? "" : trim_spaces(line.substr(eq + 1));
+        size_t used = 0;
+        try {
+            if (eq == string::npos) used = string::npos;
+            else if (key == "min_df") { opts.min_df = stoi(value, &used); }
+            else if (key == "max_df") { opts.max_df = stod(value, &used); }
+            else if (key == "hash_bits") { opts.hash_bits = stoi(value, &used); }
+            else if (key == "stopwords") { opts.stopwords_path = value; used = value.size(); }
+            else used = string::npos;
+        } catch (...) {
+            used = string::npos;
+        }
+        if (used != value.size()) {
+            cout << "[vocab] " << path << ":" << line_no << ": cannot read '" << line << "'\n";
+            return false;
+        }
+    }
+    if (!vocab_options_ok(opts)) {
+        cout << "[vocab] " << path << ": need min_df >= 1, 0 < max_df <= 1 and hash_bits in 0.."
+             << VOCAB_MAX_HASH_BITS << "\n";
+        return false;
+    }
+    out = opts;
+    return true;
 }
 
 string VocabBuilder::csv_escape(const string& s) {
@@ -261,6 +532,13 @@ void VocabBuilder::save_vocab(const string &out_dir) const {
                     tok_out << "," << tid << "," << df << "\n";
                 }
             }
+            if (options.hash_bits > 0) {
+                for (const auto &col : docfreq_per_col) {
+                    vector<pair<int,int>> ids(col.second.begin(), col.second.end());
+                    sort(ids.begin(), ids.end());
+                    for (const auto &pr : ids) tok_out << col.first << ",," << pr.first << "," << pr.second << "\n";
+                }
+            }
             tok_out.close();
         }
     }
@@ -305,4 +583,53 @@ void VocabBuilder::save_vocab(const string &out_dir) const {
     write_part(address_part1_to_id, "addresses_part1.csv", "address_part1_id,address_part1");
     write_part(address_part2_to_id, "addresses_part2.csv", "address_part2_id,address_part2");
     write_part(address_part3_to_id, "addresses_part3.csv", "address_part3_id,address_part3");
+
+    vector<VocabTableSource> tables;
+    auto by_id = [](const unordered_map<string,int> &m, VocabTableSource &t) {
+        for (auto &kv : m) {
+            if (kv.second < 0) continue;
+            if ((size_t)kv.second >= t.strings.size()) t.strings.resize((size_t)kv.second + 1);
+            t.strings[(size_t)kv.second] = kv.first;
+            if (kv.first.empty()) t.empty_id = kv.second;
+        }
+    };
+    for (const auto &col : token2id_per_col) {
+        VocabTableSource t;
+        t.name = "tokens/" + col.first;
+        auto dit = docfreq_per_col.find(col.first);
+        if (options.hash_bits > 0) {
+            if (dit != docfreq_per_col.end())
+                for (auto &pr : dit->second) t.df_pairs.push_back(make_pair((uint32_t)pr.first, (uint32_t)pr.second));
+            sort(t.df_pairs.begin(), t.df_pairs.end());
+            // an empty pair list would read as a string table
+            if (!t.df_pairs.empty()) { tables.push_back(std::move(t)); continue; }
+        }
+        by_id(col.second, t);
+        t.df.assign(t.strings.size(), 0);
+        if (dit != docfreq_per_col.end())
+            for (auto &pr : dit->second)
+                if (pr.first >= 0 && (size_t)pr.first < t.df.size()) t.df[(size_t)pr.first] = (uint32_t)pr.second;
+        tables.push_back(std::move(t));
+    }
+    VocabTableSource clubs, titles;
+    clubs.name = "clubs";
+    by_id(club_to_id, clubs);
+    titles.name = "club_titles";
+    titles.index = false;
+    titles.strings.resize(clubs.strings.size());
+    for (size_t id = 0; id < clubs.strings.size(); ++id) {
+        auto it = club_slug_to_title.find(string(clubs.strings[id]));
+        if (it != club_slug_to_title.end()) titles.strings[id] = it->second;
+    }
+    tables.push_back(std::move(clubs));
+    tables.push_back(std::move(titles));
+    const unordered_map<string,int>* parts[3] = { &address_part1_to_id, &address_part2_to_id, &address_part3_to_id };
+    for (int i = 0; i < 3; ++i) {
+        VocabTableSource t;
+        t.name = "address_part" + to_string(i + 1);
+        by_id(*parts[i], t);
+        tables.push_back(std::move(t));
+    }
+    if (!write_vocab_bin(out_dir + "/vocab.bin", tables))
+        cout << "[vocab] cannot write " << out_dir << "/vocab.bin\n";
 }
@@ -0,0 +1,278 @@
+#include "vocab_view.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+static const char VOCAB_BIN_MAGIC[4] = { 'P', 'K', 'V', 'B' };
+static const uint32_t VOCAB_BIN_VERSION = 1;
+
+enum : uint32_t {
+    TableStrings = 1,
+    TableIndex = 2,
+    TableDf = 4,
+    TableDfPairs = 8,
+};
+
+// Fixed part of a table, followed by the name and the sections its flags list.
+struct VocabTableHeader {
+    uint32_t name_len;
+    uint32_t n;
+    uint32_t keys;
+    uint32_t buckets;
+    uint32_t flags;
+    uint32_t empty_id;  // UINT32_MAX when no entry is ""
+    uint64_t seed;
+    uint64_t arena_len;
+};
+
+static uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+static uint64_t key_hash(string_view s, uint64_t seed) {
+    uint64_t h = 14695981039346656037ull ^ seed;
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ull; }
+    return fmix64(h);
+}
+
+static uint32_t bucket_of(uint64_t h, uint32_t buckets) {
+    return (uint32_t)((h >> 32) % buckets);
+}
+
+static uint32_t slot_of(uint64_t h, uint32_t pilot, uint32_t keys) {
+    return (uint32_t)(fmix64(h ^ (((uint64_t)pilot + 1) * 0x9E3779B97F4A7C15ull)) % keys);
+}
+
+// Places the largest buckets first, each with the smallest pilot that moves
+// all its keys to free slots. Retries with another seed if a bucket gets stuck.
+static bool build_index(const vector<string_view>& strings, const vector<uint32_t>& key_ids,
+                        uint64_t& seed, vector<uint32_t>& pilots, vector<uint32_t>& slot_ids) {
+    const uint32_t keys = (uint32_t)key_ids.size();
+    const uint32_t buckets = (keys + 2) / 3;
+    const uint32_t max_pilot = 1u << 24;
+    vector<uint64_t> hashes(keys);
+    vector<vector<uint32_t>> members(buckets);
+    vector<uint32_t> order(buckets);
+    vector<char> taken(keys);
+    vector<uint32_t> slots;
+    for (uint32_t attempt = 0; attempt < 16; ++attempt) {
+        seed = fmix64(attempt + 1);
+        for (auto &m : members) m.clear();
+        for (uint32_t k = 0; k < keys; ++k) {
+            hashes[k] = key_hash(strings[key_ids[k]], seed);
+            members[bucket_of(hashes[k], buckets)].push_back(k);
+        }
+        for (uint32_t b = 0; b < buckets; ++b) order[b] = b;
+        stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return members[a].size() > members[b].size(); });
+        fill(taken.begin(), taken.end(), 0);
+        pilots.assign(buckets, 0);
+        slot_ids.assign(keys, 0);
+        bool placed_all = true;
+        for (uint32_t b : order) {
+            const vector<uint32_t> &m = members[b];
+            if (m.empty()) break;
+            uint32_t pilot = 0;
+            for (; pilot < max_pilot; ++pilot) {
+                slots.clear();
+                bool free = true;
+                for (uint32_t k : m) {
+                    uint32_t s = slot_of(hashes[k], pilot, keys);
+                    if (taken[s] || find(slots.begin(), slots.end(), s) != slots.end()) { free = false; break; }
+                    slots.push_back(s);
+                }
+                if (free) break;
+            }
+            if (pilot == max_pilot) { placed_all = false; break; }
+            pilots[b] = pilot;
+            for (size_t i = 0; i < m.size(); ++i) {
+                taken[slots[i]] = 1;
+                slot_ids[slots[i]] = key_ids[m[i]];
+            }
+        }
+        if (placed_all) return true;
+    }
+    return false;
+}
+
+static void put_u32(string& out, uint32_t v) { out.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+static void pad8(string& out) { out.append((8 - out.size() % 8) % 8, '\0'); }
+
+bool write_vocab_bin(const string& path, const vector<VocabTableSource>& tables) {
+    string out;
+    out.append(VOCAB_BIN_MAGIC, 4);
+    put_u32(out, VOCAB_BIN_VERSION);
+    put_u32(out, (uint32_t)tables.size());
+    put_u32(out, 0);
+    const size_t dir = out.size();
+    out.append(tables.size() * sizeof(uint64_t), '\0');
+
+    for (size_t t = 0; t < tables.size(); ++t) {
+        const VocabTableSource &src = tables[t];
+        uint64_t table_offset = out.size();
+        memcpy(&out[dir + t * sizeof(uint64_t)], &table_offset, sizeof(table_offset));
+
+        const bool strings = src.df_pairs.empty();
+        vector<uint32_t> key_ids, pilots, slot_ids;
+        uint64_t seed = 0;
+        if (strings && src.index) {
+            for (uint32_t id = 0; id < src.strings.size(); ++id)
+                if (!src.strings[id].empty()) key_ids.push_back(id);
+            if (!build_index(src.strings, key_ids, seed, pilots, slot_ids)) return false;
+        }
+        VocabTableHeader h;
+        memset(&h, 0, sizeof(h));
+        h.name_len = (uint32_t)src.name.size();
+        h.n = strings ? (uint32_t)src.strings.size() : (uint32_t)src.df_pairs.size();
+        h.keys = (uint32_t)key_ids.size();
+        h.buckets = (uint32_t)pilots.size();
+        h.flags = strings ? TableStrings : TableDfPairs;
+        if (strings && src.index) h.flags |= TableIndex;
+        if (strings && !src.df.empty()) h.flags |= TableDf;
+        h.seed = seed;
+        h.empty_id = src.empty_id >= 0 ? (uint32_t)src.empty_id : UINT32_MAX;
+        for (string_view s : src.strings) h.arena_len += s.size();
+        if (strings && h.arena_len > UINT32_MAX) return false;
+        out.append(reinterpret_cast<const char*>(&h), sizeof(h));
+        out += src.name;
+        pad8(out);
+
+        if (strings) {
+            uint32_t off = 0;
+            for (string_view s : src.strings) { put_u32(out, off); off += (uint32_t)s.size(); }
+            put_u32(out, off);
+            pad8(out);
+            for (string_view s : src.strings) out.append(s.data(), s.size());
+            pad8(out);
+            for (uint32_t p : pilots) put_u32(out, p);
+            pad8(out);
+            for (uint32_t id : slot_ids) put_u32(out, id);
+            pad8(out);
+            if (!src.df.empty()) {
+                for (size_t id = 0; id < src.strings.size(); ++id) put_u32(out, id < src.df.size() ? src.df[id] : 0);
+                pad8(out);
+            }
+        } else {
+            for (auto &pr : src.df_pairs) { put_u32(out, pr.first); put_u32(out, pr.second); }
+            pad8(out);
+        }
+    }
+
+    // replaced by rename, so a mapping of the previous file stays intact
+    const string tmp = path + ".tmp";
+    {
+        ofstream f(tmp, ios::binary | ios::trunc);
+        if (!f.is_open()) return false;
+        f.write(out.data(), (streamsize)out.size());
+        if (!f) return false;
+    }
+    error_code ec;
+    filesystem::rename(tmp, path, ec);
+    return !ec;
+}
+
+int VocabTable::find(string_view s) const {
+    if (s.empty()) return empty;
+    if (!pilots || keys == 0) return -1;
+    uint64_t h = key_hash(s, seed);
+    uint32_t id = slot_ids[slot_of(h, pilots[bucket_of(h, buckets)], keys)];
+    return str(id) == s ? (int)id : -1;
+}
+
+string_view VocabTable::str(uint32_t id) const {
+    if (!offsets || id >= n) return string_view();
+    return string_view(arena + offsets[id], offsets[id + 1] - offsets[id]);
+}
+
+uint32_t VocabTable::df(uint32_t id) const {
+    if (!df_data) return 0;
+    if (!paired_df) return id < n ? df_data[id] : 0;
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (df_data[2 * mid] < id) lo = mid + 1; else hi = mid;
+    }
+    return lo < n && df_data[2 * lo] == id ? df_data[2 * lo + 1] : 0;
+}
+
+bool VocabView::open(const string& path) {
+    close();
+    if (!file.open(path)) return false;
+    const char* base = file.view().data();
+    const size_t size = file.size();
+    size_t pos = 0;
+    // hands out the next len bytes, keeping sections 8-byte aligned
+    auto take = [&](size_t len, const char*& p) {
+        if (len > size - pos) return false;
+        p = base + pos;
+        pos += len;
+        pos += (8 - pos % 8) % 8;
+        if (pos > size) pos = size;
+        return true;
+    };
+    uint32_t version = 0, count = 0;
+    if (size < 16 || memcmp(base, VOCAB_BIN_MAGIC, 4) != 0) { close(); return false; }
+    memcpy(&version, base + 4, 4);
+    memcpy(&count, base + 8, 4);
+    if (version != VOCAB_BIN_VERSION || (uint64_t)count * 8 > size - 16) { close(); return false; }
+
+    for (uint32_t t = 0; t < count; ++t) {
+        uint64_t offset = 0;
+        memcpy(&offset, base + 16 + t * 8, 8);
+        if (offset % 8 || offset > size) { close(); return false; }
+        pos = (size_t)offset;
+        const char* p = nullptr;
+        VocabTableHeader h;
+        if (!take(sizeof(h), p)) { close(); return false; }
+        memcpy(&h, p, sizeof(h));
+        const char* name = nullptr;
+        if (!take(h.name_len, name)) { close(); return false; }
+
+        VocabTable tab;
+        tab.n = h.n;
+        tab.empty = h.empty_id < h.n ? (int)h.empty_id : -1;
+        bool ok = true;
+        if (h.flags & TableStrings) {
+            ok = take(((size_t)h.n + 1) * 4, p);
+            tab.offsets = reinterpret_cast<const uint32_t*>(p);
+            ok = ok && tab.offsets[h.n] == h.arena_len && take((size_t)h.arena_len, tab.arena);
+            if (ok && (h.flags & TableIndex) && h.keys > 0) {
+                tab.keys = h.keys;
+                tab.buckets = h.buckets;
+                tab.seed = h.seed;
+                ok = h.buckets > 0 && take((size_t)h.buckets * 4, p);
+                tab.pilots = reinterpret_cast<const uint32_t*>(p);
+                ok = ok && take((size_t)h.keys * 4, p);
+                tab.slot_ids = reinterpret_cast<const uint32_t*>(p);
+            }
+            if (ok && (h.flags & TableDf)) {
+                ok = take((size_t)h.n * 4, p);
+                tab.df_data = reinterpret_cast<const uint32_t*>(p);
+            }
+        } else if (h.flags & TableDfPairs) {
+            ok = take((size_t)h.n * 8, p);
+            tab.df_data = reinterpret_cast<const uint32_t*>(p);
+            tab.paired_df = true;
+        }
+        if (!ok) { close(); return false; }
+        tabs.emplace_back(string_view(name, h.name_len), tab);
+    }
+    return true;
+}
+
+void VocabView::close() {
+    tabs.clear();
+    file.close();
+}
+
+const VocabTable* VocabView::table(string_view name) const {
+    for (const auto &t : tabs) if (t.first == name) return &t.second;
+    return nullptr;
+}
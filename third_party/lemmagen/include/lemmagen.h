@@ -26,6 +26,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define EXPORT_API __attribute__((visibility("default")))
 #endif
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -41,6 +43,9 @@ extern "C"
 #define STATUS_FILE_NOT_FOUND -1
 #define STATUS_FAILED -2
 
+/** Output buffers passed to lem_model_lemmatize must hold at least this many bytes. */
+#define LEM_MAX_OUTPUT_LEN 512
+
   /**
    * @brief Loads lemmatizer language binary file
    *
@@ -75,6 +80,57 @@ extern "C"
   */
   EXPORT_API void lem_unload_language_library(void);
 
+  /**
+   * @brief Loaded lemmatizer model, independent of the global one above
+   *
+   * The tree is memory-mapped read-only and never modified after opening, so
+   * one model can be used from any number of threads at once. Opening the same
+   * file again returns the same model with its reference count increased, and
+   * separate processes share the page-cache copy of the file. At opening the
+   * tree is also compiled into flat node arrays that lookups walk instead of
+   * the packed bytes (one copy per model, shared by all its users).
+   */
+  typedef struct lem_model lem_model;
+
+  /**
+   * @brief Opens (or re-references) the RDR tree binary file
+   *
+   * @param file_name Path to the RDR tree binary file
+   * @param status Receives STATUS_OK, STATUS_FILE_NOT_FOUND or STATUS_FAILED; may be NULL
+   * @return the model, or NULL on failure
+   */
+  EXPORT_API lem_model *lem_model_open(const char *file_name, int *status);
+
+  /**
+   * @brief Drops one reference; the mapping is released with the last one.
+   */
+  EXPORT_API void lem_model_close(lem_model *model);
+
+  /**
+   * @brief Lemmatizes a single word, reentrant
+   *
+   * @param model Model returned by lem_model_open
+   * @param input_word Word to lemmatize, null-terminated string
+   * @param output_word Buffer of at least LEM_MAX_OUTPUT_LEN bytes
+   * @return length of the lemma written to output_word
+   */
+  EXPORT_API size_t lem_model_lemmatize(const lem_model *model, const char *input_word, char *output_word);
+
+  /**
+   * @brief Lemmatizes count words at once, reentrant
+   *
+   * Several tree walks are interleaved to overlap their memory accesses; the
+   * output is the same as calling lem_model_lemmatize on each word.
+   *
+   * @param model Model returned by lem_model_open
+   * @param input_words count null-terminated words
+   * @param count Number of words
+   * @param output_words Buffer of count * LEM_MAX_OUTPUT_LEN bytes; lemma i starts at i * LEM_MAX_OUTPUT_LEN
+   * @param output_lens Receives count lemma lengths; may be NULL
+   */
+  EXPORT_API void lem_model_lemmatize_batch(const lem_model *model, const char *const *input_words, size_t count,
+                                            char *output_words, size_t *output_lens);
+
 #ifdef __cplusplus
 }
 #endif
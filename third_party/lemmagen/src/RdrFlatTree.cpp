@@ -0,0 +1,337 @@
+/******************************************************************************
+This file is part of the lemmagen library. It gives support for lemmatization.
+
+The lemmagen library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+******************************************************************************/
+#include "RdrFlatTree.h"
+#include <deque>
+#include <map>
+
+#if defined(__GNUC__) || defined(__clang__)
+	#define FLAT_PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER)
+	#include <xmmintrin.h>
+	#define FLAT_PREFETCH(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+	#define FLAT_PREFETCH(p)
+#endif
+
+//the walk helpers are only used in this file and have to be inlined into the loops
+#if defined(__GNUC__) || defined(__clang__)
+	#define FLAT_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+	#define FLAT_INLINE __forceinline
+#else
+	#define FLAT_INLINE inline
+#endif
+
+//words walked side by side in LemmatizeBatch
+#define FlatBatchWidth 8
+
+//-------------------------------------------------------------------------------------------
+//compiles the byte tree; the root is record 0 and hashtables are appended in
+//breadth-first order, one table per internal node even if it is reached twice
+bool RdrFlatTree::Compile(const uint8_t *abData, int32_t iDataLen)
+{
+	aRecs.clear();
+	aRules.clear();
+	acChars.clear();
+	if (abData == nullptr || iDataLen <= 0)
+		return false;
+
+	const uint32_t iLen = (uint32_t)iDataLen;
+	std::map<uint32_t, uint32_t> mRuleAt;	//rule node address -> aRules index
+	std::map<uint32_t, uint32_t> mTableAt;	//internal node address -> first record of its table
+	std::deque<std::pair<uint32_t, uint32_t> > qTables;	//(record, node address) still needing a table
+	auto has = [&](uint32_t iAddr, uint32_t iCount) { return iAddr <= iLen && iCount <= iLen - iAddr; };
+
+	//rule index of the rule node at iAddr; rule fields are only valid on rule nodes
+	auto rule_at = [&](uint32_t iAddr, uint32_t &iRule) -> bool {
+		std::map<uint32_t, uint32_t>::iterator it = mRuleAt.find(iAddr);
+		if (it != mRuleAt.end()) { iRule = it->second; return true; }
+		if (!has(iAddr, FlagLen + 2 * LenSpecLen)) return false;
+		RdrFlatRule rule;
+		rule.bType = abData[iAddr];
+		if ((rule.bType & ~BitEntireWr) != TypeRule) return false;
+		rule.bFromLen = abData[iAddr + FlagLen];
+		rule.bToLen = abData[iAddr + FlagLen + LenSpecLen];
+		uint32_t iTo = iAddr + FlagLen + 2 * LenSpecLen;
+		if (!has(iTo, rule.bToLen)) return false;
+		rule.iChars = (uint32_t)acChars.size();
+		acChars.insert(acChars.end(), abData + iTo, abData + iTo + rule.bToLen);
+		iRule = (uint32_t)aRules.size();
+		mRuleAt[iAddr] = iRule;
+		aRules.push_back(rule);
+		return true;
+	};
+
+	//fills everything but bChar and iSlots from the node at iAddr
+	auto describe = [&](uint32_t iAddr, RdrFlatRecord &rec) -> bool {
+		memset(&rec, 0, sizeof(rec));
+		if (!has(iAddr, FlagLen)) return false;
+		rec.bType = abData[iAddr];
+		if ((rec.bType & ~BitEntireWr) == TypeRule)
+			return rule_at(iAddr, rec.iRule);
+		if (!has(iAddr + FlagLen, AddrLen)) return false;
+		if (!rule_at(ReadDword(&abData[iAddr + FlagLen]), rec.iRule)) return false;
+		uint32_t iTmpAddr = iAddr + FlagLen + AddrLen;
+		if ((rec.bType & BitAddChar) == BitAddChar)
+		{
+			if (!has(iTmpAddr, LenSpecLen)) return false;
+			rec.bSufxLen = abData[iTmpAddr];
+			iTmpAddr += LenSpecLen;
+			if (!has(iTmpAddr, rec.bSufxLen)) return false;
+			if (rec.bSufxLen <= FlatInlineSufx)
+				memcpy(&rec.iChars, abData + iTmpAddr, rec.bSufxLen);
+			else
+			{
+				rec.iChars = (uint32_t)acChars.size();
+				acChars.insert(acChars.end(), abData + iTmpAddr, abData + iTmpAddr + rec.bSufxLen);
+			}
+			iTmpAddr += rec.bSufxLen;
+		}
+		if ((rec.bType & BitInternal) == BitInternal)
+		{
+			if (!has(iTmpAddr, ModLen)) return false;
+			rec.bMod = abData[iTmpAddr];
+			if (rec.bMod == 0 || !has(iTmpAddr + ModLen, rec.bMod * (CharLen + AddrLen))) return false;
+		}
+		return true;
+	};
+
+	RdrFlatRecord root;
+	bool bOk = describe(DataStart, root);
+	if (bOk)
+	{
+		aRecs.push_back(root);
+		if ((root.bType & BitInternal) == BitInternal)
+			qTables.push_back(std::make_pair(0u, (uint32_t)DataStart));
+	}
+
+	while (bOk && !qTables.empty())
+	{
+		uint32_t iRec = qTables.front().first;
+		uint32_t iAddr = qTables.front().second;
+		qTables.pop_front();
+
+		std::map<uint32_t, uint32_t>::iterator it = mTableAt.find(iAddr);
+		if (it != mTableAt.end())
+		{
+			aRecs[iRec].iSlots = it->second;
+			continue;
+		}
+
+		const uint8_t bMod = aRecs[iRec].bMod;
+		const uint32_t iSlots = (uint32_t)aRecs.size();
+		mTableAt[iAddr] = iSlots;
+		aRecs[iRec].iSlots = iSlots;
+
+		uint32_t iTmpAddr = iAddr + FlagLen + AddrLen;
+		if ((aRecs[iRec].bType & BitAddChar) == BitAddChar)
+			iTmpAddr += LenSpecLen + abData[iTmpAddr];
+		iTmpAddr += ModLen;
+
+		for (uint32_t i = 0; bOk && i < bMod; ++i, iTmpAddr += CharLen + AddrLen)
+		{
+			RdrFlatRecord slot;
+			const uint8_t bChar = abData[iTmpAddr];
+			const uint32_t iChild = ReadDword(&abData[iTmpAddr + CharLen]);
+			//word characters are never 0, so a 0 slot is only ever read as the
+			//entire-word entry of slot 0 and only if its address is not 0
+			if (bChar != 0 || (i == 0 && iChild != 0))
+			{
+				bOk = describe(iChild, slot);
+				if (bOk && (slot.bType & BitInternal) == BitInternal)
+					qTables.push_back(std::make_pair(iSlots + i, iChild));
+			}
+			else
+			{
+				memset(&slot, 0, sizeof(slot));
+				slot.bType = FlatDeadSlot;
+			}
+			slot.bChar = bChar;
+			aRecs.push_back(slot);
+		}
+	}
+
+	if (!bOk)
+	{
+		aRecs.clear();
+		aRules.clear();
+		acChars.clear();
+		return false;
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------------------
+FLAT_INLINE void RdrFlatTree::Start(RdrFlatState &s, const char *acWord) const
+{
+	const size_t len = strlen(acWord);
+	s.acWord = acWord;
+	s.bWordLen = len > 250 ? 250 : (uint8_t)len;
+	s.iRec = 0;
+	s.iParent = 0;
+	s.iRule = aRecs[0].iRule;
+	s.bLookChar = s.bWordLen;
+	s.bType = aRecs[0].bType;
+}
+
+//-------------------------------------------------------------------------------------------
+//one pass of the loop in RdrLemmatizer::Lemmatize; returns true when it would break
+FLAT_INLINE bool RdrFlatTree::Step(RdrFlatState &s) const
+{
+	const RdrFlatRecord &rec = aRecs[s.iRec];
+
+	//check if additional characters match
+	if ((s.bType & BitAddChar) == BitAddChar)
+	{
+		uint8_t bNewSufxLen = rec.bSufxLen;
+		const uint8_t *acSufx = bNewSufxLen <= FlatInlineSufx ? (const uint8_t *)&rec.iChars : acChars.data() + rec.iChars;
+		s.bLookChar -= bNewSufxLen;
+
+		if (s.bLookChar >= 0)
+			do
+				bNewSufxLen--;
+			while (bNewSufxLen != 255 && acSufx[bNewSufxLen] == (uint8_t)s.acWord[s.bLookChar + bNewSufxLen]);
+
+		//wrong node, take parents rule (bType stays that of this node, as in the original)
+		if (bNewSufxLen != 255)
+		{
+			s.iRec = s.iParent;
+			s.iRule = aRecs[s.iParent].iRule;
+			return true;
+		}
+
+		if ((s.bType & ~BitEntireWr) == TypeLeafAC)
+			return true;
+	}
+
+	s.bLookChar--;
+	if (s.bLookChar < 0)
+	{
+		//look for the entireword entry in hashtable slot 0
+		if ((s.bType & BitInternal) == BitInternal)
+		{
+			const RdrFlatRecord &slot = aRecs[rec.iSlots];
+			if (slot.bChar == 0 && slot.bType != FlatDeadSlot)
+			{
+				s.iParent = s.iRec;
+				s.iRec = rec.iSlots;
+				s.iRule = slot.iRule;
+				s.bType = slot.bType;
+				s.bLookChar++;
+			}
+		}
+		return true;
+	}
+
+	if ((s.bType & BitInternal) == BitInternal)
+	{
+		const uint8_t bChar = (uint8_t)s.acWord[s.bLookChar];
+		const uint32_t iSlot = rec.iSlots + bChar % rec.bMod;
+		const RdrFlatRecord &slot = aRecs[iSlot];
+		s.iParent = s.iRec;
+		if (slot.bChar == bChar)
+		{
+			s.iRec = iSlot;
+			s.iRule = slot.iRule;
+			s.bType = slot.bType;
+		}
+		else
+		{
+			//no child for this character: the node's own rule
+			s.iRule = rec.iRule;
+			s.bType = aRules[rec.iRule].bType;
+			return true;
+		}
+
+		if ((s.bType & ~BitEntireWr) == TypeRule)
+			return true;
+	}
+	return false;
+}
+
+//-------------------------------------------------------------------------------------------
+FLAT_INLINE size_t RdrFlatTree::Finish(const RdrFlatState &s, char *acOutBuffer) const
+{
+	//if this is entire-word node, and we are not at the begining of word it's wrong node - take parents
+	uint32_t iRule = s.iRule;
+	if ((s.bType & BitEntireWr) == BitEntireWr && s.bLookChar != 0)
+		iRule = aRecs[s.iParent].iRule;
+
+	const RdrFlatRule &rule = aRules[iRule];
+	uint8_t iStemLen = s.bWordLen - rule.bFromLen;
+	memcpy(acOutBuffer, s.acWord, iStemLen);
+	if (rule.bToLen != 0)
+		memcpy(&acOutBuffer[iStemLen], &acChars[rule.iChars], rule.bToLen);
+	acOutBuffer[iStemLen + rule.bToLen] = 0;
+	//not iStemLen + bToLen: like the original, a rule longer than the word wraps
+	//iStemLen and the result ends at the first 0 copied
+	return strlen(acOutBuffer);
+}
+
+//-------------------------------------------------------------------------------------------
+size_t RdrFlatTree::Lemmatize(const char *acWord, char *acOutBuffer) const
+{
+	RdrFlatState s;
+	Start(s, acWord);
+	while (!Step(s))
+		;
+	return Finish(s, acOutBuffer);
+}
+
+//-------------------------------------------------------------------------------------------
+void RdrFlatTree::LemmatizeBatch(const char *const *aacWords, size_t iCount, char *acOutBuffer, size_t iOutStride, size_t *aiOutLens) const
+{
+	RdrFlatState aStates[FlatBatchWidth];
+
+	for (size_t iFirst = 0; iFirst < iCount; iFirst += FlatBatchWidth)
+	{
+		const int iWidth = (int)(iCount - iFirst < FlatBatchWidth ? iCount - iFirst : FlatBatchWidth);
+		unsigned iActive = 0;
+		for (int i = 0; i < iWidth; ++i)
+		{
+			Start(aStates[i], aacWords[iFirst + i]);
+			iActive |= 1u << i;
+		}
+
+		//advance every word of the group by one node per round and prefetch the
+		//slot its next step will read, so the loads of the group overlap
+		while (iActive != 0)
+		{
+			for (int i = 0; i < iWidth; ++i)
+			{
+				if (!(iActive & (1u << i)))
+					continue;
+				RdrFlatState &s = aStates[i];
+				if (Step(s))
+				{
+					size_t iOutLen = Finish(s, acOutBuffer + (iFirst + i) * iOutStride);
+					if (aiOutLens != nullptr)
+						aiOutLens[iFirst + i] = iOutLen;
+					iActive &= ~(1u << i);
+					continue;
+				}
+				const RdrFlatRecord &rec = aRecs[s.iRec];
+				int iLook = s.bLookChar - 1;
+				if ((s.bType & BitAddChar) == BitAddChar)
+					iLook -= rec.bSufxLen;
+				if ((s.bType & BitInternal) == BitInternal && iLook >= 0)
+					FLAT_PREFETCH(&aRecs[rec.iSlots + (uint8_t)s.acWord[iLook] % rec.bMod]);
+			}
+		}
+	}
+}
@@ -0,0 +1,95 @@
+/******************************************************************************
+This file is part of the lemmagen library. It gives support for lemmatization.
+
+The lemmagen library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+******************************************************************************/
+#pragma once
+
+#include <vector>
+#include "RdrLemmatizer.h"
+
+//-------------------------------------------------------------------------------------------
+//RDR tree compiled into flat arrays.
+//
+//In the byte-packed tree one lookup step reads the node flag, its hashtable
+//slot and then the child's flag at some other address, usually on different
+//cache lines. Here the hashtable of an internal node is a contiguous run of
+//16-byte records and each record is the slot character together with the whole
+//child node, so a step reads a single record. Tables are laid out breadth-first
+//from the root, which keeps the hot top of the tree together; short suffixes
+//are stored inside the record and rules live in their own small table.
+//
+//Lemmatize walks the same states as RdrLemmatizer::Lemmatize step by step, so
+//the output is identical for every input word.
+
+#define FlatDeadSlot 0xFF	//bType of an empty hashtable slot
+#define FlatInlineSufx 4	//suffixes up to this length are kept in iChars itself
+
+struct RdrFlatRecord
+{
+	uint8_t bChar;		//hashtable slot character
+	uint8_t bType;		//node type, FlatDeadSlot for empty slots
+	uint8_t bSufxLen;	//AC nodes: length of the additional suffix
+	uint8_t bMod;		//internal nodes: hashtable size
+	uint32_t iRule;		//index in aRules of the node's rule (its own for rule nodes)
+	uint32_t iChars;	//AC nodes: suffix bytes, or offset in acChars when longer than FlatInlineSufx
+	uint32_t iSlots;	//internal nodes: first record of the hashtable
+};
+
+struct RdrFlatRule
+{
+	uint8_t bType;
+	uint8_t bFromLen;
+	uint8_t bToLen;
+	uint32_t iChars;	//offset of the ending in acChars
+};
+
+//walk state of one word, kept outside so that several words can be interleaved
+struct RdrFlatState
+{
+	const char *acWord;
+	uint8_t bWordLen;
+	uint32_t iRec;		//current record
+	uint32_t iParent;	//record of the parent node
+	uint32_t iRule;		//rule of the current node
+	int16_t bLookChar;
+	uint8_t bType;
+};
+
+class RdrFlatTree
+{
+public:
+	//returns false (and leaves the tree empty) if the data is not a tree this
+	//class can reproduce exactly; callers then keep using RdrLemmatizer
+	bool Compile(const uint8_t *abData, int32_t iDataLen);
+	bool Empty() const { return aRecs.empty(); }
+
+	//same contract as RdrLemmatizer::Lemmatize with a caller buffer; returns the lemma length
+	size_t Lemmatize(const char *acWord, char *acOutBuffer) const;
+
+	//lemmatizes iCount words, keeping several walks in flight so that the
+	//memory loads of one overlap with the work on the others;
+	//output i is written at acOutBuffer + i * iOutStride, its length to aiOutLens[i] if given
+	void LemmatizeBatch(const char *const *aacWords, size_t iCount, char *acOutBuffer, size_t iOutStride, size_t *aiOutLens) const;
+
+private:
+	std::vector<RdrFlatRecord> aRecs;	//aRecs[0] is the root
+	std::vector<RdrFlatRule> aRules;
+	std::vector<uint8_t> acChars;
+
+	void Start(RdrFlatState &s, const char *acWord) const;
+	bool Step(RdrFlatState &s) const;
+	size_t Finish(const RdrFlatState &s, char *acOutBuffer) const;
+};
@@ -24,22 +24,28 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 //-------------------------------------------------------------------------------------------
 //constructors
-RdrLemmatizer::RdrLemmatizer(const char *acFileName) : abData(nullptr), iDataLen(0)
+RdrLemmatizer::RdrLemmatizer(const char *acFileName) : abData(nullptr), iDataLen(0), bOwnsData(true)
 {
 	std::ifstream is(acFileName, std::ios_base::in | std::ios_base::binary);
 	is.exceptions(std::ifstream::badbit | std::ifstream::failbit | std::ifstream::eofbit);
 	
 	is.read(reinterpret_cast<char *>(&iDataLen), sizeof(iDataLen));
-	abData = new uint8_t[iDataLen];
-	is.read(reinterpret_cast<char *>(abData), iDataLen);
+	uint8_t *abBuffer = new uint8_t[iDataLen];
+	abData = abBuffer;
+	is.read(reinterpret_cast<char *>(abBuffer), iDataLen);
 	is.close();
 }
 
+RdrLemmatizer::RdrLemmatizer(const uint8_t *abTreeData, int32_t iTreeLen) : abData(abTreeData), iDataLen(iTreeLen), bOwnsData(false)
+{
+}
+
 //-------------------------------------------------------------------------------------------
 //destructor
 RdrLemmatizer::~RdrLemmatizer()
 {	
-	delete[] abData;
+	if (bOwnsData)
+		delete[] abData;
 }
 
 //-------------------------------------------------------------------------------------------
@@ -60,8 +60,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define TypeIntrAC		(BitDefault | BitAddChar | BitInternal)
 
 //-------------------------------------------------------------------------------------------
+//addresses inside the tree are not aligned, so dwords are read with memcpy
+static inline uint32_t ReadDword(const uint8_t *abAt)
+{
+	uint32_t wVal;
+	memcpy(&wVal, abAt, sizeof(wVal));
+	return wVal;
+}
+
 #define GETDWORD(type, wVar, wAddr) \
-			type wVar = *((uint32_t *) &abData[wAddr])
+			type wVar = ReadDword(&abData[wAddr])
 
 #define GETBYTEMOVE(type, bByte, iSize) \
 			type bByte = abData[iAddr]; \
@@ -81,11 +89,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 class RdrLemmatizer{
 public:
-	uint8_t* abData;
+	const uint8_t* abData;
 	int32_t iDataLen;
+	bool bOwnsData;
 
 public:	
 	RdrLemmatizer(const char *acFileName);	
+	//uses tree data owned by the caller (e.g. a mapped file), which must outlive the object
+	RdrLemmatizer(const uint8_t *abTreeData, int32_t iTreeLen);
 	~RdrLemmatizer();
 
 	uint32_t SizeOfTree() const;
@@ -22,11 +22,23 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
 #include <iostream>
+#include <map>
+#include <string>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include "../include/lemmagen.h"
 #include "RdrLemmatizer.h"
+#include "RdrFlatTree.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <limits.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
 
 #define HAS_MUTEX __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
 
@@ -34,9 +46,116 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #if HAS_MUTEX
 	#include <mutex>
 	static std::mutex mutex_lemmatizer;
+	static std::mutex mutex_models;
+#endif
+
+struct lem_model
+{
+	std::string key;
+	int refs;
+	const uint8_t *base;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
 #endif
+	RdrLemmatizer *tree;
+	RdrFlatTree flat;	//compiled copy of tree used for lookups; empty if it could not be built
+};
 
-static RdrLemmatizer *lemmatizer = nullptr;
+// open models by canonical path, so every Lemmatiser on the same file shares one mapping
+static std::map<std::string, lem_model *> models;
+
+// model behind the global lem_* functions
+static lem_model *lemmatizer = nullptr;
+
+static std::string canonical_path(const char *file_name)
+{
+#ifdef _WIN32
+	char buf[_MAX_PATH];
+	if (_fullpath(buf, file_name, _MAX_PATH) != nullptr)
+		return std::string(buf);
+#else
+	char buf[PATH_MAX];
+	if (realpath(file_name, buf) != nullptr)
+		return std::string(buf);
+#endif
+	return std::string(file_name);
+}
+
+static void unmap_model(lem_model *model)
+{
+	delete model->tree;
+#ifdef _WIN32
+	if (model->base != nullptr) UnmapViewOfFile(model->base);
+	if (model->mapping != nullptr) CloseHandle(model->mapping);
+	if (model->file != INVALID_HANDLE_VALUE) CloseHandle(model->file);
+#else
+	if (model->base != nullptr) munmap((void *)model->base, model->size);
+#endif
+	delete model;
+}
+
+// maps the file and checks the length prefix; the tree starts right after it
+static lem_model *map_model(const char *file_name, const std::string &key, int *status)
+{
+	lem_model *model = new lem_model();
+	model->key = key;
+	model->refs = 1;
+	model->base = nullptr;
+	model->size = 0;
+	model->tree = nullptr;
+#ifdef _WIN32
+	model->mapping = nullptr;
+	model->file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER fileSize;
+	if (model->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(model->file, &fileSize))
+	{
+		*status = STATUS_FILE_NOT_FOUND;
+		unmap_model(model);
+		return nullptr;
+	}
+	model->size = (size_t)fileSize.QuadPart;
+	if (model->size > sizeof(int32_t))
+	{
+		model->mapping = CreateFileMappingA(model->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (model->mapping != nullptr)
+			model->base = (const uint8_t *)MapViewOfFile(model->mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	int fd = open(file_name, O_RDONLY);
+	struct stat buf;
+	if (fd < 0 || fstat(fd, &buf) != 0)
+	{
+		if (fd >= 0) close(fd);
+		*status = STATUS_FILE_NOT_FOUND;
+		unmap_model(model);
+		return nullptr;
+	}
+	model->size = (size_t)buf.st_size;
+	if (model->size > sizeof(int32_t))
+	{
+		void *addr = mmap(nullptr, model->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (addr != MAP_FAILED)
+			model->base = (const uint8_t *)addr;
+	}
+	close(fd);
+#endif
+	int32_t iDataLen = 0;
+	if (model->base != nullptr)
+		memcpy(&iDataLen, model->base, sizeof(iDataLen));
+	if (model->base == nullptr || iDataLen <= 0 || (size_t)iDataLen > model->size - sizeof(int32_t))
+	{
+		std::cerr << "[ERROR] Language file " << std::string(file_name) << " is not a valid lemmatizer tree!" << std::endl;
+		*status = STATUS_FAILED;
+		unmap_model(model);
+		return nullptr;
+	}
+	model->tree = new RdrLemmatizer(model->base + sizeof(int32_t), iDataLen);
+	model->flat.Compile(model->tree->abData, model->tree->iDataLen);
+	*status = STATUS_OK;
+	return model;
+}
 
 
 #ifdef __cplusplus
@@ -44,44 +163,129 @@ extern "C"
 {
 #endif
 
-	EXPORT_API int lem_load_language_library(const char *file_name)
+	EXPORT_API lem_model *lem_model_open(const char *file_name, int *status)
 	{
-		#if HAS_MUTEX
-		std::lock_guard<std::mutex> lock(mutex_lemmatizer);
-		#endif
+		int dummy;
+		if (status == nullptr) status = &dummy;
+		if (file_name == nullptr)
+		{
+			*status = STATUS_FILE_NOT_FOUND;
+			return nullptr;
+		}
 
 		struct stat buf;
 		
 		if (stat(file_name, &buf) != 0)
 		{
 			std::cerr << "[ERROR] Language file " << std::string(file_name) << " could not be found!" << std::endl;
-			return STATUS_FILE_NOT_FOUND;
+			*status = STATUS_FILE_NOT_FOUND;
+			return nullptr;
 		}
 
 		if (!(buf.st_mode & S_IFREG))
 		{
 			std::cerr << "[ERROR] Language file " << std::string(file_name) << " is not a file!" << std::endl;
-			return STATUS_FILE_NOT_FOUND;
+			*status = STATUS_FILE_NOT_FOUND;
+			return nullptr;
 		}
 
-		if (lemmatizer != nullptr)
+		std::string key = canonical_path(file_name);
+
+		#if HAS_MUTEX
+		std::lock_guard<std::mutex> lock(mutex_models);
+		#endif
+
+		std::map<std::string, lem_model *>::iterator it = models.find(key);
+		if (it != models.end())
 		{
-			delete lemmatizer;
+			it->second->refs++;
+			*status = STATUS_OK;
+			return it->second;
 		}
 
-		try {
-			lemmatizer = new RdrLemmatizer(file_name);
-		} catch (std::ifstream::failure e) {
-			return STATUS_FILE_NOT_FOUND;
+		lem_model *model = map_model(file_name, key, status);
+		if (model != nullptr)
+			models[key] = model;
+		return model;
+	}
+
+	EXPORT_API void lem_model_close(lem_model *model)
+	{
+		if (model == nullptr)
+			return;
+
+		#if HAS_MUTEX
+		std::lock_guard<std::mutex> lock(mutex_models);
+		#endif
+
+		if (--model->refs > 0)
+			return;
+		models.erase(model->key);
+		unmap_model(model);
+	}
+
+	EXPORT_API size_t lem_model_lemmatize(const lem_model *model, const char *input_word, char *output_word)
+	{
+		if (output_word == nullptr)
+			return 0;
+		if (model == nullptr || input_word == nullptr)
+		{
+			output_word[0] = '\0';
+			return 0;
 		}
+		if (!model->flat.Empty())
+			return model->flat.Lemmatize(input_word, output_word);
+		model->tree->Lemmatize(input_word, output_word);
+		return strlen(output_word);
+	}
+
+	EXPORT_API void lem_model_lemmatize_batch(const lem_model *model, const char *const *input_words, size_t count,
+	                                          char *output_words, size_t *output_lens)
+	{
+		if (output_words == nullptr || count == 0)
+			return;
+		if (model != nullptr && !model->flat.Empty())
+		{
+			bool all_words = true;
+			for (size_t i = 0; i < count && all_words; ++i)
+				all_words = input_words[i] != nullptr;
+			if (all_words)
+			{
+				model->flat.LemmatizeBatch(input_words, count, output_words, LEM_MAX_OUTPUT_LEN, output_lens);
+				return;
+			}
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			size_t len = lem_model_lemmatize(model, input_words[i], output_words + i * LEM_MAX_OUTPUT_LEN);
+			if (output_lens != nullptr)
+				output_lens[i] = len;
+		}
+	}
+
+	EXPORT_API int lem_load_language_library(const char *file_name)
+	{
+		#if HAS_MUTEX
+		std::lock_guard<std::mutex> lock(mutex_lemmatizer);
+		#endif
+
+		int status = STATUS_FAILED;
+		lem_model *model = lem_model_open(file_name, &status);
+		if (model == nullptr)
+			return status;
+
+		if (lemmatizer != nullptr)
+		{
+			lem_model_close(lemmatizer);
+		}
+		lemmatizer = model;
 
 		return STATUS_OK;
 	}
 
 	EXPORT_API void lem_lemmatize_word(const char *input_word, char *output_word)
 	{
-		// TODO figure out fast locking for this to ensure thread safety
-		// Lemmatization should be reentrant, but initialization isn't.
+		// Not synchronized with lem_load/unload; use lem_model_* for concurrent use.
 		if (lemmatizer == nullptr)
 		{
 			std::cerr << "[ERROR] Language file for lemmatizer has to be loaded first!" << std::endl;
@@ -93,12 +297,7 @@ extern "C"
 			return;
 		}
 
-		if (input_word == nullptr) {
-			output_word[0] = '\0';
-			return;
-		}
-
-		lemmatizer->Lemmatize(input_word, output_word);
+		lem_model_lemmatize(lemmatizer, input_word, output_word);
 	}
 
 	EXPORT_API char *lem_lemmatize_word_alloc(const char *input_word)
@@ -109,18 +308,10 @@ extern "C"
 			return nullptr;
 		}
 
-		if (input_word == nullptr) {
-			char *return_val = (char *)malloc(sizeof(char));
-			return_val[0] = '\0';
-			return return_val;
-		}
-
-		char *output_word = lemmatizer->Lemmatize(input_word, nullptr);
-		// Output word is allocated with "new" so we have to reallocate to change to
-		// C-like malloc allocation
-		char *return_val = (char *)malloc(sizeof(char) * strlen(output_word) + 1);
-		strcpy(return_val, output_word);
-		delete[] output_word;
+		char output_word[LEM_MAX_OUTPUT_LEN];
+		size_t len = lem_model_lemmatize(lemmatizer, input_word, output_word);
+		char *return_val = (char *)malloc(sizeof(char) * len + 1);
+		memcpy(return_val, output_word, len + 1);
 
 		return return_val;
 	}
@@ -131,7 +322,7 @@ extern "C"
 		#endif
 
 		if (lemmatizer != nullptr) {
-			delete lemmatizer;
+			lem_model_close(lemmatizer);
 			lemmatizer = nullptr;
 		}
 	}